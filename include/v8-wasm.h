@@ -0,0 +1,221 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V8_V8_WASM_H_
+#define V8_V8_WASM_H_
+
+#include <string.h>
+
+#include "v8.h"  // NOLINT(build/include)
+
+/**
+ * Typed access to the exports of WebAssembly instances from C++.
+ */
+namespace v8 {
+
+/**
+ * The types of the parameters and results of WebAssembly functions.
+ */
+enum WasmValueType { kWasmI32, kWasmI64, kWasmF32, kWasmF64, kWasmVoid };
+
+/**
+ * Maps the C++ types of parameters and results to their WebAssembly types.
+ */
+template <typename T>
+struct WasmValueTypeOf;
+
+template <>
+struct WasmValueTypeOf<int32_t> {
+  static const WasmValueType value = kWasmI32;
+};
+
+template <>
+struct WasmValueTypeOf<int64_t> {
+  static const WasmValueType value = kWasmI64;
+};
+
+template <>
+struct WasmValueTypeOf<float> {
+  static const WasmValueType value = kWasmF32;
+};
+
+template <>
+struct WasmValueTypeOf<double> {
+  static const WasmValueType value = kWasmF64;
+};
+
+/**
+ * The part of a WasmExport that does not depend on its signature. It holds
+ * an entry function that calls the export with the values of a block of
+ * slots, in their machine representation, and stores the result into the
+ * first slot.
+ */
+class V8_EXPORT WasmExportBase {
+ public:
+  ~WasmExportBase();
+  WasmExportBase(WasmExportBase&& other);
+
+  /**
+   * Returns false if the instance has no export of the name, if its
+   * signature differs from the one of the handle, or if the export does not
+   * call its code directly, as for lazily compiled, tiered and shared code.
+   */
+  bool IsValid() const { return !entry_.IsEmpty(); }
+
+  /** The size of the slot of each value. */
+  static const int kSlotSize = 8;
+
+ protected:
+  WasmExportBase(Isolate* isolate, Local<Object> instance, const char* name,
+                 WasmValueType result, const WasmValueType* params,
+                 int param_count);
+
+  /**
+   * Calls the export with the parameters in their slots. Returns false if
+   * the call threw, in which case the exception is reported as for any
+   * other call into JavaScript.
+   */
+  bool Invoke();
+
+  static void WriteSlots(uint8_t* slot) {}
+
+  template <typename T, typename... Rest>
+  static void WriteSlots(uint8_t* slot, T value, Rest... rest) {
+    memcpy(slot, &value, sizeof(T));
+    WriteSlots(slot + kSlotSize, rest...);
+  }
+
+  /** The slot of the result, followed by one for each parameter. */
+  uint8_t* slots_;
+
+ private:
+  Isolate* isolate_;
+  /** Keeps the memory and the code that the entry function uses alive. */
+  Global<Object> instance_;
+  Global<Function> entry_;
+
+  WasmExportBase(const WasmExportBase&) = delete;
+  void operator=(const WasmExportBase&) = delete;
+};
+
+template <typename Sig>
+class WasmExport;
+
+/**
+ * A handle for calling an export with the C++ signature R(Args...).
+ */
+template <typename R, typename... Args>
+class WasmExport<R(Args...)> : public WasmExportBase {
+ public:
+  WasmExport(Isolate* isolate, Local<Object> instance, const char* name)
+      : WasmExportBase(isolate, instance, name, WasmValueTypeOf<R>::value,
+                       ParamTypes(), sizeof...(Args)) {}
+
+  /**
+   * Calls the export and stores its result into |result|. Returns false if
+   * the call threw.
+   */
+  bool Call(Args... args, R* result) {
+    WriteSlots(slots_ + kSlotSize, args...);
+    if (!Invoke()) return false;
+    memcpy(result, slots_, sizeof(R));
+    return true;
+  }
+
+ private:
+  static const WasmValueType* ParamTypes() {
+    static const WasmValueType types[] = {kWasmVoid,
+                                          WasmValueTypeOf<Args>::value...};
+    return types + 1;
+  }
+};
+
+/**
+ * A handle for calling an export that returns no value.
+ */
+template <typename... Args>
+class WasmExport<void(Args...)> : public WasmExportBase {
+ public:
+  WasmExport(Isolate* isolate, Local<Object> instance, const char* name)
+      : WasmExportBase(isolate, instance, name, kWasmVoid, ParamTypes(),
+                       sizeof...(Args)) {}
+
+  /**
+   * Calls the export. Returns false if the call threw.
+   */
+  bool Call(Args... args) {
+    WriteSlots(slots_ + kSlotSize, args...);
+    return Invoke();
+  }
+
+ private:
+  static const WasmValueType* ParamTypes() {
+    static const WasmValueType types[] = {kWasmVoid,
+                                          WasmValueTypeOf<Args>::value...};
+    return types + 1;
+  }
+};
+
+/**
+ * Gives C++ code typed access to the exports of a WebAssembly instance,
+ * which it calls with the WebAssembly calling convention instead of
+ * converting the values to and from JavaScript, e.g.
+ *
+ *   WasmInstance instance(isolate, object);
+ *   WasmExport<double(int32_t, double)> scale =
+ *       instance.GetExport<double(int32_t, double)>("scale");
+ *   double result;
+ *   if (scale.IsValid() && scale.Call(3, 0.5, &result)) ...
+ *
+ * The signature is checked once, when the handle is created. Handles keep
+ * the instance alive and stay valid beyond the handle scope they are created
+ * in, and calls through them do not allocate.
+ */
+class WasmInstance {
+ public:
+  WasmInstance(Isolate* isolate, Local<Object> instance)
+      : isolate_(isolate), instance_(instance) {}
+
+  template <typename Sig>
+  WasmExport<Sig> GetExport(const char* name) {
+    return WasmExport<Sig>(isolate_, instance_, name);
+  }
+
+ private:
+  Isolate* isolate_;
+  Local<Object> instance_;
+};
+
+/**
+ * Controls WASM.instantiateModuleAsync(), which decodes and compiles modules
+ * in tasks posted to the platform, both to background threads and to the
+ * isolate's thread. Since those tasks refer to the isolate, an embedder that
+ * enables it for an isolate has to abort the pending instantiations before
+ * disposing of the isolate:
+ *
+ *   WasmAsyncInstantiation::Enable(isolate);
+ *   ...
+ *   WasmAsyncInstantiation::Abort(isolate);
+ *   isolate->Dispose();
+ *
+ * WASM.instantiateModuleAsync() throws in isolates for which it has not been
+ * enabled, or which have been aborted.
+ */
+class V8_EXPORT WasmAsyncInstantiation {
+ public:
+  /** Allows asynchronous instantiations in |isolate|. */
+  static void Enable(Isolate* isolate);
+
+  /**
+   * Aborts the pending instantiations in |isolate|, whose promises then
+   * never settle, after waiting for their background tasks. The tasks still
+   * posted to the isolate's thread do nothing when they run. Disallows new
+   * instantiations. Must be called on the isolate's thread.
+   */
+  static void Abort(Isolate* isolate);
+};
+
+}  // namespace v8
+
+#endif  // V8_V8_WASM_H_
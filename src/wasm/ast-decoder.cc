@@ -143,6 +143,11 @@ class LR_WasmDecoder : public Decoder {
       }
     }
 
+    if (ok() && builder_) {
+      // Loops are complete only now, so their bounds checks can be hoisted.
+      builder_->HoistBoundsChecks();
+    }
+
     if (ok()) {
       if (FLAG_trace_wasm_decode_time) {
         double ms = decode_timer.Elapsed().InMillisecondsF();
@@ -226,6 +231,7 @@ class LR_WasmDecoder : public Decoder {
     ssa_env->control = start;
     ssa_env->effect = start;
     SetEnv("initial", ssa_env);
+    BUILD0(TierUpCheck);
   }
 
   void Leaf(LocalType type, TFNode* node = nullptr) {
@@ -349,6 +355,7 @@ class LR_WasmDecoder : public Decoder {
             PrepareForLoop(cont_env);
             SetEnv("loop:start", Split(cont_env));
             if (ssa_env_->go()) ssa_env_->state = SsaEnv::kReached;
+            BUILD0(TierUpCheck);
             PushBlock(cont_env);
             blocks_.back().stack_depth = -1;  // no production for inner block.
           }
@@ -973,8 +980,7 @@ class LR_WasmDecoder : public Decoder {
 
       case kExprGrowMemory:
         TypeCheckLast(p, kAstI32);
-        // TODO: build node for GrowMemory
-        p->tree->node = BUILD(Int32Constant, 0);
+        p->tree->node = BUILD(GrowMemory, p->last()->node);
         return;
 
       case kExprCallFunction: {
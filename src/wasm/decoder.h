@@ -33,7 +33,8 @@ class Decoder {
         pc_(start),
         limit_(end),
         error_pc_(nullptr),
-        error_pt_(nullptr) {}
+        error_pt_(nullptr),
+        fell_off_end_(false) {}
 
   virtual ~Decoder() {}
 
@@ -128,6 +129,7 @@ class Decoder {
 
     *length = static_cast<int>(pc_ - pos);
     if (pc_ == end && (b & 0x80)) {
+      if (ok() && end < pos + 5) fell_off_end_ = true;
       error(pc_ - 1, "varint too large");
     } else {
       TRACE("= %u\n", result);
@@ -138,6 +140,7 @@ class Decoder {
   // Check that at least {size} bytes exist between {pc_} and {limit_}.
   bool checkAvailable(int size) {
     if (pc_ < start_ || (pc_ + size) > limit_) {
+      if (ok() && pc_ >= start_) fell_off_end_ = true;
       error(pc_, nullptr, "expected %d bytes, fell off end", size);
       return false;
     } else {
@@ -211,17 +214,23 @@ class Decoder {
     error_pc_ = nullptr;
     error_pt_ = nullptr;
     error_msg_.Reset(nullptr);
+    fell_off_end_ = false;
   }
 
   bool ok() const { return error_pc_ == nullptr; }
   bool failed() const { return error_pc_ != nullptr; }
 
+  // Checks whether the first error was reading beyond {limit_}, which more
+  // bytes after {limit_} might have avoided.
+  bool fell_off_end() const { return fell_off_end_; }
+
  protected:
   const byte* start_;
   const byte* pc_;
   const byte* limit_;
   const byte* error_pc_;
   const byte* error_pt_;
+  bool fell_off_end_;
   base::SmartArrayPointer<char> error_msg_;
 };
 
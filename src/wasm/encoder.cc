@@ -64,7 +64,8 @@ WasmFunctionBuilder::WasmFunctionBuilder(Zone* zone)
       exported_(0),
       external_(0),
       body_(zone),
-      local_indices_(zone) {}
+      local_indices_(zone),
+      name_(zone) {}
 
 uint16_t WasmFunctionBuilder::AddParam(LocalType type) {
   return AddVar(type, true);
@@ -125,10 +126,18 @@ void WasmFunctionBuilder::Exported(uint8_t flag) { exported_ = flag; }
 
 void WasmFunctionBuilder::External(uint8_t flag) { external_ = flag; }
 
+void WasmFunctionBuilder::SetName(const char* name) {
+  name_.clear();
+  // Names are stored with their terminating null character.
+  for (const char* c = name; *c != '\0'; c++) name_.push_back(*c);
+  name_.push_back('\0');
+}
+
 WasmFunctionEncoder* WasmFunctionBuilder::Build(Zone* zone,
                                                 WasmModuleBuilder* mb) const {
   WasmFunctionEncoder* e =
       new (zone) WasmFunctionEncoder(zone, return_type_, exported_, external_);
+  e->name_.insert(e->name_.end(), name_.begin(), name_.end());
   auto var_index = new uint16_t[locals_.size()];
   IndexVars(e, var_index);
   const byte* start = body_.data();
@@ -212,10 +221,15 @@ void WasmFunctionBuilder::IndexVars(WasmFunctionEncoder* e,
 
 WasmFunctionEncoder::WasmFunctionEncoder(Zone* zone, LocalType return_type,
                                          bool exported, bool external)
-    : params_(zone), exported_(exported), external_(external), body_(zone) {}
+    : params_(zone),
+      exported_(exported),
+      external_(external),
+      body_(zone),
+      name_(zone) {}
 
 uint32_t WasmFunctionEncoder::HeaderSize() const {
   uint32_t size = 3;
+  if (HasName()) size += 4;
   if (HasLocals()) size += 8;
   if (!external_) size += 2;
   return size;
@@ -225,15 +239,27 @@ uint32_t WasmFunctionEncoder::BodySize(void) const {
   return external_ ? 0 : static_cast<uint32_t>(body_.size());
 }
 
+uint32_t WasmFunctionEncoder::NameSize() const {
+  return static_cast<uint32_t>(name_.size());
+}
+
 void WasmFunctionEncoder::Serialize(byte* buffer, byte** header,
                                     byte** body) const {
   uint8_t decl_bits = (exported_ ? kDeclFunctionExport : 0) |
                       (external_ ? kDeclFunctionImport : 0) |
+                      (HasName() ? kDeclFunctionName : 0) |
                       (HasLocals() ? kDeclFunctionLocals : 0);
 
   EmitUint8(header, decl_bits);
   EmitUint16(header, signature_index_);
 
+  if (HasName()) {
+    // The name goes after the end of the module, like data segments.
+    EmitUint32(header, static_cast<uint32_t>(*body - buffer));
+    std::memcpy(*body, name_.data(), name_.size());
+    (*body) += name_.size();
+  }
+
   if (HasLocals()) {
     EmitUint16(header, local_int32_count_);
     EmitUint16(header, local_int64_count_);
@@ -408,7 +434,8 @@ WasmModuleIndex* WasmModuleWriter::WriteTo(Zone* zone) const {
 
   sizes.AddSection(functions_.size());
   for (auto function : functions_) {
-    sizes.Add(function->HeaderSize() + function->BodySize(), 0);
+    sizes.Add(function->HeaderSize() + function->BodySize(),
+              function->NameSize());
   }
 
   sizes.AddSection(data_segments_.size());
@@ -24,6 +24,7 @@ class WasmFunctionEncoder : public ZoneObject {
  public:
   uint32_t HeaderSize() const;
   uint32_t BodySize() const;
+  uint32_t NameSize() const;
   void Serialize(byte* buffer, byte** header, byte** body) const;
 
  private:
@@ -39,7 +40,9 @@ class WasmFunctionEncoder : public ZoneObject {
   bool exported_;
   bool external_;
   ZoneVector<uint8_t> body_;
+  ZoneVector<char> name_;
 
+  bool HasName() const { return !name_.empty(); }
   bool HasLocals() const {
     return (local_int32_count_ + local_int64_count_ + local_float32_count_ +
             local_float64_count_) > 0;
@@ -61,6 +64,7 @@ class WasmFunctionBuilder : public ZoneObject {
   void EditImmediate(uint32_t offset, const byte immediate);
   void Exported(uint8_t flag);
   void External(uint8_t flag);
+  void SetName(const char* name);
   WasmFunctionEncoder* Build(Zone* zone, WasmModuleBuilder* mb) const;
 
  private:
@@ -73,6 +77,7 @@ class WasmFunctionBuilder : public ZoneObject {
   uint8_t external_;
   ZoneVector<uint8_t> body_;
   ZoneVector<uint32_t> local_indices_;
+  ZoneVector<char> name_;
   uint16_t AddVar(LocalType type, bool param);
   void IndexVars(WasmFunctionEncoder* e, uint16_t* var_index) const;
 };
@@ -27,7 +27,10 @@ class ModuleDecoder : public Decoder {
  public:
   ModuleDecoder(Zone* zone, const byte* module_start, const byte* module_end,
                 bool asm_js)
-      : Decoder(module_start, module_end), module_zone(zone), asm_js_(asm_js) {
+      : Decoder(module_start, module_end),
+        module_zone(zone),
+        asm_js_(asm_js),
+        deferred_offsets_(nullptr) {
     result_.start = start_;
     if (limit_ < start_) {
       error(start_, "end is less than start");
@@ -39,9 +42,8 @@ class ModuleDecoder : public Decoder {
     pc_ = limit_;  // On error, terminate section decoding loop.
   }
 
-  // Decodes an entire module.
-  ModuleResult DecodeModule(WasmModule* module, bool verify_functions = true) {
-    pc_ = start_;
+  // Initializes an empty module for the bytes of this decoder.
+  void InitModule(WasmModule* module) {
     module->module_start = start_;
     module->module_end = limit_;
     module->min_mem_size_log2 = 0;
@@ -53,6 +55,12 @@ class ModuleDecoder : public Decoder {
     module->functions = new std::vector<WasmFunction>();
     module->data_segments = new std::vector<WasmDataSegment>();
     module->function_table = new std::vector<uint16_t>();
+  }
+
+  // Decodes an entire module.
+  ModuleResult DecodeModule(WasmModule* module, bool verify_functions = true) {
+    pc_ = start_;
+    InitModule(module);
 
     bool sections[kMaxModuleSectionCode];
     memset(sections, 0, sizeof(sections));
@@ -189,6 +197,109 @@ class ModuleDecoder : public Decoder {
     return toResult(module);
   }
 
+  // Decodes the next item at {*pos} of a module whose bytes arrive in chunks:
+  // the header of a section, or the next of the {*remaining} entries of the
+  // current {*section}. {sections} records the sections whose headers have
+  // been decoded. Offsets beyond {limit_}, which can refer to bytes that have
+  // not arrived yet, are appended to {offsets} with their positions instead
+  // of being checked. Returns false without changing the module if the bytes
+  // up to {limit_} do not contain a complete and valid item; the item is
+  // incomplete rather than invalid if {fell_off_end()}.
+  bool DecodeStreamingItem(WasmModule* module, size_t* pos,
+                           WasmSectionDeclCode* section, uint32_t* remaining,
+                           bool* sections, DeferredOffsets* offsets) {
+    pc_ = start_ + *pos;
+    DeferredOffsets item_offsets;
+    deferred_offsets_ = &item_offsets;
+    if (*remaining == 0) {
+      WasmSectionDeclCode next =
+          static_cast<WasmSectionDeclCode>(u8("section"));
+      if (ok() && next < kMaxModuleSectionCode) {
+        CheckForPreviousSection(sections, next, false);
+        // Functions require signatures, and a function table functions.
+        if (next == kDeclFunctions) {
+          CheckForPreviousSection(sections, kDeclSignatures, true);
+        } else if (next == kDeclFunctionTable) {
+          CheckForPreviousSection(sections, kDeclFunctions, true);
+        }
+      }
+      uint32_t count = 0;
+      switch (next) {
+        case kDeclEnd:
+          break;
+        case kDeclMemory: {
+          uint8_t min_mem_size_log2 = u8("min memory");
+          uint8_t max_mem_size_log2 = u8("max memory");
+          bool mem_export = u8("export memory") != 0;
+          if (ok()) {
+            module->min_mem_size_log2 = min_mem_size_log2;
+            module->max_mem_size_log2 = max_mem_size_log2;
+            module->mem_export = mem_export;
+          }
+          break;
+        }
+        case kDeclSignatures:
+        case kDeclFunctions:
+        case kDeclGlobals:
+        case kDeclDataSegments:
+        case kDeclFunctionTable: {
+          int length;
+          count = u32v(&length, "entries count");
+          break;
+        }
+        default:
+          error(pc_ - 1, nullptr, "unrecognized section 0x%02x", next);
+          break;
+      }
+      if (failed()) return false;
+      if (next < kMaxModuleSectionCode) sections[next] = true;
+      *section = next;
+      *remaining = count;
+    } else {
+      switch (*section) {
+        case kDeclSignatures: {
+          FunctionSig* s = sig();
+          if (ok()) module->signatures->push_back(s);
+          break;
+        }
+        case kDeclFunctions: {
+          WasmFunction function = {nullptr, 0, 0, 0, 0, 0, 0, false, false};
+          DecodeFunctionInModule(module, &function, false);
+          if (ok()) module->functions->push_back(function);
+          break;
+        }
+        case kDeclGlobals: {
+          WasmGlobal global = {0, kMachInt32, 0, false};
+          DecodeGlobalInModule(&global);
+          if (ok()) module->globals->push_back(global);
+          break;
+        }
+        case kDeclDataSegments: {
+          WasmDataSegment segment = {0, 0, 0};
+          DecodeDataSegmentInModule(&segment);
+          if (ok()) module->data_segments->push_back(segment);
+          break;
+        }
+        case kDeclFunctionTable: {
+          uint16_t index = u16();
+          if (ok() && index >= module->functions->size()) {
+            error(pc_ - 2, "invalid function index");
+          }
+          if (ok()) module->function_table->push_back(index);
+          break;
+        }
+        default:
+          UNREACHABLE();
+          break;
+      }
+      if (failed()) return false;
+      (*remaining)--;
+    }
+    offsets->insert(offsets->end(), item_offsets.begin(), item_offsets.end());
+    *pos = static_cast<size_t>(pc_ - start_);
+    return true;
+  }
+
   uint32_t SafeReserve(uint32_t count) {
     // Avoid OOM by only reserving up to a certain size.
     const uint32_t kMaxReserve = 20000;
@@ -264,6 +375,7 @@ class ModuleDecoder : public Decoder {
   Zone* module_zone;
   ModuleResult result_;
   bool asm_js_;
+  DeferredOffsets* deferred_offsets_;
 
   uint32_t off(const byte* ptr) { return static_cast<uint32_t>(ptr - start_); }
 
@@ -386,8 +498,13 @@ class ModuleDecoder : public Decoder {
   // the offset is within bounds and advances.
   uint32_t offset(const char* name = nullptr) {
     uint32_t offset = u32(name ? name : "offset");
-    if (offset > (limit_ - start_)) {
-      error(pc_ - sizeof(uint32_t), "offset out of bounds of module");
+    if (ok() && offset > (limit_ - start_)) {
+      uint32_t pos = off(pc_ - sizeof(uint32_t));
+      if (deferred_offsets_) {
+        deferred_offsets_->push_back(std::make_pair(pos, offset));
+      } else {
+        error(start_ + pos, "offset out of bounds of module");
+      }
     }
     return offset;
   }
@@ -503,6 +620,79 @@ ModuleResult DecodeWasmModule(Isolate* isolate, Zone* zone,
   return decoder.DecodeModule(module, verify_functions);
 }
 
+StreamingModuleDecoder::StreamingModuleDecoder(Zone* zone)
+    : zone_(zone),
+      pos_(0),
+      module_(new WasmModule()),
+      section_(kDeclEnd),
+      remaining_(0),
+      done_(false) {
+  memset(sections_, 0, sizeof(sections_));
+  memset(complete_, 0, sizeof(complete_));
+  ModuleDecoder decoder(zone, nullptr, nullptr, false);
+  decoder.InitModule(module_);
+}
+
+StreamingModuleDecoder::~StreamingModuleDecoder() {
+  delete module_->globals;
+  delete module_->signatures;
+  delete module_->functions;
+  delete module_->data_segments;
+  delete module_->function_table;
+  delete module_;
+}
+
+bool StreamingModuleDecoder::AddBytes(const byte* bytes, size_t size) {
+  if (failed()) return false;
+  bytes_.insert(bytes_.end(), bytes, bytes + size);
+  module_->module_start = bytes_.data();
+  module_->module_end = bytes_.data() + bytes_.size();
+  // Decode the items that are complete now. An item that falls off the end
+  // of the bytes is retried with the next chunk; any other error is final.
+  while (!done_ && pos_ < bytes_.size()) {
+    ModuleDecoder decoder(zone_, module_->module_start, module_->module_end,
+                          false);
+    if (!decoder.DecodeStreamingItem(module_, &pos_, &section_, &remaining_,
+                                     sections_, &offsets_)) {
+      if (decoder.fell_off_end()) break;
+      ModuleResult result = decoder.toResult<WasmModule*>(nullptr);
+      error_.CopyFrom(result);
+      return false;
+    }
+    if (section_ == kDeclEnd) {
+      done_ = true;
+    } else if (remaining_ == 0) {
+      complete_[section_] = true;
+    }
+  }
+  return true;
+}
+
+ModuleResult StreamingModuleDecoder::Finish() {
+  ModuleResult result;
+  if (failed()) {
+    result.CopyFrom(error_);
+    return result;
+  }
+  ModuleDecoder decoder(zone_, module_->module_start, module_->module_end,
+                        false);
+  if (!done_ && (pos_ < bytes_.size() || remaining_ > 0)) {
+    // The module ends within an item, which fails to decode.
+    decoder.DecodeStreamingItem(module_, &pos_, &section_, &remaining_,
+                                sections_, &offsets_);
+  } else {
+    // Check the offsets that referred beyond the bytes of their chunks.
+    for (const std::pair<uint32_t, uint32_t>& offset : offsets_) {
+      if (offset.second > bytes_.size()) {
+        decoder.error(module_->module_start + offset.first,
+                      "offset out of bounds of module");
+        break;
+      }
+    }
+  }
+  return decoder.toResult(module_);
+}
+
 FunctionSig* DecodeWasmSignatureForTesting(Zone* zone, const byte* start,
                                            const byte* end) {
   ModuleDecoder decoder(zone, start, end, false);
@@ -16,6 +16,56 @@ ModuleResult DecodeWasmModule(Isolate* isolate, Zone* zone,
                               const byte* module_start, const byte* module_end,
                               bool verify_functions, bool asm_js);
 
+// Offsets into a module, with their positions in the module, that could not
+// be checked yet.
+typedef std::vector<std::pair<uint32_t, uint32_t>> DeferredOffsets;
+
+// Decodes a module from chunks of bytes as they arrive, entry by entry, so
+// that functions can be compiled before the rest of the module has arrived.
+// Offsets beyond the bytes received so far are checked by {Finish}. Function
+// bodies are not verified.
+class StreamingModuleDecoder {
+ public:
+  explicit StreamingModuleDecoder(Zone* zone);
+  ~StreamingModuleDecoder();
+
+  // Appends the next chunk of the module bytes and decodes the entries that
+  // it completes. Returns false once the bytes cannot be the start of a valid
+  // module, and ignores any later chunks.
+  bool AddBytes(const byte* bytes, size_t size);
+
+  // Checks that the module is complete once all bytes have arrived. Returns
+  // the module, which this decoder owns, or the first error in the bytes.
+  ModuleResult Finish();
+
+  // The first error in the bytes, found by {AddBytes}.
+  bool failed() const { return error_.failed(); }
+  ModuleResult& error() { return error_; }
+
+  // Checks whether all entries of {section} have been decoded.
+  bool IsComplete(WasmSectionDeclCode section) const {
+    DCHECK_LT(section, kMaxModuleSectionCode);
+    return complete_[section];
+  }
+
+  // The module decoded so far, which refers to the bytes received so far.
+  // The bytes move when more bytes arrive.
+  WasmModule* module() const { return module_; }
+
+ private:
+  Zone* zone_;
+  std::vector<byte> bytes_;
+  size_t pos_;
+  WasmModule* module_;
+  WasmSectionDeclCode section_;
+  uint32_t remaining_;
+  bool done_;
+  bool sections_[kMaxModuleSectionCode];
+  bool complete_[kMaxModuleSectionCode];
+  DeferredOffsets offsets_;
+  ModuleResult error_;
+};
+
 // Exposed for testing. Decodes a single function signature, allocating it
 // in the given zone. Returns {nullptr} upon failure.
 FunctionSig* DecodeWasmSignatureForTesting(Zone* zone, const byte* start,
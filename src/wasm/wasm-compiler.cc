@@ -7,6 +7,8 @@
 #include "src/compiler/change-lowering.h"
 #include "src/compiler/common-operator.h"
 #include "src/compiler/common-operator.h"
+#include "src/compiler/common-operator-reducer.h"
+#include "src/compiler/dead-code-elimination.h"
 #include "src/compiler/diamond.h"
 #include "src/compiler/graph-visualizer.h"
 #include "src/compiler/graph.h"
@@ -16,6 +18,7 @@
 #include "src/compiler/js-operator.h"
 #include "src/compiler/linkage.h"
 #include "src/compiler/linkage.h"
+#include "src/compiler/machine-operator-reducer.h"
 #include "src/compiler/machine-operator.h"
 #include "src/compiler/node-matchers.h"
 #include "src/compiler/pipeline.h"
@@ -23,6 +26,7 @@
 #include "src/compiler/simplified-operator.h"
 #include "src/compiler/source-position.h"
 #include "src/compiler/typer.h"
+#include "src/compiler/verifier.h"
 
 #include "src/code-stubs.h"
 #include "src/code-factory.h"
@@ -54,6 +58,182 @@ void MergeControlToEnd(JSGraph* graph, Node* node) {
 }
 
 
+// Computes an upper bound of the values of the 32-bit {index}, from constants,
+// masks, shifts and remainders, and from loads of narrow types.
+uint64_t MaxIndexValue(Node* index) {
+  switch (index->opcode()) {
+    case IrOpcode::kInt32Constant:
+      return Uint32Matcher(index).Value();
+    case IrOpcode::kWord32And: {
+      Uint32BinopMatcher m(index);
+      return std::min(MaxIndexValue(m.left().node()),
+                      MaxIndexValue(m.right().node()));
+    }
+    case IrOpcode::kWord32Shr: {
+      Uint32BinopMatcher m(index);
+      if (!m.right().HasValue()) break;
+      return MaxIndexValue(m.left().node()) >> (m.right().Value() & 0x1f);
+    }
+    case IrOpcode::kUint32Mod: {
+      Uint32BinopMatcher m(index);
+      if (!m.right().HasValue() || m.right().Value() == 0) break;
+      return m.right().Value() - 1;
+    }
+    case IrOpcode::kLoad: {
+      MachineType type = LoadRepresentationOf(index->op());
+      if (type == kMachUint8) return 0xff;
+      if (type == kMachUint16) return 0xffff;
+      break;
+    }
+    default:
+      break;
+  }
+  return kMaxUInt32;
+}
+
+// Checks whether the control node {dominator} dominates {node}, by walking up
+// from {node} through nodes whose dominator is known. Merges are not looked
+// through, so the answer is conservative.
+bool Dominates(Node* dominator, Node* node) {
+  static const int kMaxWalk = 256;
+  for (int i = 0; i < kMaxWalk; i++) {
+    if (node == dominator) return true;
+    switch (node->opcode()) {
+      case IrOpcode::kStart:
+      case IrOpcode::kMerge:
+        return false;
+      case IrOpcode::kLoop:
+        // A loop is dominated by the dominators of its entry.
+        node = node->InputAt(0);
+        break;
+      default:
+        if (node->op()->ControlInputCount() == 0) return false;
+        node = NodeProperties::GetControlInput(node);
+        break;
+    }
+  }
+  return false;
+}
+
+// Matches the condition of the branch that {projection} is taken from against
+// {index} < {bound}, which then holds where the projection is taken.
+bool MatchLessThan(Node* projection, Node* index, Node** bound,
+                   bool* is_signed) {
+  Node* cond = NodeProperties::GetControlInput(projection)->InputAt(0);
+  bool if_true = projection->opcode() == IrOpcode::kIfTrue;
+  switch (cond->opcode()) {
+    case IrOpcode::kUint32LessThan:
+    case IrOpcode::kInt32LessThan:
+      if (!if_true || cond->InputAt(0) != index) return false;
+      *bound = cond->InputAt(1);
+      break;
+    case IrOpcode::kUint32LessThanOrEqual:
+    case IrOpcode::kInt32LessThanOrEqual:
+      if (if_true || cond->InputAt(1) != index) return false;
+      *bound = cond->InputAt(0);
+      break;
+    default:
+      return false;
+  }
+  *is_signed = cond->opcode() == IrOpcode::kInt32LessThan ||
+               cond->opcode() == IrOpcode::kInt32LessThanOrEqual;
+  return true;
+}
+
+// Matches {index} against the phi of a loop with a single backedge, which
+// increments it by one.
+bool MatchInductionVariable(Node* index, Node** loop) {
+  if (index->opcode() != IrOpcode::kPhi || index->InputCount() != 3) {
+    return false;
+  }
+  Node* control = NodeProperties::GetControlInput(index);
+  if (control->opcode() != IrOpcode::kLoop) return false;
+  Int32BinopMatcher m(index->InputAt(1));
+  if (!m.IsInt32Add() || m.left().node() != index || !m.right().Is(1)) {
+    return false;
+  }
+  *loop = control;
+  return true;
+}
+
+// Finds the projection of a branch on {index} < {bound} that dominates
+// {control} within {loop}, walking up the same way as {Dominates}.
+Node* FindLoopGuard(Node* control, Node* loop, Node* index, Node** bound,
+                    bool* is_signed) {
+  while (control != loop) {
+    switch (control->opcode()) {
+      case IrOpcode::kIfTrue:
+      case IrOpcode::kIfFalse:
+        if (MatchLessThan(control, index, bound, is_signed)) return control;
+        control = NodeProperties::GetControlInput(
+            NodeProperties::GetControlInput(control));
+        break;
+      case IrOpcode::kStart:
+      case IrOpcode::kMerge:
+      case IrOpcode::kLoop:
+        return nullptr;
+      default:
+        if (control->op()->ControlInputCount() == 0) return nullptr;
+        control = NodeProperties::GetControlInput(control);
+        break;
+    }
+  }
+  return nullptr;
+}
+
+// Collects the control nodes of the body of {loop}, from which its backedge
+// can be reached without passing the loop.
+bool ComputeLoopBody(Zone* zone, Node* loop, ZoneSet<Node*>* body) {
+  ZoneVector<Node*> queue(zone);
+  queue.push_back(loop->InputAt(1));
+  while (!queue.empty()) {
+    Node* node = queue.back();
+    queue.pop_back();
+    if (node == loop || body->count(node)) continue;
+    if (node->opcode() == IrOpcode::kStart) return false;
+    body->insert(node);
+    for (int i = 0; i < node->op()->ControlInputCount(); i++) {
+      queue.push_back(NodeProperties::GetControlInput(node, i));
+    }
+  }
+  return true;
+}
+
+// Returns the value that {node} has before {loop}, or nullptr if it can
+// change within the loop.
+Node* LoopInvariantValue(Node* node, Node* loop, const ZoneSet<Node*>& body,
+                         int depth = 0) {
+  static const int kMaxDepth = 8;
+  if (depth > kMaxDepth) return nullptr;
+  switch (node->opcode()) {
+    case IrOpcode::kInt32Constant:
+    case IrOpcode::kParameter:
+      return node;
+    case IrOpcode::kPhi: {
+      Node* control = NodeProperties::GetControlInput(node);
+      if (control == loop) {
+        // Locals that the loop does not assign are phis of themselves.
+        for (int i = 1; i < node->op()->ValueInputCount(); i++) {
+          if (node->InputAt(i) != node) return nullptr;
+        }
+        return node->InputAt(0);
+      }
+      return body.count(control) ? nullptr : node;
+    }
+    default:
+      if (node->op()->EffectInputCount() > 0 ||
+          node->op()->ControlInputCount() > 0) {
+        return nullptr;
+      }
+      for (Node* input : node->inputs()) {
+        if (LoopInvariantValue(input, loop, body, depth + 1) != input) {
+          return nullptr;
+        }
+      }
+      return node;
+  }
+}
+
 enum TrapReason {
   kTrapUnreachable,
   kTrapMemOutOfBounds,
@@ -124,6 +304,21 @@ class WasmTrapHelper : public ZoneObject {
   void AddTrapIfFalse(TrapReason reason, Node* cond) {
     AddTrapIf(reason, cond, false);
   }
+  // Checks whether {node} is the merge of the sites of a trap.
+  bool IsTrapMerge(Node* node) {
+    for (int i = 0; i < kTrapCount; i++) {
+      if (traps[i] == node) return true;
+    }
+    return false;
+  }
+  // Checks whether {node} only leads to trap code.
+  bool IsTrapExit(Node* node) {
+    for (Edge edge : node->use_edges()) {
+      if (!NodeProperties::IsControlEdge(edge)) continue;
+      if (!IsTrapMerge(edge.from())) return false;
+    }
+    return true;
+  }
   // Add a trap if {cond} is true or false according to {iftrue}.
   void AddTrapIf(TrapReason reason, Node* cond, bool iftrue) {
     DCHECK_NOT_NULL(graph);
@@ -215,6 +410,12 @@ WasmGraphBuilder::WasmGraphBuilder(Zone* z, JSGraph* g)
       mem_buffer(nullptr),
       mem_size(nullptr),
       function_table(nullptr),
+      instance_context(nullptr),
+      globals_start(nullptr),
+      tier_up_index(-1),
+      hoist_bounds_checks(true),
+      bounds_checks(z),
+      last_bounds_checks(z),
       control(nullptr),
       effect(nullptr),
       cur_buffer(def_buffer),
@@ -1170,8 +1371,8 @@ Node* WasmGraphBuilder::BuildWasmCall(wasm::FunctionSig* sig, Node** args) {
   args[params + 1] = *effect;
   args[params + 2] = *control;
 
-  const Operator* op =
-      graph->common()->Call(module->GetWasmCallDescriptor(graph->zone(), sig));
+  const Operator* op = graph->common()->Call(
+      wasm::ModuleEnv::GetWasmCallDescriptor(graph->zone(), sig));
   Node* call = graph->graph()->NewNode(op, static_cast<int>(count), args);
 
   *effect = call;
@@ -1182,8 +1383,17 @@ Node* WasmGraphBuilder::CallDirect(uint32_t index, Node** args) {
   DCHECK_NOT_NULL(graph);
   DCHECK_NULL(args[0]);
 
-  // Add code object as constant.
-  args[0] = Constant(module->GetFunctionCode(index));
+  if (module->current_instance &&
+      module->module->functions->at(index).external) {
+    // Imports differ between the instances of the code.
+    args[0] = LoadCodeFromTable(Int32Constant(index));
+  } else if (module->code_table.is_null()) {
+    // Add code object as constant.
+    args[0] = Constant(module->GetFunctionCode(index));
+  } else {
+    // Load the code object from the code table, whose entries can change.
+    args[0] = LoadCodeFromTable(Int32Constant(index));
+  }
   wasm::FunctionSig* sig = module->GetFunctionSignature(index);
 
   return BuildWasmCall(sig, args);
@@ -1270,43 +1480,95 @@ Node* WasmGraphBuilder::FromJS(Node* node, Node* context,
                                wasm::LocalType type) {
   DCHECK_NOT_NULL(graph);
   Graph* g = graph->graph();
+  CommonOperatorBuilder* common = graph->common();
+  MachineOperatorBuilder* machine = graph->machine();
+  Node* start_effect = *effect;
+
+  // Smis and heap numbers are converted inline. Only other values go through
+  // the generic ToNumber, which may call back into JavaScript.
+  Node* is_smi = g->NewNode(
+      machine->WordEqual(),
+      g->NewNode(machine->WordAnd(), node, graph->IntPtrConstant(kSmiTagMask)),
+      graph->IntPtrConstant(kSmiTag));
+  Diamond smi(g, common, is_smi, BranchHint::kTrue);
+  smi.Chain(*control);
+  Node* smi_value =
+      g->NewNode(machine->WordSar(), node,
+                 graph->IntPtrConstant(kSmiShiftSize + kSmiTagSize));
+  if (machine->Is64()) {
+    smi_value = g->NewNode(machine->TruncateInt64ToInt32(), smi_value);
+  }
+
+  Node* map = g->NewNode(
+      machine->Load(kMachAnyTagged), node,
+      graph->IntPtrConstant(HeapObject::kMapOffset - kHeapObjectTag),
+      start_effect, smi.if_false);
+  Node* is_heap_number = g->NewNode(
+      machine->WordEqual(), map,
+      graph->HeapConstant(graph->isolate()->factory()->heap_number_map()));
+  Diamond number(g, common, is_heap_number, BranchHint::kTrue);
+  number.Nest(smi, false);
+  Node* number_value = g->NewNode(
+      machine->Load(kMachFloat64), node,
+      graph->IntPtrConstant(HeapNumber::kValueOffset - kHeapObjectTag), map,
+      number.if_true);
+
   // Do a JavaScript ToNumber.
   Node* num = g->NewNode(graph->javascript()->ToNumber(), node, context,
-                         graph->EmptyFrameState(), *effect, *control);
-  *control = num;
-  *effect = num;
+                         graph->EmptyFrameState(), map, number.if_false);
+  number.merge->ReplaceInput(1, num);
 
   // Change representation.
   SimplifiedOperatorBuilder simplified(graph->zone());
-  num = g->NewNode(simplified.ChangeTaggedToFloat64(), num);
+  Node* float_value =
+      number.Phi(kMachFloat64, number_value,
+                 g->NewNode(simplified.ChangeTaggedToFloat64(), num));
+  Node* float_effect = number.EffectPhi(number_value, num);
+  *effect = smi.EffectPhi(start_effect, float_effect);
+  *control = smi.merge;
 
   switch (type) {
-    case wasm::kAstI32: {
-      num = g->NewNode(
-          graph->machine()->TruncateFloat64ToInt32(TruncationMode::kJavaScript),
-          num);
+    case wasm::kAstI32:
       break;
-    }
     case wasm::kAstI64:
       // TODO(titzer): JS->i64 has no good solution right now. Using 32 bits.
-      num = g->NewNode(
-          graph->machine()->TruncateFloat64ToInt32(TruncationMode::kJavaScript),
-          num);
-      num = g->NewNode(graph->machine()->ChangeInt32ToInt64(), num);
+      smi_value = g->NewNode(machine->ChangeInt32ToInt64(), smi_value);
       break;
     case wasm::kAstF32:
-      num = g->NewNode(graph->machine()->TruncateFloat64ToFloat32(), num);
+      smi_value = g->NewNode(machine->ChangeInt32ToFloat64(), smi_value);
+      smi_value = g->NewNode(machine->TruncateFloat64ToFloat32(), smi_value);
       break;
     case wasm::kAstF64:
+      smi_value = g->NewNode(machine->ChangeInt32ToFloat64(), smi_value);
       break;
     case wasm::kAstStmt:
-      num = graph->Int32Constant(0);
-      break;
+      return graph->Int32Constant(0);
+    default:
+      UNREACHABLE();
+      return nullptr;
+  }
+  return smi.Phi(type, smi_value, FromFloat64(float_value, type));
+}
+
+Node* WasmGraphBuilder::FromFloat64(Node* node, wasm::LocalType type) {
+  MachineOperatorBuilder* machine = graph->machine();
+  Graph* g = graph->graph();
+  switch (type) {
+    case wasm::kAstI32:
+      return g->NewNode(
+          machine->TruncateFloat64ToInt32(TruncationMode::kJavaScript), node);
+    case wasm::kAstI64:
+      node = g->NewNode(
+          machine->TruncateFloat64ToInt32(TruncationMode::kJavaScript), node);
+      return g->NewNode(machine->ChangeInt32ToInt64(), node);
+    case wasm::kAstF32:
+      return g->NewNode(machine->TruncateFloat64ToFloat32(), node);
+    case wasm::kAstF64:
+      return node;
     default:
       UNREACHABLE();
       return nullptr;
   }
-  return num;
 }
 
 Node* WasmGraphBuilder::Invert(Node* node) {
@@ -1315,7 +1577,8 @@ Node* WasmGraphBuilder::Invert(Node* node) {
 }
 
 void WasmGraphBuilder::BuildJSToWasmWrapper(Handle<Code> wasm_code,
-                                            wasm::FunctionSig* sig) {
+                                            wasm::FunctionSig* sig,
+                                            uint32_t index) {
   DCHECK_NOT_NULL(graph);
 
   int params = static_cast<int>(sig->parameter_count());
@@ -1332,7 +1595,12 @@ void WasmGraphBuilder::BuildJSToWasmWrapper(Handle<Code> wasm_code,
       g->NewNode(graph->common()->Parameter(params + 1, "context"), start);
 
   int pos = 0;
-  args[pos++] = Constant(wasm_code);
+  if (module->code_table.is_null()) {
+    args[pos++] = Constant(wasm_code);
+  } else {
+    // Load the code object from the code table, whose entries can change.
+    args[pos++] = LoadCodeFromTable(Int32Constant(index));
+  }
 
   // Convert JS parameters to WASM numbers.
   for (int i = 0; i < params; i++) {
@@ -1340,6 +1608,9 @@ void WasmGraphBuilder::BuildJSToWasmWrapper(Handle<Code> wasm_code,
     args[pos++] = FromJS(param, context, sig->GetParam(i));
   }
 
+  // The conversions above may have entered other instances of the code.
+  if (module->current_instance) SetCurrentInstance();
+
   args[pos++] = *effect;
   args[pos++] = *control;
 
@@ -1349,7 +1620,7 @@ void WasmGraphBuilder::BuildJSToWasmWrapper(Handle<Code> wasm_code,
   Node* jsval =
       ToJS(call, context,
            sig->return_count() == 0 ? wasm::kAstStmt : sig->GetReturn());
-  Node* ret = g->NewNode(graph->common()->Return(), jsval, call, start);
+  Node* ret = g->NewNode(graph->common()->Return(), jsval, call, call);
 
   MergeControlToEnd(graph, ret);
 }
@@ -1358,7 +1629,7 @@ void WasmGraphBuilder::BuildWasmToJSWrapper(Handle<JSFunction> function,
                                             wasm::FunctionSig* sig) {
   DCHECK_NOT_NULL(graph);
   CHECK_NOT_NULL(graph);
-  int js_count = function->shared()->internal_formal_parameter_count();
+  bool direct = GetDirectCallArgumentCount(*function, sig) >= 0;
   int wasm_count = static_cast<int>(sig->parameter_count());
 
   // Build the start and the parameter nodes.
@@ -1376,8 +1647,9 @@ void WasmGraphBuilder::BuildWasmToJSWrapper(Handle<JSFunction> function,
   bool add_new_target_undefined = false;
 
   int pos = 0;
-  if (js_count == wasm_count) {
-    // exact arity match, just call the function directly.
+  if (direct) {
+    // The arity matches: call the function directly, without the arguments
+    // adaptor.
     desc = Linkage::GetJSCallDescriptor(g->zone(), false, wasm_count + 1,
                                         CallDescriptor::kNoFlags);
     arg_count_before_args = false;
@@ -1396,14 +1668,20 @@ void WasmGraphBuilder::BuildWasmToJSWrapper(Handle<JSFunction> function,
   if (arg_count_before_args) {
     args[pos++] = graph->Int32Constant(wasm_count);  // argument count
   }
-  args[pos++] = graph->UndefinedConstant();  // JS receiver.
+  if (direct && HasGlobalProxyReceiver(*function)) {
+    // The Call builtin would convert the undefined receiver of a sloppy
+    // function to the global proxy, which is known when compiling.
+    args[pos++] = graph->Constant(
+        handle(function->context()->global_proxy(), isolate));
+  } else {
+    args[pos++] = graph->UndefinedConstant();  // JS receiver.
+  }
 
   // Convert WASM numbers to JS values.
   for (int i = 0; i < wasm_count; i++) {
     Node* param = g->NewNode(graph->common()->Parameter(i), start);
     args[pos++] = ToJS(param, context, sig->GetParam(i));
   }
-
   if (add_new_target_undefined) {
     args[pos++] = graph->UndefinedConstant();  // new target
   }
@@ -1416,28 +1694,436 @@ void WasmGraphBuilder::BuildWasmToJSWrapper(Handle<JSFunction> function,
   args[pos++] = *control;
 
   Node* call = g->NewNode(graph->common()->Call(desc), pos, args);
+  *effect = call;
+  *control = call;
 
   // Convert the return value back.
   Node* val =
       FromJS(call, context,
              sig->return_count() == 0 ? wasm::kAstStmt : sig->GetReturn());
-  Node* ret = g->NewNode(graph->common()->Return(), val, call, start);
+  if (module && module->current_instance) {
+    // The JS function may have entered other instances of the code.
+    SetCurrentInstance();
+  }
+  Node* ret = g->NewNode(graph->common()->Return(), val, *effect, *control);
+
+  MergeControlToEnd(graph, ret);
+}
+
+Node* WasmGraphBuilder::BuildCallToJS(Handle<JSFunction> function,
+                                      Handle<JSObject> receiver, Node* arg,
+                                      Node* context) {
+  Isolate* isolate = graph->isolate();
+  Graph* g = graph->graph();
+  Callable callable = CodeFactory::Call(isolate);
+  CallDescriptor* desc = Linkage::GetStubCallDescriptor(
+      isolate, g->zone(), callable.descriptor(), 2, CallDescriptor::kNoFlags);
+  Node* inputs[] = {graph->HeapConstant(callable.code()),
+                    graph->Constant(function),  // JS function.
+                    graph->Int32Constant(1),    // argument count
+                    graph->Constant(receiver),  // JS receiver.
+                    arg,
+                    context,
+                    *effect,
+                    *control};
+  Node* call = g->NewNode(graph->common()->Call(desc),
+                          static_cast<int>(arraysize(inputs)), inputs);
+  *effect = call;
+  return call;
+}
+
+Node* WasmGraphBuilder::LoadCodeFromTable(Node* key) {
+  MachineOperatorBuilder* machine = graph->machine();
+  ElementAccess access = AccessBuilder::ForFixedArrayElement();
+  const int fixed_offset = access.header_size - access.tag();
+  Node* table;
+  if (module->current_instance) {
+    table = LoadInstanceTable(offsetof(wasm::WasmInstanceContext, code_table));
+  } else {
+    DCHECK(!module->code_table.is_null());
+    table = graph->Constant(module->code_table);
+  }
+  Node* load = graph->graph()->NewNode(
+      machine->Load(kMachAnyTagged), table,
+      graph->graph()->NewNode(
+          machine->Int32Add(),
+          graph->graph()->NewNode(machine->Word32Shl(), key,
+                                  Int32Constant(kPointerSizeLog2)),
+          Int32Constant(fixed_offset)),
+      *effect, *control);
+  *effect = load;
+  return load;
+}
+
+void WasmGraphBuilder::BuildLazyCompileStub(Handle<JSFunction> lazy_compile,
+                                            Handle<JSObject> instance,
+                                            Handle<HeapNumber> index,
+                                            wasm::FunctionSig* sig) {
+  DCHECK_NOT_NULL(graph);
+  int wasm_count = static_cast<int>(sig->parameter_count());
+
+  // Build the start and the parameter nodes.
+  Isolate* isolate = graph->isolate();
+  Graph* g = graph->graph();
+  Node* start = Start(wasm_count + 3);
+  *effect = start;
+  *control = start;
+  Node* context = Constant(Handle<Context>(lazy_compile->context(), isolate));
+
+  // Call the lazy compile function, which returns the index of the function
+  // to call as a Smi. The {index} is embedded as a heap number, so that
+  // copies of this stub can be patched for other functions with the same
+  // signature.
+  Node* call = BuildCallToJS(lazy_compile, instance,
+                             graph->HeapConstant(index), context);
+
+  // Load the code object from the code table.
+  SimplifiedOperatorBuilder simplified(graph->zone());
+  Node* load_code =
+      LoadCodeFromTable(g->NewNode(simplified.ChangeTaggedToInt32(), call));
+
+  // Call the code with the original parameters and return its result.
+  Node** args = Buffer(wasm_count + 1);
+  args[0] = load_code;
+  for (int i = 0; i < wasm_count; i++) {
+    args[i + 1] = g->NewNode(graph->common()->Parameter(i), start);
+  }
+  Node* result = BuildWasmCall(sig, args);
+  if (sig->return_count() == 0) {
+    ReturnVoid();
+  } else {
+    Node** rets = Buffer(1);
+    rets[0] = result;
+    Return(1, rets);
+  }
+}
+
+void WasmGraphBuilder::BuildTierUpStub(Handle<JSFunction> tier_up,
+                                       Handle<JSObject> instance) {
+  DCHECK_NOT_NULL(graph);
+
+  // Build the start and the function index parameter.
+  Isolate* isolate = graph->isolate();
+  Graph* g = graph->graph();
+  Node* start = Start(1 + 3);
+  *effect = start;
+  *control = start;
+  Node* context = Constant(Handle<Context>(tier_up->context(), isolate));
+  Node* index = g->NewNode(graph->common()->Parameter(0), start);
+
+  // Call the tier-up function with the index of the hot function.
+  BuildCallToJS(tier_up, instance, ToJS(index, context, wasm::kAstI32),
+                context);
+  ReturnVoid();
+}
+
+void WasmGraphBuilder::BuildGrowMemoryStub(Handle<JSFunction> grow_memory) {
+  DCHECK_NOT_NULL(graph);
+
+  // Build the start and the delta parameter.
+  Isolate* isolate = graph->isolate();
+  Graph* g = graph->graph();
+  Node* start = Start(1 + 3);
+  *effect = start;
+  *control = start;
+  Node* context = Constant(Handle<Context>(grow_memory->context(), isolate));
+  Node* delta = g->NewNode(graph->common()->Parameter(0), start);
+
+  // Call the grow memory function and return the old size of the memory.
+  Handle<JSObject> receiver(grow_memory->context()->global_proxy(), isolate);
+  Node* call = BuildCallToJS(grow_memory, receiver,
+                             ToJS(delta, context, wasm::kAstI32), context);
+  Node** rets = Buffer(1);
+  rets[0] = FromJS(call, context, wasm::kAstI32);
+  Return(1, rets);
+}
+
+void WasmGraphBuilder::BuildWasmToHostWrapper(Address function,
+                                              Handle<Code> trampoline,
+                                              wasm::FunctionSig* sig,
+                                              CallDescriptor* desc) {
+  DCHECK_NOT_NULL(graph);
+  int count = static_cast<int>(sig->parameter_count());
+  Graph* g = graph->graph();
+  Node* start = Start(count + 3);
+  *effect = start;
+  *control = start;
+
+  // Pass the parameters on unchanged, from the registers of the wasm calling
+  // convention to those of the C calling convention. A trampoline, if any,
+  // takes the address of the function first.
+  Node** args = Buffer(count + 4);
+  int pos = 0;
+  if (!trampoline.is_null()) args[pos++] = graph->HeapConstant(trampoline);
+  args[pos++] = graph->ExternalConstant(
+      ExternalReference(function, graph->isolate()));
+  for (int i = 0; i < count; i++) {
+    args[pos++] = g->NewNode(graph->common()->Parameter(i), start);
+  }
+  args[pos++] = *effect;
+  args[pos++] = *control;
+  Node* call = g->NewNode(graph->common()->Call(desc), pos, args);
+  *effect = call;
+  if (sig->return_count() == 0) {
+    ReturnVoid();
+  } else {
+    Node** rets = Buffer(1);
+    rets[0] = call;
+    Return(1, rets);
+  }
+}
+
+void WasmGraphBuilder::BuildWasmEntryWrapper(Handle<Code> wasm_code,
+                                             wasm::FunctionSig* sig,
+                                             Address slots) {
+  DCHECK_NOT_NULL(graph);
+  int params = static_cast<int>(sig->parameter_count());
+  Graph* g = graph->graph();
+  MachineOperatorBuilder* machine = graph->machine();
+  Node* start = Start(0 + 3);
+  *effect = start;
+  *control = start;
+
+  // The wrapper takes no parameters. It reads the parameters from the slots
+  // following the one for the result, which are outside of the heap, so that
+  // calls do not allocate.
+  Node* base = graph->IntPtrConstant(reinterpret_cast<intptr_t>(slots));
+  Node** args = Buffer(params + 1);
+  args[0] = graph->HeapConstant(wasm_code);
+  for (int i = 0; i < params; i++) {
+    int offset = (i + 1) * kWasmEntrySlotSize;
+    args[i + 1] = *effect =
+        g->NewNode(machine->Load(sig->GetParam(i)), base,
+                   graph->IntPtrConstant(offset), *effect, *control);
+  }
+  Node* call = BuildWasmCall(sig, args);
+  if (sig->return_count() > 0) {
+    StoreRepresentation rep(sig->GetReturn(), kNoWriteBarrier);
+    *effect = g->NewNode(machine->Store(rep), base, graph->IntPtrConstant(0),
+                         call, *effect, *control);
+  }
+  Node* ret = g->NewNode(graph->common()->Return(), graph->UndefinedConstant(),
+                         *effect, *control);
+  MergeControlToEnd(graph, ret);
+}
+
+void WasmGraphBuilder::BuildWasmBatchWrapper(Handle<Code> wasm_code,
+                                             wasm::FunctionSig* sig) {
+  DCHECK_NOT_NULL(graph);
+  int params = static_cast<int>(sig->parameter_count());
+  Graph* g = graph->graph();
+  MachineOperatorBuilder* machine = graph->machine();
+  Node* start = Start(1 + 3);
+  *effect = start;
+  *control = start;
+
+  // The only parameter is a byte array holding the number of calls, the
+  // address of the results and the address of the arguments of each
+  // parameter. They point outside of the heap, so they stay valid during the
+  // calls, unlike the array itself.
+  Node* array = g->NewNode(graph->common()->Parameter(0), start);
+  const int kFirstSlotOffset = ByteArray::kHeaderSize - kHeapObjectTag;
+  Node** slots = zone->NewArray<Node*>(params + 2);
+  for (int i = 0; i < params + 2; i++) {
+    int offset = kFirstSlotOffset + i * kWasmEntrySlotSize;
+    slots[i] = *effect =
+        g->NewNode(machine->Load(i == 0 ? kMachInt32 : kMachPtr), array,
+                   graph->IntPtrConstant(offset), *effect, *control);
+  }
+  Node* count = slots[0];
+
+  // Loop over the elements, the same way the decoder builds loops.
+  Node* zero = Int32Constant(0);
+  Node* loop = *control = Loop(*control);
+  Node* loop_effect = *effect = EffectPhi(1, effect, loop);
+  Terminate(loop_effect, loop);
+  Node* index = Phi(kAstI32, 1, &zero, loop);
+  Node* if_true;
+  Node* if_false;
+  Branch(g->NewNode(machine->Int32LessThan(), index, count), &if_true,
+         &if_false);
+  *control = if_true;
+
+  Node** args = Buffer(params + 1);
+  args[0] = graph->HeapConstant(wasm_code);
+  for (int i = 0; i < params; i++) {
+    wasm::LocalType type = sig->GetParam(i);
+    args[i + 1] = *effect =
+        g->NewNode(machine->Load(type), slots[i + 2],
+                   BuildBatchElementOffset(index, type), *effect, *control);
+  }
+  Node* call = BuildWasmCall(sig, args);
+  if (sig->return_count() > 0) {
+    wasm::LocalType type = sig->GetReturn();
+    StoreRepresentation rep(type, kNoWriteBarrier);
+    *effect = g->NewNode(machine->Store(rep), slots[1],
+                         BuildBatchElementOffset(index, type), call, *effect,
+                         *control);
+  }
+  AppendToMerge(loop, *control);
+  AppendToPhi(loop, loop_effect, *effect);
+  AppendToPhi(loop, index,
+              g->NewNode(machine->Int32Add(), index, Int32Constant(1)));
 
+  Node* ret = g->NewNode(graph->common()->Return(), graph->UndefinedConstant(),
+                         loop_effect, if_false);
   MergeControlToEnd(graph, ret);
 }
 
+Node* WasmGraphBuilder::BuildBatchElementOffset(Node* index,
+                                                wasm::LocalType type) {
+  MachineOperatorBuilder* machine = graph->machine();
+  Graph* g = graph->graph();
+  int size = wasm::WasmOpcodes::MemSize(type);
+  // Multiply at pointer width: the index is below the length of the typed
+  // array, whose byte length fits into the address space, while the product
+  // can exceed 32 bits for large arrays of 64-bit elements.
+  if (machine->Is64()) {
+    Node* index64 = g->NewNode(machine->ChangeUint32ToUint64(), index);
+    return g->NewNode(machine->Int64Mul(), index64, Int64Constant(size));
+  }
+  return g->NewNode(machine->Int32Mul(), index, Int32Constant(size));
+}
+
+void WasmGraphBuilder::BuildOutOfBoundsStub() {
+  DCHECK_NOT_NULL(graph);
+  Node* start = Start(3);
+  *effect = start;
+  *control = start;
+  trap->AddTrapIfFalse(kTrapMemOutOfBounds, graph->Int32Constant(0));
+  ReturnVoid();
+}
+
+Node* WasmGraphBuilder::TierUpCheck() {
+  if (tier_up_index < 0) return nullptr;
+  DCHECK(!module->tier_up_stub.is_null());
+  Graph* g = graph->graph();
+  MachineOperatorBuilder* machine = graph->machine();
+
+  // Count down the budget of the function.
+  Node* budget = graph->IntPtrConstant(
+      reinterpret_cast<intptr_t>(&module->tier_up_budgets[tier_up_index]));
+  Node* zero = graph->Int32Constant(0);
+  Node* load =
+      g->NewNode(machine->Load(kMachInt32), budget, zero, *effect, *control);
+  Node* value = g->NewNode(machine->Int32Sub(), load, graph->Int32Constant(1));
+  StoreRepresentation rep(kMachInt32, kNoWriteBarrier);
+  Node* store = g->NewNode(machine->Store(rep), budget, zero, value, load,
+                           *control);
+
+  // Call the tier-up stub when the budget is exhausted.
+  Diamond d(g, graph->common(),
+            g->NewNode(machine->Int32LessThanOrEqual(), value, zero),
+            BranchHint::kFalse);
+  d.Chain(*control);
+  *effect = store;
+  *control = d.if_true;
+  wasm::LocalType params[] = {wasm::kAstI32};
+  wasm::FunctionSig sig(0, 1, params);
+  Node** args = Buffer(2);
+  args[0] = graph->HeapConstant(module->tier_up_stub);
+  args[1] = graph->Int32Constant(tier_up_index);
+  Node* call = BuildWasmCall(&sig, args);
+  *effect = d.EffectPhi(call, store);
+  *control = d.merge;
+  return *effect;
+}
+
 Node* WasmGraphBuilder::MemBuffer(uint32_t offset) {
   if (!graph) return nullptr;
-  if (offset == 0) {
-    if (!mem_buffer) mem_buffer = graph->IntPtrConstant(module->mem_start);
-    return mem_buffer;
-  } else {
-    return graph->IntPtrConstant(module->mem_start + offset);
+  if (module->current_instance) {
+    if (!mem_buffer) {
+      mem_buffer = LoadInstanceField(
+          kMachPtr, offsetof(wasm::WasmInstanceContext, mem_start));
+    }
+    if (offset == 0) return mem_buffer;
+    return graph->graph()->NewNode(graph->machine()->IntAdd(), mem_buffer,
+                                   graph->IntPtrConstant(offset));
+  }
+  // The start of the memory is embedded on its own, and offsets are added to
+  // it, so that the serializer recognizes references to the memory by their
+  // address.
+  if (!mem_buffer) mem_buffer = ExternalAddress(module->mem_start);
+  if (offset == 0) return mem_buffer;
+  return graph->graph()->NewNode(graph->machine()->IntAdd(), mem_buffer,
+                                 graph->IntPtrConstant(offset));
+}
+
+// Addresses of the linear memory, the globals and the instance contexts are
+// embedded as external references, so that they carry relocation
+// information and code can be relinked against another instance.
+Node* WasmGraphBuilder::ExternalAddress(uintptr_t address) {
+  return graph->ExternalConstant(
+      ExternalReference::ForDeoptEntry(reinterpret_cast<Address>(address)));
+}
+
+// The context of the current instance does not change during the execution
+// of a function, since wrappers reinstall it when returning from JS. Hence
+// the context and its fields are loaded once, at the start of the function.
+Node* WasmGraphBuilder::InstanceContext() {
+  DCHECK_NOT_NULL(module->current_instance);
+  if (!instance_context) {
+    Node* start = graph->graph()->start();
+    instance_context = graph->graph()->NewNode(
+        graph->machine()->Load(kMachPtr),
+        ExternalAddress(reinterpret_cast<uintptr_t>(module->current_instance)),
+        graph->Int32Constant(0), start, start);
   }
+  return instance_context;
+}
+
+Node* WasmGraphBuilder::LoadInstanceField(MachineType type, size_t offset) {
+  Node* start = graph->graph()->start();
+  return graph->graph()->NewNode(
+      graph->machine()->Load(type), InstanceContext(),
+      graph->Int32Constant(static_cast<int32_t>(offset)), start, start);
+}
+
+// Tables are heap objects that can move, so they are loaded at each use
+// through the location of their handle in the instance context.
+Node* WasmGraphBuilder::LoadInstanceTable(size_t offset) {
+  Node* location = LoadInstanceField(kMachPtr, offset);
+  Node* table = graph->graph()->NewNode(graph->machine()->Load(kMachAnyTagged),
+                                        location, graph->Int32Constant(0),
+                                        *effect, *control);
+  *effect = table;
+  return table;
+}
+
+// Installs the context of the instance that a wrapper belongs to as the
+// current instance of the code.
+void WasmGraphBuilder::SetCurrentInstance() {
+  StoreRepresentation rep(kMachPtr, kNoWriteBarrier);
+  Node* store = graph->graph()->NewNode(
+      graph->machine()->Store(rep),
+      ExternalAddress(reinterpret_cast<uintptr_t>(module->current_instance)),
+      graph->Int32Constant(0),
+      ExternalAddress(reinterpret_cast<uintptr_t>(module->instance_context)),
+      *effect, *control);
+  *effect = store;
 }
 
 Node* WasmGraphBuilder::MemSize(uint32_t offset) {
   if (!graph) return nullptr;
+  if (HasDynamicMemSize()) {
+    // The memory can grow during any call, so its size is loaded at each use.
+    Node* base;
+    size_t field = offsetof(wasm::WasmInstanceContext, mem_size);
+    if (module->current_instance) {
+      base = InstanceContext();
+    } else {
+      base = ExternalAddress(
+          reinterpret_cast<uintptr_t>(module->instance_context) + field);
+      field = 0;
+    }
+    Node* size = graph->graph()->NewNode(
+        graph->machine()->Load(kMachUint32), base,
+        graph->Int32Constant(static_cast<int32_t>(field)), *effect, *control);
+    *effect = size;
+    if (offset == 0) return size;
+    return graph->graph()->NewNode(graph->machine()->Int32Add(), size,
+                                   graph->Int32Constant(offset));
+  }
   int32_t size = static_cast<int>(module->mem_end - module->mem_start);
   if (offset == 0) {
     if (!mem_size) mem_size = graph->Int32Constant(size);
@@ -1447,9 +2133,33 @@ Node* WasmGraphBuilder::MemSize(uint32_t offset) {
   }
 }
 
+// The size of the memory is loaded from an instance context if the code is
+// shared between instances, or if the memory of the instance can grow.
+bool WasmGraphBuilder::HasDynamicMemSize() {
+  return module->current_instance || module->instance_context;
+}
+
+Node* WasmGraphBuilder::GrowMemory(Node* delta) {
+  if (!graph) return nullptr;
+  if (module->grow_memory_stub.is_null()) {
+    // The memory cannot grow.
+    return graph->Int32Constant(-1);
+  }
+  wasm::LocalType types[] = {wasm::kAstI32, wasm::kAstI32};
+  wasm::FunctionSig sig(1, 1, types);
+  Node** args = Buffer(2);
+  args[0] = graph->HeapConstant(module->grow_memory_stub);
+  args[1] = delta;
+  return BuildWasmCall(&sig, args);
+}
+
 
 Node* WasmGraphBuilder::FunctionTable() {
   if (!graph) return nullptr;
+  if (module->current_instance) {
+    return LoadInstanceTable(
+        offsetof(wasm::WasmInstanceContext, function_table));
+  }
   if (!function_table) {
     DCHECK(!module->function_table.is_null());
     function_table = graph->Constant(module->function_table);
@@ -1458,14 +2168,32 @@ Node* WasmGraphBuilder::FunctionTable() {
 }
 
 
+void WasmGraphBuilder::GlobalAddress(uint32_t index, Node** base,
+                                     Node** offset) {
+  uint32_t global_offset = module->module->globals->at(index).offset;
+  if (module->current_instance) {
+    if (!globals_start) {
+      globals_start = LoadInstanceField(
+          kMachPtr, offsetof(wasm::WasmInstanceContext, globals_start));
+    }
+    *base = globals_start;
+    *offset = graph->Int32Constant(global_offset);
+  } else {
+    // Like the start of the memory, the start of the globals area is
+    // embedded on its own.
+    *base = ExternalAddress(module->globals_area);
+    *offset = graph->Int32Constant(global_offset);
+  }
+}
+
 Node* WasmGraphBuilder::LoadGlobal(uint32_t index) {
   DCHECK_NOT_NULL(graph);
   MachineType mem_type = module->GetGlobalType(index);
-  Node* addr = graph->IntPtrConstant(module->globals_area +
-                                     module->module->globals->at(index).offset);
+  Node* base;
+  Node* offset;
+  GlobalAddress(index, &base, &offset);
   const Operator* op = graph->machine()->Load(mem_type);
-  Node* node = graph->graph()->NewNode(op, addr, graph->Int32Constant(0),
-                                       *effect, *control);
+  Node* node = graph->graph()->NewNode(op, base, offset, *effect, *control);
   *effect = node;
   return node;
 }
@@ -1474,56 +2202,441 @@ Node* WasmGraphBuilder::LoadGlobal(uint32_t index) {
 Node* WasmGraphBuilder::StoreGlobal(uint32_t index, Node* val) {
   DCHECK_NOT_NULL(graph);
   MachineType mem_type = module->GetGlobalType(index);
-  Node* addr = graph->IntPtrConstant(module->globals_area +
-                                     module->module->globals->at(index).offset);
+  Node* base;
+  Node* offset;
+  GlobalAddress(index, &base, &offset);
   const Operator* op =
       graph->machine()->Store(StoreRepresentation(mem_type, kNoWriteBarrier));
-  Node* node = graph->graph()->NewNode(op, addr, graph->Int32Constant(0), val,
-                                       *effect, *control);
+  Node* node =
+      graph->graph()->NewNode(op, base, offset, val, *effect, *control);
   *effect = node;
   return node;
 }
 
-void WasmGraphBuilder::BoundsCheckMem(MachineType memtype, Node* index,
-                                      uint32_t offset) {
-  // TODO(turbofan): fold bounds checks for constant indexes.
+Node* WasmGraphBuilder::BoundsCheckMem(MachineType memtype, Node* index,
+                                       uint32_t offset) {
   Graph* g = graph->graph();
+  if (module->guard_pages) {
+    // The guard pages cover any index and offset, as long as the index is
+    // zero-extended to compute the address.
+    return g->NewNode(graph->machine()->ChangeUint32ToUint64(), index);
+  }
   CHECK_GE(module->mem_end, module->mem_start);
-  ptrdiff_t size = module->mem_end - module->mem_start;
+  // The memory never shrinks, so its size at compile time is a lower bound
+  // of its size at run time.
+  uint64_t size = module->mem_end - module->mem_start;
   byte memsize = wasm::WasmOpcodes::MemSize(memtype);
+  uint64_t end = static_cast<uint64_t>(offset) + memsize;
+
+  // Omit the check if the access is within the memory for any value that the
+  // index can take, or if a dominating check of the same index covers it.
+  if (MaxIndexValue(index) + end <= size) return index;
+  int previous = -1;
+  auto last = last_bounds_checks.find(index);
+  if (last != last_bounds_checks.end()) {
+    previous = last->second;
+    for (int i = previous; i >= 0; i = bounds_checks[i].previous) {
+      const BoundsCheck& check = bounds_checks[i];
+      if (check.end >= end && Dominates(check.control, *control)) {
+        return index;
+      }
+    }
+  }
+
   Node* cond;
-  if (offset >= size || (offset + memsize) > size) {
+  if (HasDynamicMemSize()) {
+    // Check against the current size of the memory of the instance.
+    if (end > kMaxUInt32) {
+      cond = graph->Int32Constant(0);
+    } else {
+      MachineOperatorBuilder* machine = graph->machine();
+      Node* current_size = MemSize(0);
+      Node* end_node = graph->Int32Constant(static_cast<uint32_t>(end));
+      Node* limit = g->NewNode(machine->Int32Sub(), current_size, end_node);
+      cond = g->NewNode(
+          machine->Word32And(),
+          g->NewNode(machine->Uint32LessThanOrEqual(), end_node, current_size),
+          g->NewNode(machine->Uint32LessThanOrEqual(), index, limit));
+    }
+  } else if (end > size) {
     // The access will always throw.
     cond = graph->Int32Constant(0);
   } else {
     // Check against the limit.
-    size_t limit = size - offset - memsize;
+    uint64_t limit = size - end;
     CHECK(limit <= kMaxUInt32);
     cond = g->NewNode(graph->machine()->Uint32LessThanOrEqual(), index,
                       graph->Int32Constant(static_cast<uint32_t>(limit)));
   }
 
   trap->AddTrapIfFalse(kTrapMemOutOfBounds, cond);
+  BoundsCheck check = {index, end, *control, previous};
+  last_bounds_checks[index] = static_cast<int>(bounds_checks.size());
+  bounds_checks.push_back(check);
+  return index;
 }
 
 
-Node* WasmGraphBuilder::LoadMem(wasm::LocalType type, MachineType memtype,
-                                Node* index, uint32_t offset) {
-  if (!graph) return nullptr;
+// Hoists the bounds checks of accesses indexed by the induction variable of
+// a loop out of the loop, if the loop only exits where the induction
+// variable reaches a loop invariant bound. A single check before the loop
+// then covers the whole range of the induction variable. The loop is
+// versioned on that check: a copy of the loop without the hoisted checks
+// runs if it holds, and the original loop with all its checks otherwise, so
+// that out of bounds accesses still trap where they happen.
+void WasmGraphBuilder::HoistBoundsChecks() {
+  if (!graph || !hoist_bounds_checks || HasDynamicMemSize() ||
+      module->guard_pages) {
+    return;
+  }
+  ZoneVector<Node*> loops(zone);
+  bool versioned = false;
+  for (const BoundsCheck& check : bounds_checks) {
+    Node* loop;
+    if (MatchInductionVariable(check.index, &loop) &&
+        std::find(loops.begin(), loops.end(), loop) == loops.end()) {
+      loops.push_back(loop);
+    }
+  }
+  for (Node* loop : loops) {
+    ZoneSet<Node*> body(zone);
+    if (!ComputeLoopBody(zone, loop, &body)) continue;
+    Node* guard = nullptr;
+    Node* cond = nullptr;
+    ZoneVector<Node*> branches(zone);
+    for (const BoundsCheck& check : bounds_checks) {
+      Node* ok = HoistedBoundsCheck(check, loop, body, &guard);
+      if (!ok) continue;
+      cond = cond ? graph->graph()->NewNode(graph->machine()->Word32And(),
+                                            cond, ok)
+                  : ok;
+      branches.push_back(NodeProperties::GetControlInput(check.control));
+    }
+    if (!cond) continue;
+    if (VersionLoop(loop, body, guard, cond, branches)) {
+      versioned = true;
+    } else if (FLAG_trace_wasm_compiler) {
+      PrintF("Not versioning loop #%d\n", loop->id());
+    }
+  }
+#ifdef DEBUG
+  // Check the graph with the copies of the versioned loops.
+  if (versioned) Verifier::Run(graph->graph(), Verifier::UNTYPED);
+#endif
+}
 
+// Returns the condition under which {check} holds on every iteration of
+// {loop}, computed before the loop, or nullptr if there is none. Checks of
+// the same loop have to share their {guard}.
+Node* WasmGraphBuilder::HoistedBoundsCheck(const BoundsCheck& check,
+                                           Node* loop,
+                                           const ZoneSet<Node*>& body,
+                                           Node** guard) {
+  MachineOperatorBuilder* machine = graph->machine();
   Graph* g = graph->graph();
-  Node* load;
-
-  if (module && module->asm_js) {
-    // asm.js semantics use CheckedLoad (i.e. OOB reads return 0ish).
-    DCHECK_EQ(0, offset);
-    const Operator* op = graph->machine()->CheckedLoad(memtype);
-    load = g->NewNode(op, MemBuffer(0), index, MemSize(0), *effect, *control);
-  } else {
-    // WASM semantics throw on OOB. Introduce explicit bounds check.
-    BoundsCheckMem(memtype, index, offset);
-    load = g->NewNode(graph->machine()->Load(memtype), MemBuffer(offset), index,
-                      *effect, *control);
+  uint64_t size = module->mem_end - module->mem_start;
+  Node* branch = NodeProperties::GetControlInput(check.control);
+  if (check.end > size || Int32Matcher(branch->InputAt(0)).HasValue()) {
+    return nullptr;
+  }
+  // The check has to be taken on every iteration, after the guard.
+  Node* check_loop;
+  if (!MatchInductionVariable(check.index, &check_loop) ||
+      check_loop != loop || !Dominates(check.control, loop->InputAt(1))) {
+    return nullptr;
+  }
+  Node* bound;
+  bool is_signed;
+  Node* check_guard =
+      FindLoopGuard(check.control, loop, check.index, &bound, &is_signed);
+  if (!check_guard || (*guard && *guard != check_guard) ||
+      !HasSingleExit(loop, body, check_guard)) {
+    return nullptr;
+  }
+  Node* entry_bound = LoopInvariantValue(bound, loop, body);
+  uint64_t max_bound = size - check.end + 1;
+  if (!entry_bound || (is_signed && max_bound > kMaxInt)) return nullptr;
+  *guard = check_guard;
+
+  // The loop either does not run, or runs from its initial index up to the
+  // bound, all within the memory.
+  Node* init = check.index->InputAt(0);
+  Node* max_node = graph->Int32Constant(static_cast<uint32_t>(max_bound));
+  if (is_signed) {
+    return g->NewNode(
+        machine->Word32Or(),
+        g->NewNode(machine->Int32LessThanOrEqual(), entry_bound, init),
+        g->NewNode(machine->Word32And(),
+                   g->NewNode(machine->Int32LessThanOrEqual(),
+                              graph->Int32Constant(0), init),
+                   g->NewNode(machine->Int32LessThanOrEqual(), entry_bound,
+                              max_node)));
+  }
+  return g->NewNode(
+      machine->Word32Or(),
+      g->NewNode(machine->Uint32LessThanOrEqual(), entry_bound, init),
+      g->NewNode(machine->Uint32LessThanOrEqual(), entry_bound, max_node));
+}
+
+// Duplicates {loop} with everything computed in it, and enters the copy
+// instead of {loop} if {cond} holds before the loop. The copy runs without
+// the checks of {branches}. Both loops leave through the exit of {guard},
+// or to trap code, and their exits are merged. Returns false, leaving the
+// graph alone, if the loop is too large or its values cannot be merged.
+bool WasmGraphBuilder::VersionLoop(Node* loop, const ZoneSet<Node*>& body,
+                                   Node* guard, Node* cond,
+                                   const ZoneVector<Node*>& branches) {
+  static const size_t kMaxLoopSize = 1000;
+  CommonOperatorBuilder* common = graph->common();
+  Graph* g = graph->graph();
+
+  // Everything under the control of the loop is in the loop, and so are the
+  // values computed from it that the loop uses. Values computed from it
+  // that only code after the loop uses are left there.
+  ZoneSet<Node*> reachable(zone);
+  ZoneVector<Node*> queue(body.begin(), body.end(), zone);
+  queue.push_back(loop);
+  while (!queue.empty()) {
+    Node* node = queue.back();
+    queue.pop_back();
+    if (reachable.count(node)) continue;
+    if (IrOpcode::IsControlOpcode(node->opcode())) {
+      if (node != loop && !body.count(node)) continue;
+    } else if (node->op()->ControlInputCount() > 0) {
+      Node* control = NodeProperties::GetControlInput(node);
+      if (control != loop && !body.count(control)) continue;
+    }
+    reachable.insert(node);
+    if (reachable.size() > kMaxLoopSize) return false;
+    for (Node* use : node->uses()) queue.push_back(use);
+  }
+  ZoneSet<Node*> nodes(zone);
+  for (Node* node : reachable) {
+    if (IrOpcode::IsControlOpcode(node->opcode()) ||
+        node->op()->ControlInputCount() > 0) {
+      queue.push_back(node);
+    }
+  }
+  while (!queue.empty()) {
+    Node* node = queue.back();
+    queue.pop_back();
+    if (nodes.count(node) || !reachable.count(node)) continue;
+    nodes.insert(node);
+    for (Node* input : node->inputs()) queue.push_back(input);
+  }
+
+  // Find the edges that leave the loop, before changing any of them.
+  Node* exit_branch = NodeProperties::GetControlInput(guard);
+  ZoneVector<Node*> exits(zone);
+  ZoneVector<std::pair<Node*, int>> value_uses(zone);
+  ZoneVector<std::pair<Node*, int>> effect_uses(zone);
+  for (Node* node : nodes) {
+    for (Edge edge : node->use_edges()) {
+      Node* user = edge.from();
+      if (nodes.count(user)) continue;
+      if (IrOpcode::IsControlOpcode(user->opcode())) {
+        if (NodeProperties::IsControlEdge(edge)) exits.push_back(user);
+        continue;
+      }
+      if (IrOpcode::IsPhiOpcode(user->opcode()) &&
+          trap->IsTrapMerge(NodeProperties::GetControlInput(user))) {
+        continue;
+      }
+      if (NodeProperties::IsEffectEdge(edge)) {
+        effect_uses.push_back(std::make_pair(user, edge.index()));
+      } else {
+        if (!CanMergeValue(node, nodes)) return false;
+        value_uses.push_back(std::make_pair(user, edge.index()));
+      }
+    }
+  }
+
+  // Copy the nodes of the loop, and make the copies use each other.
+  ZoneMap<Node*, Node*> copies(zone);
+  for (Node* node : nodes) {
+    ZoneVector<Node*> inputs(zone);
+    for (Node* input : node->inputs()) inputs.push_back(input);
+    copies[node] = g->NewNode(node->op(), static_cast<int>(inputs.size()),
+                              inputs.data());
+  }
+  for (auto& entry : copies) {
+    Node* copy = entry.second;
+    for (int i = 0; i < copy->InputCount(); i++) {
+      auto it = copies.find(copy->InputAt(i));
+      if (it != copies.end()) copy->ReplaceInput(i, it->second);
+    }
+  }
+
+  // Enter the copy if the condition holds, and drop its checks.
+  Node* branch = g->NewNode(common->Branch(BranchHint::kTrue), cond,
+                            loop->InputAt(0));
+  copies[loop]->ReplaceInput(0, g->NewNode(common->IfTrue(), branch));
+  loop->ReplaceInput(0, g->NewNode(common->IfFalse(), branch));
+  for (Node* check : branches) {
+    copies[check]->ReplaceInput(0, graph->Int32Constant(1));
+  }
+
+  // Connect the exits of the copy next to the exits of the loop.
+  Node* merge = nullptr;
+  for (Node* exit : exits) {
+    ZoneVector<Node*> inputs(zone);
+    for (Node* input : exit->inputs()) {
+      auto it = copies.find(input);
+      inputs.push_back(it != copies.end() ? it->second : input);
+    }
+    Node* copy = g->NewNode(exit->op(), static_cast<int>(inputs.size()),
+                            inputs.data());
+    if (exit->opcode() == IrOpcode::kTerminate) {
+      MergeControlToEnd(graph, copy);
+    } else if (NodeProperties::GetControlInput(exit) == exit_branch) {
+      ZoneVector<std::pair<Node*, int>> uses(zone);
+      for (Edge edge : exit->use_edges()) {
+        uses.push_back(std::make_pair(edge.from(), edge.index()));
+      }
+      merge = g->NewNode(common->Merge(2), exit, copy);
+      for (auto& use : uses) use.first->ReplaceInput(use.second, merge);
+    } else {
+      ZoneVector<std::pair<Node*, int>> uses(zone);
+      for (Edge edge : exit->use_edges()) {
+        uses.push_back(std::make_pair(edge.from(), edge.index()));
+      }
+      for (auto& use : uses) {
+        Node* trap_merge = use.first;
+        ZoneVector<Node*> phis(zone);
+        for (Node* phi : trap_merge->uses()) {
+          if (IrOpcode::IsPhiOpcode(phi->opcode())) phis.push_back(phi);
+        }
+        AppendToMerge(trap_merge, copy);
+        for (Node* phi : phis) {
+          Node* input = phi->InputAt(use.second);
+          auto it = copies.find(input);
+          AppendToPhi(trap_merge, phi,
+                      it != copies.end() ? it->second : input);
+        }
+      }
+    }
+  }
+  DCHECK_NOT_NULL(merge);
+
+  // Merge the values and effects that code after the loop uses.
+  ZoneMap<Node*, Node*> values(zone);
+  ZoneMap<Node*, Node*> effects(zone);
+  for (auto& use : value_uses) {
+    Node* node = use.first->InputAt(use.second);
+    use.first->ReplaceInput(use.second,
+                            MergeValue(node, copies, merge, &values));
+  }
+  for (auto& use : effect_uses) {
+    Node* node = use.first->InputAt(use.second);
+    Node*& phi = effects[node];
+    if (!phi) {
+      phi = g->NewNode(common->EffectPhi(2), node, copies[node], merge);
+    }
+    use.first->ReplaceInput(use.second, phi);
+  }
+  return true;
+}
+
+// Checks whether the value of {node} in the loop of {nodes} can be merged
+// with the value of its copy where the loop and its copy exit.
+bool WasmGraphBuilder::CanMergeValue(Node* node, const ZoneSet<Node*>& nodes) {
+  if (!nodes.count(node)) return true;
+  switch (node->opcode()) {
+    case IrOpcode::kPhi:
+    case IrOpcode::kLoad:
+      return true;
+    default:
+      if (node->op()->EffectInputCount() > 0 ||
+          node->op()->ControlInputCount() > 0) {
+        return false;
+      }
+      for (Node* input : node->inputs()) {
+        if (!CanMergeValue(input, nodes)) return false;
+      }
+      return true;
+  }
+}
+
+// Merges the value of {node} with the value of its copy at {merge}. Phis and
+// loads are merged with phis of their representation, and pure values are
+// computed again from the merged values of their inputs.
+Node* WasmGraphBuilder::MergeValue(Node* node,
+                                   const ZoneMap<Node*, Node*>& copies,
+                                   Node* merge, ZoneMap<Node*, Node*>* values) {
+  auto copy = copies.find(node);
+  if (copy == copies.end()) return node;
+  Node*& value = (*values)[node];
+  if (value) return value;
+  Graph* g = graph->graph();
+  switch (node->opcode()) {
+    case IrOpcode::kPhi:
+      value = g->NewNode(
+          graph->common()->Phi(OpParameter<MachineType>(node), 2), node,
+          copy->second, merge);
+      break;
+    case IrOpcode::kLoad:
+      value = g->NewNode(
+          graph->common()->Phi(LoadRepresentationOf(node->op()), 2), node,
+          copy->second, merge);
+      break;
+    default: {
+      ZoneVector<Node*> inputs(zone);
+      for (Node* input : node->inputs()) {
+        inputs.push_back(MergeValue(input, copies, merge, values));
+      }
+      value = g->NewNode(node->op(), static_cast<int>(inputs.size()),
+                         inputs.data());
+      break;
+    }
+  }
+  return value;
+}
+
+// Checks that the only control flow leaving {loop} is the exit of {guard} and
+// trap code.
+bool WasmGraphBuilder::HasSingleExit(Node* loop, const ZoneSet<Node*>& body,
+                                     Node* guard) {
+  Node* branch = NodeProperties::GetControlInput(guard);
+  ZoneVector<Node*> nodes(body.begin(), body.end(), zone);
+  nodes.push_back(loop);
+  for (Node* node : nodes) {
+    for (Edge edge : node->use_edges()) {
+      Node* user = edge.from();
+      if (!NodeProperties::IsControlEdge(edge) ||
+          !IrOpcode::IsControlOpcode(user->opcode())) {
+        continue;
+      }
+      if (user == loop || body.count(user) ||
+          user->opcode() == IrOpcode::kTerminate ||
+          NodeProperties::GetControlInput(user) == branch ||
+          trap->IsTrapExit(user)) {
+        continue;
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+
+Node* WasmGraphBuilder::LoadMem(wasm::LocalType type, MachineType memtype,
+                                Node* index, uint32_t offset) {
+  if (!graph) return nullptr;
+
+  Graph* g = graph->graph();
+  Node* load;
+
+  if (module && module->asm_js) {
+    // asm.js semantics use CheckedLoad (i.e. OOB reads return 0ish).
+    DCHECK_EQ(0, offset);
+    const Operator* op = graph->machine()->CheckedLoad(memtype);
+    Node* size = MemSize(0);
+    load = g->NewNode(op, MemBuffer(0), index, size, *effect, *control);
+  } else {
+    // WASM semantics throw on OOB. Introduce explicit bounds check.
+    index = BoundsCheckMem(memtype, index, offset);
+    load = g->NewNode(graph->machine()->Load(memtype), MemBuffer(offset), index,
+                      *effect, *control);
   }
 
   *effect = load;
@@ -1552,11 +2665,12 @@ Node* WasmGraphBuilder::StoreMem(MachineType memtype, Node* index,
     // asm.js semantics use CheckedStore (i.e. ignore OOB writes).
     DCHECK_EQ(0, offset);
     const Operator* op = graph->machine()->CheckedStore(memtype);
-    store = graph->graph()->NewNode(op, MemBuffer(0), index, MemSize(0), val,
+    Node* size = MemSize(0);
+    store = graph->graph()->NewNode(op, MemBuffer(0), index, size, val,
                                     *effect, *control);
   } else {
     // WASM semantics throw on OOB. Introduce explicit bounds check.
-    BoundsCheckMem(memtype, index, offset);
+    index = BoundsCheckMem(memtype, index, offset);
     StoreRepresentation rep(memtype, kNoWriteBarrier);
     store =
         graph->graph()->NewNode(graph->machine()->Store(rep), MemBuffer(offset),
@@ -1579,6 +2693,115 @@ Node* WasmGraphBuilder::String(const char* string) {
 }
 
 
+namespace {
+// Wrappers that call their wasm code directly, rather than through the code
+// table or after switching the current instance, record the signature of the
+// function in the function data of their shared function info. It holds the
+// number of returns, then the local type codes of the returns followed by the
+// parameters.
+
+bool HasDirectWasmCall(wasm::ModuleEnv* module) {
+  return module->code_table.is_null() && !module->current_instance;
+}
+
+Handle<ByteArray> EncodeWasmSignature(Isolate* isolate,
+                                      wasm::FunctionSig* sig) {
+  int returns = static_cast<int>(sig->return_count());
+  int params = static_cast<int>(sig->parameter_count());
+  Handle<ByteArray> data =
+      isolate->factory()->NewByteArray(1 + returns + params, TENURED);
+  data->set(0, static_cast<byte>(returns));
+  for (int i = 0; i < returns; i++) {
+    data->set(1 + i, wasm::WasmOpcodes::LocalTypeCodeFor(sig->GetReturn(i)));
+  }
+  for (int i = 0; i < params; i++) {
+    data->set(1 + returns + i,
+              wasm::WasmOpcodes::LocalTypeCodeFor(sig->GetParam(i)));
+  }
+  return data;
+}
+
+wasm::LocalType DecodeLocalType(byte code) {
+  switch (code) {
+    case wasm::kLocalI32:
+      return wasm::kAstI32;
+    case wasm::kLocalI64:
+      return wasm::kAstI64;
+    case wasm::kLocalF32:
+      return wasm::kAstF32;
+    case wasm::kLocalF64:
+      return wasm::kAstF64;
+    default:
+      UNREACHABLE();
+      return wasm::kAstStmt;
+  }
+}
+
+wasm::FunctionSig* DecodeWasmSignature(Zone* zone, ByteArray* data) {
+  size_t returns = data->get(0);
+  size_t params = data->length() - 1 - returns;
+  wasm::FunctionSig::Builder builder(zone, returns, params);
+  for (size_t i = 0; i < returns; i++) {
+    builder.AddReturn(DecodeLocalType(data->get(static_cast<int>(1 + i))));
+  }
+  for (size_t i = 0; i < params; i++) {
+    builder.AddParam(
+        DecodeLocalType(data->get(static_cast<int>(1 + returns + i))));
+  }
+  return builder.Build();
+}
+
+// Creates the JSFunction object for a JS-to-wasm wrapper around {wasm_code},
+// which takes {params} parameters. Its code is set by the caller.
+Handle<JSFunction> NewJSToWasmFunction(Isolate* isolate, Handle<String> name,
+                                       Handle<Code> wasm_code, int params,
+                                       Handle<Object> function_data) {
+  Handle<SharedFunctionInfo> shared =
+      isolate->factory()->NewSharedFunctionInfo(name, wasm_code, false);
+  if (!function_data.is_null()) shared->set_function_data(*function_data);
+  shared->set_length(params);
+  shared->set_internal_formal_parameter_count(1 + params);
+  Handle<JSFunction> function = isolate->factory()->NewFunction(name);
+  function->set_shared(*shared);
+  return function;
+}
+
+// Copies the wrapper code {templ}, replacing the code targets and embedded
+// objects found in {from} by the corresponding entries of {to}.
+Handle<Code> CopyAndRetargetWrapper(Isolate* isolate, Handle<Code> templ,
+                                    Handle<HeapObject>* from,
+                                    Handle<HeapObject>* to, size_t count) {
+  Handle<Code> code = isolate->factory()->CopyCode(templ);
+  int mode_mask = RelocInfo::kCodeTargetMask |
+                  RelocInfo::ModeMask(RelocInfo::EMBEDDED_OBJECT);
+  for (RelocIterator it(*code, mode_mask); !it.done(); it.next()) {
+    RelocInfo* rinfo = it.rinfo();
+    Object* target;
+    if (RelocInfo::IsCodeTarget(rinfo->rmode())) {
+      target = Code::GetCodeFromTargetAddress(rinfo->target_address());
+    } else {
+      target = rinfo->target_object();
+    }
+    for (size_t i = 0; i < count; i++) {
+      if (target != *from[i]) continue;
+      if (RelocInfo::IsCodeTarget(rinfo->rmode())) {
+        Handle<Code> new_target = Handle<Code>::cast(to[i]);
+        rinfo->set_target_address(new_target->instruction_start(),
+                                  UPDATE_WRITE_BARRIER, SKIP_ICACHE_FLUSH);
+      } else {
+        rinfo->set_target_object(*to[i], UPDATE_WRITE_BARRIER,
+                                 SKIP_ICACHE_FLUSH);
+      }
+      break;
+    }
+  }
+  Assembler::FlushICache(isolate, code->instruction_start(),
+                         code->instruction_size());
+  return code;
+}
+}  // namespace
+
+
 Handle<JSFunction> CompileJSToWasmWrapper(Isolate* isolate,
                                           wasm::ModuleEnv* module,
                                           Handle<String> name,
@@ -1589,13 +2812,13 @@ Handle<JSFunction> CompileJSToWasmWrapper(Isolate* isolate,
   //----------------------------------------------------------------------------
   // Create the JSFunction object.
   //----------------------------------------------------------------------------
-  Handle<SharedFunctionInfo> shared =
-      isolate->factory()->NewSharedFunctionInfo(name, wasm_code, false);
-  int params = static_cast<int>(func->sig->parameter_count());
-  shared->set_length(params);
-  shared->set_internal_formal_parameter_count(1 + params);
-  Handle<JSFunction> function = isolate->factory()->NewFunction(name);
-  function->set_shared(*shared);
+  Handle<Object> function_data;
+  if (HasDirectWasmCall(module)) {
+    function_data = EncodeWasmSignature(isolate, func->sig);
+  }
+  Handle<JSFunction> function = NewJSToWasmFunction(
+      isolate, name, wasm_code, static_cast<int>(func->sig->parameter_count()),
+      function_data);
 
   //----------------------------------------------------------------------------
   // Create the Graph
@@ -1614,7 +2837,7 @@ Handle<JSFunction> CompileJSToWasmWrapper(Isolate* isolate,
   builder.set_control_ptr(&control);
   builder.set_effect_ptr(&effect);
   builder.set_module(module);
-  builder.BuildJSToWasmWrapper(wasm_code, func->sig);
+  builder.BuildJSToWasmWrapper(wasm_code, func->sig, index);
 
   //----------------------------------------------------------------------------
   // Run the compilation pipeline.
@@ -1748,82 +2971,485 @@ Handle<Code> CompileWasmToJSWrapper(Isolate* isolate, wasm::ModuleEnv* module,
 }
 
 
-// Helper function to compile a single function.
-Handle<Code> CompileWasmFunction(wasm::ErrorThrower& thrower, Isolate* isolate,
-                                 wasm::ModuleEnv* module_env,
-                                 const wasm::WasmFunction& function,
-                                 int index) {
-  if (FLAG_trace_wasm_compiler || FLAG_trace_wasm_decode_time) {
-    // TODO(titzer): clean me up a bit.
+Handle<JSFunction> CopyJSToWasmWrapper(Isolate* isolate, Handle<String> name,
+                                       Handle<JSFunction> templ,
+                                       Handle<Code> wasm_code) {
+  Handle<SharedFunctionInfo> templ_shared(templ->shared(), isolate);
+  Handle<Object> function_data;
+  if (templ_shared->function_data()->IsByteArray()) {
+    function_data = handle(templ_shared->function_data(), isolate);
+  }
+  Handle<JSFunction> function = NewJSToWasmFunction(
+      isolate, name, wasm_code, templ_shared->length(), function_data);
+  // The shared function info of a wrapper holds the wasm code it calls.
+  Handle<HeapObject> from[] = {handle(templ_shared->code(), isolate)};
+  Handle<HeapObject> to[] = {wasm_code};
+  function->set_code(*CopyAndRetargetWrapper(
+      isolate, handle(templ->code(), isolate), from, to, arraysize(from)));
+  return function;
+}
+
+
+wasm::FunctionSig* GetWasmExportSignature(Zone* zone, JSFunction* function) {
+  Object* function_data = function->shared()->function_data();
+  if (!function_data->IsByteArray()) return nullptr;
+  return DecodeWasmSignature(zone, ByteArray::cast(function_data));
+}
+
+
+int GetDirectCallArgumentCount(JSFunction* function, wasm::FunctionSig* sig) {
+  SharedFunctionInfo* shared = function->shared();
+  int js_count = shared->internal_formal_parameter_count();
+  int wasm_count = static_cast<int>(sig->parameter_count());
+  // Functions that don't adapt their arguments expect the actual count to
+  // be checked by the Call builtin, and class constructors throw when called.
+  if (js_count != wasm_count ||
+      js_count == SharedFunctionInfo::kDontAdaptArgumentsSentinel ||
+      IsClassConstructor(shared->kind())) {
+    return -1;
+  }
+  return js_count;
+}
+
+
+bool HasGlobalProxyReceiver(JSFunction* function) {
+  SharedFunctionInfo* shared = function->shared();
+  return is_sloppy(shared->language_mode()) && !shared->native();
+}
+
+
+Handle<Code> CopyWasmToJSWrapper(Isolate* isolate, Handle<Code> templ,
+                                 Handle<JSFunction> templ_function,
+                                 Handle<JSFunction> function) {
+  DCHECK_EQ(HasGlobalProxyReceiver(*templ_function),
+            HasGlobalProxyReceiver(*function));
+  Handle<HeapObject> from[] = {
+      templ_function, handle(templ_function->context(), isolate),
+      handle(templ_function->context()->global_proxy(), isolate)};
+  Handle<HeapObject> to[] = {function, handle(function->context(), isolate),
+                             handle(function->context()->global_proxy(),
+                                    isolate)};
+  return CopyAndRetargetWrapper(isolate, templ, from, to, arraysize(from));
+}
+
+
+namespace {
+// Lowers the graph of a stub and generates its code.
+Handle<Code> GenerateStubCode(Isolate* isolate, Zone* zone, JSGraph* jsgraph,
+                              CallDescriptor* incoming, const char* name) {
+  Graph* graph = jsgraph->graph();
+
+  // Changes lowering requires types.
+  Typer typer(isolate, graph);
+  NodeVector roots(zone);
+  jsgraph->GetCachedNodes(&roots);
+  typer.Run(roots);
+
+  // Run change lowering.
+  ChangeLowering changes(jsgraph);
+  GraphReducer graph_reducer(zone, graph, jsgraph->Dead());
+  graph_reducer.AddReducer(&changes);
+  graph_reducer.ReduceGraph();
+
+  if (FLAG_trace_turbo_graph) {  // Simple textual RPO.
     OFStream os(stdout);
-    os << "Compiling WASM function #" << index << ":";
-    if (function.name_offset > 0) {
-      os << module_env->module->GetName(function.name_offset);
-    }
-    os << std::endl;
-  }
-  // Initialize the function environment for decoding.
-  wasm::FunctionEnv env;
-  env.module = module_env;
-  env.sig = function.sig;
-  env.local_int32_count = function.local_int32_count;
-  env.local_int64_count = function.local_int64_count;
-  env.local_float32_count = function.local_float32_count;
-  env.local_float64_count = function.local_float64_count;
-  env.SumLocals();
-
-  // Create a TF graph during decoding.
+    os << "-- Graph after change lowering -- " << std::endl;
+    os << AsRPO(*graph);
+  }
+
+  // Schedule and compile to machine code.
+  CompilationInfo info(name, isolate, zone);
+  // TODO(titzer): this is technically a WASM stub, not a wasm function.
+  info.set_output_code_kind(Code::WASM_FUNCTION);
+  Handle<Code> code =
+      Pipeline::GenerateCodeForTesting(&info, incoming, graph, nullptr);
+
+#ifdef ENABLE_DISASSEMBLER
+  // Disassemble the stub code for debugging.
+  if (!code.is_null() && FLAG_print_opt_code) {
+    OFStream os(stdout);
+    code->Disassemble(name, os);
+  }
+#endif
+  return code;
+}
+}  // namespace
+
+
+Handle<Code> CompileWasmLazyCompileStub(Isolate* isolate,
+                                        wasm::ModuleEnv* module,
+                                        Handle<JSFunction> lazy_compile,
+                                        Handle<JSObject> instance,
+                                        Handle<HeapNumber> index,
+                                        wasm::FunctionSig* sig) {
   Zone zone;
   Graph graph(&zone);
   CommonOperatorBuilder common(&zone);
-  MachineOperatorBuilder machine(
-      &zone, kMachPtr, InstructionSelector::SupportedMachineOperatorFlags());
-  JSGraph jsgraph(isolate, &graph, &common, nullptr, nullptr, &machine);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
   WasmGraphBuilder builder(&zone, &jsgraph);
-  wasm::TreeResult result = wasm::BuildTFGraph(
-      &builder, &env,                                                 // --
-      module_env->module->module_start,                               // --
-      module_env->module->module_start + function.code_start_offset,  // --
-      module_env->module->module_start + function.code_end_offset);   // --
-
-  if (result.failed()) {
-    if (FLAG_trace_wasm_compiler) {
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.set_module(module);
+  builder.BuildLazyCompileStub(lazy_compile, instance, index, sig);
+
+  CallDescriptor* incoming = module->GetWasmCallDescriptor(&zone, sig);
+  return GenerateStubCode(isolate, &zone, &jsgraph, incoming,
+                          "wasm-lazy-compile");
+}
+
+
+Handle<Code> CompileWasmTierUpStub(Isolate* isolate, wasm::ModuleEnv* module,
+                                   Handle<JSFunction> tier_up,
+                                   Handle<JSObject> instance) {
+  Zone zone;
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.set_module(module);
+  builder.BuildTierUpStub(tier_up, instance);
+
+  wasm::LocalType params[] = {wasm::kAstI32};
+  wasm::FunctionSig sig(0, 1, params);
+  CallDescriptor* incoming = module->GetWasmCallDescriptor(&zone, &sig);
+  return GenerateStubCode(isolate, &zone, &jsgraph, incoming, "wasm-tier-up");
+}
+
+
+
+Handle<Code> CompileWasmGrowMemoryStub(Isolate* isolate,
+                                       wasm::ModuleEnv* module,
+                                       Handle<JSFunction> grow_memory) {
+  Zone zone;
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.set_module(module);
+  builder.BuildGrowMemoryStub(grow_memory);
+
+  wasm::LocalType types[] = {wasm::kAstI32, wasm::kAstI32};
+  wasm::FunctionSig sig(1, 1, types);
+  CallDescriptor* incoming = module->GetWasmCallDescriptor(&zone, &sig);
+  return GenerateStubCode(isolate, &zone, &jsgraph, incoming,
+                          "wasm-grow-memory");
+}
+
+
+Handle<Code> CompileWasmOutOfBoundsStub(Isolate* isolate,
+                                        wasm::ModuleEnv* module) {
+  Zone zone;
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.set_module(module);
+  builder.BuildOutOfBoundsStub();
+
+  wasm::FunctionSig sig(0, 0, nullptr);
+  CallDescriptor* incoming = module->GetWasmCallDescriptor(&zone, &sig);
+  return GenerateStubCode(isolate, &zone, &jsgraph, incoming,
+                          "wasm-out-of-bounds");
+}
+
+Handle<Code> CompileWasmToHostWrapper(Isolate* isolate,
+                                      wasm::ModuleEnv* module,
+                                      Address function,
+                                      wasm::FunctionSig* sig) {
+  Zone zone;
+  CallDescriptor* desc = wasm::ModuleEnv::GetHostCallDescriptor(&zone, sig);
+  if (desc == nullptr) return Handle<Code>::null();
+  Handle<Code> trampoline =
+      wasm::ModuleEnv::CompileHostCallTrampoline(isolate);
+
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.set_module(module);
+  builder.BuildWasmToHostWrapper(function, trampoline, sig, desc);
+
+  CallDescriptor* incoming = module->GetWasmCallDescriptor(&zone, sig);
+  return GenerateStubCode(isolate, &zone, &jsgraph, incoming,
+                          "wasm-to-host");
+}
+
+Handle<JSFunction> CompileWasmEntryWrapper(Isolate* isolate,
+                                           Handle<Code> wasm_code,
+                                           wasm::FunctionSig* sig,
+                                           Address slots) {
+  Zone zone;
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.BuildWasmEntryWrapper(wasm_code, sig, slots);
+
+  CallDescriptor* incoming = Linkage::GetJSCallDescriptor(
+      &zone, false, 0 + 1, CallDescriptor::kNoFlags);
+  Handle<Code> code =
+      GenerateStubCode(isolate, &zone, &jsgraph, incoming, "wasm-entry");
+  if (code.is_null()) return Handle<JSFunction>::null();
+  Handle<String> name = isolate->factory()->NewStringFromStaticChars("entry");
+  Handle<JSFunction> function =
+      NewJSToWasmFunction(isolate, name, wasm_code, 0, Handle<Object>::null());
+  function->set_code(*code);
+  return function;
+}
+
+Handle<JSFunction> CompileWasmBatchWrapper(Isolate* isolate,
+                                           Handle<Code> wasm_code,
+                                           wasm::FunctionSig* sig) {
+  Zone zone;
+  Graph graph(&zone);
+  CommonOperatorBuilder common(&zone);
+  JSOperatorBuilder javascript(&zone);
+  MachineOperatorBuilder machine(&zone);
+  JSGraph jsgraph(isolate, &graph, &common, &javascript, nullptr, &machine);
+
+  Node* control = nullptr;
+  Node* effect = nullptr;
+
+  WasmGraphBuilder builder(&zone, &jsgraph);
+  builder.set_control_ptr(&control);
+  builder.set_effect_ptr(&effect);
+  builder.BuildWasmBatchWrapper(wasm_code, sig);
+
+  CallDescriptor* incoming = Linkage::GetJSCallDescriptor(
+      &zone, false, 1 + 1, CallDescriptor::kNoFlags);
+  Handle<Code> code =
+      GenerateStubCode(isolate, &zone, &jsgraph, incoming, "wasm-batch");
+  if (code.is_null()) return Handle<JSFunction>::null();
+  Handle<String> name = isolate->factory()->NewStringFromStaticChars("batch");
+  Handle<JSFunction> function =
+      NewJSToWasmFunction(isolate, name, wasm_code, 1, Handle<Object>::null());
+  function->set_code(*code);
+  return function;
+}
+
+// A compilation unit owns the zone and the TurboFan graph of one function
+// between the creation, the execution and the finishing phases.
+class WasmCompilationUnit {
+ public:
+  WasmCompilationUnit(wasm::ErrorThrower& thrower, Isolate* isolate,
+                      wasm::ModuleEnv* module_env,
+                      const wasm::WasmFunction& function, int index,
+                      WasmCodeTier tier)
+      : thrower_(thrower),
+        isolate_(isolate),
+        module_env_(module_env),
+        function_(function),
+        index_(index),
+        tier_(tier),
+        graph_(&zone_),
+        common_(&zone_),
+        machine_(&zone_, kMachPtr,
+                 InstructionSelector::SupportedMachineOperatorFlags()),
+        jsgraph_(isolate, &graph_, &common_, nullptr, nullptr, &machine_),
+        builder_(&zone_, &jsgraph_) {
+    // Initialize the function environment for decoding.
+    env_.module = module_env;
+    env_.sig = function.sig;
+    env_.local_int32_count = function.local_int32_count;
+    env_.local_int64_count = function.local_int64_count;
+    env_.local_float32_count = function.local_float32_count;
+    env_.local_float64_count = function.local_float64_count;
+    env_.SumLocals();
+
+    builder_.set_module(module_env);
+    if (tier == kQuickTier) {
+      // The quick tier skips the optimizations of the graph.
+      builder_.set_hoist_bounds_checks(false);
+      if (!module_env->tier_up_stub.is_null()) {
+        builder_.set_tier_up_index(index);
+      }
+    }
+  }
+
+  // Decodes the function body and builds the TF graph. The graph embeds
+  // handles, so this happens on the isolate's thread.
+  void BuildGraph() {
+    if (FLAG_trace_wasm_compiler || FLAG_trace_wasm_decode_time) {
+      // TODO(titzer): clean me up a bit.
       OFStream os(stdout);
-      os << "Compilation failed: " << result << std::endl;
+      os << "Compiling WASM function #" << index_ << ":";
+      if (function_.name_offset > 0) {
+        os << module_env_->module->GetName(function_.name_offset);
+      }
+      os << std::endl;
     }
-    // Add the function as another context for the exception
-    char buffer[256];
-    snprintf(buffer, 256, "Compiling WASM function #%d:%s failed:", index,
-             module_env->module->GetName(function.name_offset));
-    thrower.Failed(buffer, result);
-    return Handle<Code>::null();
-  }
-
-  // Run the compiler pipeline to generate machine code.
-  CallDescriptor* descriptor = const_cast<CallDescriptor*>(
-      module_env->GetWasmCallDescriptor(&zone, function.sig));
-  CompilationInfo info("wasm", isolate, &zone);
-  info.set_output_code_kind(Code::WASM_FUNCTION);
-  Handle<Code> code =
-      Pipeline::GenerateCodeForTesting(&info, descriptor, &graph);
+    const byte* module_start = module_env_->module->module_start;
+    result_ = wasm::BuildTFGraph(
+        &builder_, &env_,                             // --
+        module_start,                                 // --
+        module_start + function_.code_start_offset,   // --
+        module_start + function_.code_end_offset);    // --
+  }
+
+  // Runs the machine-level optimizations of the graph for the optimized
+  // tier. The reducers only touch the graph in the unit's zone, so this can
+  // run on a background thread while the isolate's thread keeps running.
+  void Execute() {
+    DisallowHeapAllocation no_allocation;
+    DisallowHandleAllocation no_handles;
+    DisallowHandleDereference no_deref;
+    if (result_.failed() || tier_ != kOptimizedTier) return;
+    GraphReducer graph_reducer(&zone_, &graph_, jsgraph_.Dead());
+    MachineOperatorReducer machine_reducer(&jsgraph_);
+    CommonOperatorReducer common_reducer(&graph_reducer, &graph_, &common_,
+                                         &machine_);
+    DeadCodeElimination dead_code_elimination(&graph_reducer, &graph_,
+                                              &common_);
+    graph_reducer.AddReducer(&machine_reducer);
+    graph_reducer.AddReducer(&common_reducer);
+    graph_reducer.AddReducer(&dead_code_elimination);
+    graph_reducer.ReduceGraph();
+  }
+
+  // Runs the backend pipeline on the graph and allocates the code object.
+  // Pipeline::GenerateCodeForTesting is the only entry point of the pipeline
+  // available to this tree, and it allocates the code object and creates
+  // handles, so scheduling, instruction selection, register allocation and
+  // code generation all run here, on the isolate's thread.
+  Handle<Code> Finish() {
+    if (result_.failed()) {
+      if (FLAG_trace_wasm_compiler) {
+        OFStream os(stdout);
+        os << "Compilation failed: " << result_ << std::endl;
+      }
+      // Add the function as another context for the exception
+      char buffer[256];
+      snprintf(buffer, 256, "Compiling WASM function #%d:%s failed:", index_,
+               module_env_->module->GetName(function_.name_offset));
+      thrower_.Failed(buffer, result_);
+      return Handle<Code>::null();
+    }
+
+    // Run the compiler pipeline to generate machine code.
+    CallDescriptor* descriptor = const_cast<CallDescriptor*>(
+        module_env_->GetWasmCallDescriptor(&zone_, function_.sig));
+    CompilationInfo info("wasm", isolate_, &zone_);
+    info.set_output_code_kind(Code::WASM_FUNCTION);
+    Handle<Code> code =
+        Pipeline::GenerateCodeForTesting(&info, descriptor, &graph_);
 
 #ifdef ENABLE_DISASSEMBLER
-  // Disassemble the code for debugging.
-  if (!code.is_null() && FLAG_print_opt_code) {
-    static const int kBufferSize = 128;
-    char buffer[kBufferSize];
-    const char* name = "";
-    if (function.name_offset > 0) {
-      const byte* ptr = module_env->module->module_start + function.name_offset;
-      name = reinterpret_cast<const char*>(ptr);
+    // Disassemble the code for debugging.
+    if (!code.is_null() && FLAG_print_opt_code) {
+      static const int kBufferSize = 128;
+      char buffer[kBufferSize];
+      const char* name = "";
+      if (function_.name_offset > 0) {
+        const byte* ptr =
+            module_env_->module->module_start + function_.name_offset;
+        name = reinterpret_cast<const char*>(ptr);
+      }
+      snprintf(buffer, kBufferSize, "WASM function #%d:%s", index_, name);
+      OFStream os(stdout);
+      code->Disassemble(buffer, os);
     }
-    snprintf(buffer, kBufferSize, "WASM function #%d:%s", index, name);
-    OFStream os(stdout);
-    code->Disassemble(buffer, os);
-  }
 #endif
+    return code;
+  }
+
+ private:
+  wasm::ErrorThrower& thrower_;
+  Isolate* isolate_;
+  wasm::ModuleEnv* module_env_;
+  // A copy, since the functions of a streamed module move while it arrives.
+  const wasm::WasmFunction function_;
+  int index_;
+  WasmCodeTier tier_;
+  wasm::FunctionEnv env_;
+  Zone zone_;
+  Graph graph_;
+  CommonOperatorBuilder common_;
+  MachineOperatorBuilder machine_;
+  JSGraph jsgraph_;
+  WasmGraphBuilder builder_;
+  wasm::TreeResult result_;
+};
+
+
+WasmCompilationUnit* CreateWasmCompilationUnit(
+    wasm::ErrorThrower& thrower, Isolate* isolate, wasm::ModuleEnv* module_env,
+    const wasm::WasmFunction& function, int index, WasmCodeTier tier) {
+  WasmCompilationUnit* unit = new WasmCompilationUnit(
+      thrower, isolate, module_env, function, index, tier);
+  unit->BuildGraph();
+  return unit;
+}
+
+
+void ExecuteCompilation(WasmCompilationUnit* unit) { unit->Execute(); }
+
+
+Handle<Code> FinishCompilation(WasmCompilationUnit* unit) {
+  Handle<Code> code = unit->Finish();
+  delete unit;
   return code;
 }
+
+
+void AbortCompilation(WasmCompilationUnit* unit) { delete unit; }
+
+
+// Helper function to compile a single function.
+Handle<Code> CompileWasmFunction(wasm::ErrorThrower& thrower, Isolate* isolate,
+                                 wasm::ModuleEnv* module_env,
+                                 const wasm::WasmFunction& function,
+                                 int index) {
+  WasmCompilationUnit* unit = CreateWasmCompilationUnit(
+      thrower, isolate, module_env, function, index);
+  ExecuteCompilation(unit);
+  return FinishCompilation(unit);
+}
 }
 }
 }
@@ -6,6 +6,7 @@
 #define V8_WASM_TF_BUILDER_H_
 
 #include "src/zone.h"
+#include "src/zone-containers.h"
 
 #include "src/wasm/wasm-opcodes.h"
 
@@ -14,6 +15,7 @@ namespace internal {
 
 namespace compiler {
 // Forward declarations for some compiler data structures.
+class CallDescriptor;
 class Node;
 class JSGraph;
 }
@@ -30,24 +32,146 @@ typedef compiler::JSGraph TFGraph;
 }
 
 namespace compiler {
+// The tiers of code that a wasm function can be compiled to.
+enum WasmCodeTier {
+  kQuickTier,     // fewer optimizations, counts towards tiering up.
+  kOptimizedTier  // all optimizations.
+};
+
 // Compiles a single function, producing a code object.
 Handle<Code> CompileWasmFunction(wasm::ErrorThrower& thrower, Isolate* isolate,
                                  wasm::ModuleEnv* module_env,
                                  const wasm::WasmFunction& function, int index);
 
+// The compilation of a single function, split into phases. Creating and
+// finishing a unit must happen on the isolate's thread, since they touch the
+// heap. Creating a unit decodes the function body and builds its TurboFan
+// graph in the unit's own zone. Executing a unit runs the machine-level
+// optimizations of the graph without touching the heap, and can therefore
+// run on a background thread while the isolate's thread keeps running.
+// Finishing runs the backend pipeline and allocates the code object, since
+// the pipeline entry point available here does both.
+class WasmCompilationUnit;
+
+WasmCompilationUnit* CreateWasmCompilationUnit(
+    wasm::ErrorThrower& thrower, Isolate* isolate, wasm::ModuleEnv* module_env,
+    const wasm::WasmFunction& function, int index,
+    WasmCodeTier tier = kOptimizedTier);
+
+void ExecuteCompilation(WasmCompilationUnit* unit);
+
+// Generates the code object for an executed unit and deletes the unit.
+// Returns a null handle (and reports to the thrower) on failure.
+Handle<Code> FinishCompilation(WasmCompilationUnit* unit);
+
+// Deletes a unit without generating code.
+void AbortCompilation(WasmCompilationUnit* unit);
+
 // Wraps a JS function, producing a code object that can be called from WASM.
 Handle<Code> CompileWasmToJSWrapper(Isolate* isolate, wasm::ModuleEnv* module,
                                     Handle<JSFunction> function,
                                     uint32_t index);
 
+// Returns the number of arguments with which a wasm-to-JS wrapper with the
+// signature {sig} calls {function} directly, which requires the arities to
+// match exactly. Returns -1 if the wrapper calls the function through the
+// Call builtin instead, which adapts the arguments and the receiver.
+int GetDirectCallArgumentCount(JSFunction* function, wasm::FunctionSig* sig);
+
+// Returns true if a wasm-to-JS wrapper that calls {function} directly passes
+// the global proxy of its context as the receiver, as the Call builtin does
+// for sloppy functions, rather than undefined.
+bool HasGlobalProxyReceiver(JSFunction* function);
+
+// Compiles a trampoline with the signature {sig} that calls the native host
+// function at {function} under the C calling convention. Returns a null
+// handle if the platform or the signature is not supported.
+Handle<Code> CompileWasmToHostWrapper(Isolate* isolate,
+                                      wasm::ModuleEnv* module,
+                                      Address function,
+                                      wasm::FunctionSig* sig);
+
+// Copies the code of the wasm-to-JS wrapper {templ}, which was compiled for
+// the JS function {templ_function}, so that it calls {function} instead. The
+// direct call argument counts of both functions must be the same, and so
+// must be whether they have the global proxy as the receiver.
+Handle<Code> CopyWasmToJSWrapper(Isolate* isolate, Handle<Code> templ,
+                                 Handle<JSFunction> templ_function,
+                                 Handle<JSFunction> function);
+
+// Compiles a stub with the signature {sig} that calls the JS function
+// {lazy_compile} with {instance} as the receiver and {index} as the only
+// argument, and then tail-calls into the code found in the code table of
+// {module} at the index returned.
+Handle<Code> CompileWasmLazyCompileStub(Isolate* isolate,
+                                        wasm::ModuleEnv* module,
+                                        Handle<JSFunction> lazy_compile,
+                                        Handle<JSObject> instance,
+                                        Handle<HeapNumber> index,
+                                        wasm::FunctionSig* sig);
+
+// Compiles a stub taking the index of a function as its only parameter, which
+// calls the JS function {tier_up} with {instance} as the receiver and the
+// index as the argument.
+Handle<Code> CompileWasmTierUpStub(Isolate* isolate, wasm::ModuleEnv* module,
+                                   Handle<JSFunction> tier_up,
+                                   Handle<JSObject> instance);
+
+// Compiles a stub taking a delta in bytes as its only parameter, which calls
+// the JS function {grow_memory} with the delta as the argument and returns
+// its result, the old size of the memory or -1, as an int32.
+Handle<Code> CompileWasmGrowMemoryStub(Isolate* isolate,
+                                       wasm::ModuleEnv* module,
+                                       Handle<JSFunction> grow_memory);
+
+// Compiles a stub that throws the out of bounds trap, in which faults on the
+// guard pages of the memory continue.
+Handle<Code> CompileWasmOutOfBoundsStub(Isolate* isolate,
+                                        wasm::ModuleEnv* module);
+
 // Wraps a given wasm code object, producing a JSFunction that can be called
-// from JavaScript.
+// from JavaScript. Optimized JavaScript calls the wrapper like any other
+// function; TurboFan does not inline it.
 Handle<JSFunction> CompileJSToWasmWrapper(Isolate* isolate,
                                           wasm::ModuleEnv* module,
                                           Handle<String> name,
                                           Handle<Code> wasm_code,
                                           uint32_t index);
 
+// Creates a JSFunction that calls the wasm code object {wasm_code}, using a
+// copy of the code of the JS-to-wasm wrapper {templ}, which must have been
+// compiled for a function with the same signature and without a code table.
+Handle<JSFunction> CopyJSToWasmWrapper(Isolate* isolate, Handle<String> name,
+                                       Handle<JSFunction> templ,
+                                       Handle<Code> wasm_code);
+
+// Returns the signature of the exported wasm function that the JS-to-wasm
+// wrapper {function} calls, allocated in {zone}, if the wrapper calls the
+// wasm code found in its shared function info directly. Returns nullptr for
+// any other function.
+wasm::FunctionSig* GetWasmExportSignature(Zone* zone, JSFunction* function);
+
+// The size of the slots of the values passed to entry and batch wrappers.
+const int kWasmEntrySlotSize = 8;
+
+// Compiles a JSFunction for calling {wasm_code} from C++ without converting
+// values. It takes no arguments: it reads the parameters of {sig} from the
+// slots following the first one at {slots}, outside of the heap, and stores
+// the result of the call into the first slot. {slots} must outlive the
+// function.
+Handle<JSFunction> CompileWasmEntryWrapper(Isolate* isolate,
+                                           Handle<Code> wasm_code,
+                                           wasm::FunctionSig* sig,
+                                           Address slots);
+
+// Compiles a JSFunction that calls {wasm_code} once for each element of
+// arrays outside of the heap. It takes a byte array of entry slots holding the
+// number of calls as an int32, the address of the array receiving the results
+// and the address of the array of arguments of each parameter of {sig}.
+Handle<JSFunction> CompileWasmBatchWrapper(Isolate* isolate,
+                                           Handle<Code> wasm_code,
+                                           wasm::FunctionSig* sig);
+
 // Abstracts details of building TurboFan graph nodes for WASM to separate
 // the WASM decoder from the internal details of TurboFan.
 class WasmTrapHelper;
@@ -101,9 +225,22 @@ class WasmGraphBuilder {
 
   Node* CallDirect(uint32_t index, Node** args);
   Node* CallIndirect(uint32_t index, Node** args);
-  void BuildJSToWasmWrapper(Handle<Code> wasm_code, wasm::FunctionSig* sig);
+  Node* TierUpCheck();
+  void BuildJSToWasmWrapper(Handle<Code> wasm_code, wasm::FunctionSig* sig,
+                            uint32_t index);
   void BuildWasmToJSWrapper(Handle<JSFunction> function,
                             wasm::FunctionSig* sig);
+  void BuildLazyCompileStub(Handle<JSFunction> lazy_compile,
+                            Handle<JSObject> instance,
+                            Handle<HeapNumber> index, wasm::FunctionSig* sig);
+  void BuildTierUpStub(Handle<JSFunction> tier_up, Handle<JSObject> instance);
+  void BuildGrowMemoryStub(Handle<JSFunction> grow_memory);
+  void BuildOutOfBoundsStub();
+  void BuildWasmToHostWrapper(Address function, Handle<Code> trampoline,
+                              wasm::FunctionSig* sig, CallDescriptor* desc);
+  void BuildWasmEntryWrapper(Handle<Code> wasm_code, wasm::FunctionSig* sig,
+                             Address slots);
+  void BuildWasmBatchWrapper(Handle<Code> wasm_code, wasm::FunctionSig* sig);
   Node* ToJS(Node* node, Node* context, wasm::LocalType type);
   Node* FromJS(Node* node, Node* context, wasm::LocalType type);
   Node* Invert(Node* node);
@@ -113,12 +250,16 @@ class WasmGraphBuilder {
   // Operations that concern the linear memory.
   //-----------------------------------------------------------------------
   Node* MemSize(uint32_t offset);
+  Node* GrowMemory(Node* delta);
   Node* LoadGlobal(uint32_t index);
   Node* StoreGlobal(uint32_t index, Node* val);
   Node* LoadMem(wasm::LocalType type, MachineType memtype, Node* index,
                 uint32_t offset);
   Node* StoreMem(MachineType type, Node* index, uint32_t offset, Node* val);
 
+  // Hoists bounds checks out of loops, once the graph is complete.
+  void HoistBoundsChecks();
+
   static void PrintDebugName(Node* node);
 
   Node* Control() { return *control; }
@@ -126,6 +267,14 @@ class WasmGraphBuilder {
 
   void set_module(wasm::ModuleEnv* env) { this->module = env; }
 
+  // Enables counting down the tier-up budget of the function {index}.
+  void set_tier_up_index(int index) { this->tier_up_index = index; }
+
+  // Enables hoisting bounds checks out of loops, which is on by default.
+  void set_hoist_bounds_checks(bool hoist) {
+    this->hoist_bounds_checks = hoist;
+  }
+
   void set_control_ptr(Node** control) { this->control = control; }
 
   void set_effect_ptr(Node** effect) { this->effect = effect; }
@@ -140,6 +289,22 @@ class WasmGraphBuilder {
   Node* mem_buffer;
   Node* mem_size;
   Node* function_table;
+  Node* instance_context;
+  Node* globals_start;
+  int tier_up_index;
+  bool hoist_bounds_checks;
+  // A bounds check that accesses up to {end} bytes beyond {index} are within
+  // the memory, under {control}. {previous} is the position in
+  // {bounds_checks} of the previous check of the same index, or -1.
+  struct BoundsCheck {
+    Node* index;
+    uint64_t end;
+    Node* control;
+    int previous;
+  };
+  ZoneVector<BoundsCheck> bounds_checks;
+  // The position in {bounds_checks} of the last check of each index.
+  ZoneMap<Node*, int> last_bounds_checks;
   Node** control;
   Node** effect;
   Node** cur_buffer;
@@ -151,9 +316,29 @@ class WasmGraphBuilder {
   // Internal helper methods.
   Node* String(const char* string);
   Node* MemBuffer(uint32_t offset);
-  void BoundsCheckMem(MachineType memtype, Node* index, uint32_t offset);
+  bool HasDynamicMemSize();
+  Node* ExternalAddress(uintptr_t address);
+  Node* InstanceContext();
+  Node* LoadInstanceField(MachineType type, size_t offset);
+  Node* LoadInstanceTable(size_t offset);
+  void SetCurrentInstance();
+  void GlobalAddress(uint32_t index, Node** base, Node** offset);
+  Node* BoundsCheckMem(MachineType memtype, Node* index, uint32_t offset);
+  bool HasSingleExit(Node* loop, const ZoneSet<Node*>& body, Node* guard);
+  Node* HoistedBoundsCheck(const BoundsCheck& check, Node* loop,
+                           const ZoneSet<Node*>& body, Node** guard);
+  bool VersionLoop(Node* loop, const ZoneSet<Node*>& body, Node* guard,
+                   Node* cond, const ZoneVector<Node*>& branches);
+  bool CanMergeValue(Node* node, const ZoneSet<Node*>& nodes);
+  Node* MergeValue(Node* node, const ZoneMap<Node*, Node*>& copies,
+                   Node* merge, ZoneMap<Node*, Node*>* values);
 
   Node* BuildWasmCall(wasm::FunctionSig* sig, Node** args);
+  Node* FromFloat64(Node* node, wasm::LocalType type);
+  Node* BuildBatchElementOffset(Node* index, wasm::LocalType type);
+  Node* BuildCallToJS(Handle<JSFunction> function, Handle<JSObject> receiver,
+                      Node* arg, Node* context);
+  Node* LoadCodeFromTable(Node* key);
   Node* BuildF32CopySign(Node* left, Node* right);
   Node* BuildF64CopySign(Node* left, Node* right);
   Node* BuildI32Ctz(Node* input);
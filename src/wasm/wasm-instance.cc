@@ -0,0 +1,160 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <utility>
+
+#include "include/v8-wasm.h"
+
+#include "src/api.h"
+#include "src/execution.h"
+#include "src/factory.h"
+#include "src/objects.h"
+#include "src/simulator.h"
+#include "src/v8.h"
+#include "src/vm-state-inl.h"
+
+#include "src/wasm/wasm-compiler.h"
+#include "src/wasm/wasm-module.h"
+
+namespace v8 {
+
+STATIC_ASSERT(WasmExportBase::kSlotSize == i::compiler::kWasmEntrySlotSize);
+
+namespace {
+i::wasm::LocalType ToLocalType(WasmValueType type) {
+  switch (type) {
+    case kWasmI32:
+      return i::wasm::kAstI32;
+    case kWasmI64:
+      return i::wasm::kAstI64;
+    case kWasmF32:
+      return i::wasm::kAstF32;
+    case kWasmF64:
+      return i::wasm::kAstF64;
+    default:
+      UNREACHABLE();
+      return i::wasm::kAstStmt;
+  }
+}
+
+// Compiles the entry function of the export {name} of {instance}, which
+// passes the values through {slots}, if the export has the signature {sig}.
+// Returns a null handle otherwise.
+i::Handle<i::JSFunction> CompileEntry(i::Isolate* isolate,
+                                      i::Handle<i::JSObject> instance,
+                                      const char* name,
+                                      i::wasm::FunctionSig* sig,
+                                      uint8_t* slots) {
+  i::Handle<i::String> key = isolate->factory()->InternalizeUtf8String(name);
+  i::Handle<i::Object> value = i::JSObject::GetDataProperty(instance, key);
+  if (!value->IsJSFunction()) return i::Handle<i::JSFunction>::null();
+  i::Handle<i::JSFunction> function = i::Handle<i::JSFunction>::cast(value);
+
+  // Only wrappers that call the wasm code in their shared function info
+  // directly have a signature.
+  i::Zone zone;
+  i::wasm::FunctionSig* export_sig =
+      i::compiler::GetWasmExportSignature(&zone, *function);
+  if (export_sig == nullptr || !i::wasm::SameSignature(export_sig, sig)) {
+    return i::Handle<i::JSFunction>::null();
+  }
+  i::Handle<i::Code> wasm_code(function->shared()->code(), isolate);
+  return i::compiler::CompileWasmEntryWrapper(isolate, wasm_code, sig,
+                                              slots);
+}
+}  // namespace
+
+
+WasmExportBase::WasmExportBase(Isolate* isolate, Local<Object> instance,
+                               const char* name, WasmValueType result,
+                               const WasmValueType* params, int param_count)
+    : slots_(new uint8_t[(param_count + 1) * kSlotSize]), isolate_(isolate) {
+  i::Isolate* i_isolate = reinterpret_cast<i::Isolate*>(isolate);
+  i::HandleScope scope(i_isolate);
+  i::Zone zone;
+  i::wasm::FunctionSig::Builder builder(&zone, result == kWasmVoid ? 0 : 1,
+                                        param_count);
+  if (result != kWasmVoid) builder.AddReturn(ToLocalType(result));
+  for (int i = 0; i < param_count; i++) {
+    builder.AddParam(ToLocalType(params[i]));
+  }
+  i::Handle<i::JSFunction> entry =
+      CompileEntry(i_isolate, Utils::OpenHandle(*instance), name,
+                   builder.Build(), slots_);
+  if (!entry.is_null()) {
+    instance_.Reset(isolate, instance);
+    entry_.Reset(isolate, Utils::ToLocal(entry));
+  }
+}
+
+
+WasmExportBase::WasmExportBase(WasmExportBase&& other)
+    : slots_(other.slots_),
+      isolate_(other.isolate_),
+      instance_(std::move(other.instance_)),
+      entry_(std::move(other.entry_)) {
+  other.slots_ = nullptr;
+}
+
+
+WasmExportBase::~WasmExportBase() { delete[] slots_; }
+
+
+bool WasmExportBase::Invoke() {
+  DCHECK(IsValid());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(isolate_);
+  i::HandleScope scope(isolate);
+  bool call_depth_is_zero =
+      isolate->handle_scope_implementer()->CallDepthIsZero();
+  i::StackLimitCheck check(isolate);
+  if (check.HasOverflowed()) {
+    isolate->StackOverflow();
+    isolate->ReportPendingMessages();
+    isolate->OptionalRescheduleException(call_depth_is_zero);
+    return false;
+  }
+
+  // The entry function reads the parameters from the slots and stores the
+  // result into them, which are outside of the heap. It is entered through
+  // the JS entry stub, called as a C function, rather than through
+  // Execution::Call. A stub of its own would not do: traps throw, and both
+  // the stack walker and the exception unwinder only recognize the frame of
+  // the JS entry stub as the boundary to C++.
+  typedef i::Object* (*JSEntryFunction)(i::Object* new_target,
+                                        i::Object* target,
+                                        i::Object* receiver, int argc,
+                                        i::Object*** args);
+  JSEntryFunction stub_entry = i::FUNCTION_CAST<JSEntryFunction>(
+      isolate->factory()->js_entry_code()->entry());
+  Local<Function> entry = Local<Function>::New(isolate_, entry_);
+  i::Object* target = *Utils::OpenHandle(*entry);
+  i::Object* undefined = isolate->heap()->undefined_value();
+  i::Object* value;
+  {
+    i::SaveContext save(isolate);
+    i::SealHandleScope shs(isolate);
+    i::VMState<i::JS> state(isolate);
+    value = CALL_GENERATED_CODE(isolate, stub_entry, undefined, target,
+                                undefined, 0, nullptr);
+  }
+  if (value->IsException()) {
+    isolate->ReportPendingMessages();
+    isolate->OptionalRescheduleException(call_depth_is_zero);
+    return false;
+  }
+  isolate->clear_pending_message();
+  return true;
+}
+
+
+void WasmAsyncInstantiation::Enable(Isolate* isolate) {
+  i::wasm::EnableAsyncInstantiations(reinterpret_cast<i::Isolate*>(isolate));
+}
+
+
+void WasmAsyncInstantiation::Abort(Isolate* isolate) {
+  i::wasm::AbortAsyncInstantiations(reinterpret_cast<i::Isolate*>(isolate));
+}
+
+}  // namespace v8
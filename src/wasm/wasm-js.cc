@@ -16,6 +16,7 @@
 
 #include "src/wasm/asm-wasm-builder.h"
 #include "src/wasm/encoder.h"
+#include "src/wasm/wasm-compiler.h"
 #include "src/wasm/wasm-js.h"
 #include "src/wasm/wasm-module.h"
 #include "src/wasm/module-decoder.h"
@@ -28,31 +29,59 @@ using v8::internal::wasm::ErrorThrower;
 namespace v8 {
 
 namespace {
-struct RawBuffer {
-  const byte* start;
-  const byte* end;
+// The bytes of a buffer argument, which are read in place. The buffer cannot
+// be neutered while they are in use, since compilation and instantiation can
+// call into JavaScript.
+class RawBuffer {
+ public:
+  RawBuffer() : start(nullptr), end(nullptr) {}
+
+  ~RawBuffer() {
+    if (!pinned_.is_null()) pinned_->set_is_neuterable(true);
+  }
+
   size_t size() { return static_cast<size_t>(end - start); }
-};
 
-RawBuffer GetRawBufferArgument(
-    ErrorThrower& thrower, const v8::FunctionCallbackInfo<v8::Value>& args) {
-  if (args.Length() < 1 || !args[0]->IsArrayBuffer()) {
-    thrower.Error("Argument 0 must be an array buffer");
-    return {nullptr, nullptr};
+  void Set(Local<ArrayBuffer> buffer, size_t offset, size_t length) {
+    ArrayBuffer::Contents contents = buffer->GetContents();
+    if (contents.Data() == nullptr) return;
+    start = reinterpret_cast<const byte*>(contents.Data()) + offset;
+    end = start + length;
+    i::Handle<i::JSArrayBuffer> internal = v8::Utils::OpenHandle(*buffer);
+    if (internal->is_neuterable()) {
+      internal->set_is_neuterable(false);
+      pinned_ = internal;
+    }
   }
-  Local<ArrayBuffer> buffer = Local<ArrayBuffer>::Cast(args[0]);
-  ArrayBuffer::Contents contents =
-      buffer->IsExternal() ? buffer->GetContents() : buffer->Externalize();
 
-  // TODO(titzer): allow offsets into buffers, views, etc.
+  const byte* start;
+  const byte* end;
+
+ private:
+  i::Handle<i::JSArrayBuffer> pinned_;
+
+  DISALLOW_COPY_AND_ASSIGN(RawBuffer);
+};
 
-  const byte* start = reinterpret_cast<const byte*>(contents.Data());
-  const byte* end = start + contents.ByteLength();
+// Reads the bytes of an array buffer or of a view into one, without
+// externalizing the buffer.
+void GetRawBufferArgument(ErrorThrower& thrower,
+                          const v8::FunctionCallbackInfo<v8::Value>& args,
+                          RawBuffer* buffer) {
+  if (args.Length() > 0 && args[0]->IsArrayBuffer()) {
+    Local<ArrayBuffer> array_buffer = Local<ArrayBuffer>::Cast(args[0]);
+    buffer->Set(array_buffer, 0, array_buffer->ByteLength());
+  } else if (args.Length() > 0 && args[0]->IsArrayBufferView()) {
+    Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(args[0]);
+    buffer->Set(view->Buffer(), view->ByteOffset(), view->ByteLength());
+  } else {
+    thrower.Error("Argument 0 must be an array buffer or a view");
+    return;
+  }
 
-  if (start == nullptr) {
+  if (buffer->start == nullptr) {
     thrower.Error("ArrayBuffer argument is empty");
   }
-  return {start, end};
 }
 
 void VerifyModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -60,12 +89,18 @@ void VerifyModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
   i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
   ErrorThrower thrower(isolate, "WASM.verifyModule()");
 
-  RawBuffer buffer = GetRawBufferArgument(thrower, args);
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
   if (thrower.error()) return;
 
+  internal::wasm::ModuleResult result;
   i::Zone zone;
-  internal::wasm::ModuleResult result = internal::wasm::DecodeWasmModule(
-      isolate, &zone, buffer.start, buffer.end, true, false);
+  {
+    // Verification of a module shouldn't allocate.
+    i::DisallowHeapAllocation no_allocation;
+    result = internal::wasm::DecodeWasmModule(isolate, &zone, buffer.start,
+                                              buffer.end, true, false);
+  }
 
   if (result.failed()) {
     thrower.Failed("", result);
@@ -79,8 +114,8 @@ void VerifyFunction(const v8::FunctionCallbackInfo<v8::Value>& args) {
   i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
   ErrorThrower thrower(isolate, "WASM.verifyFunction()");
 
-  // TODO(titzer): no need to externalize to get the bytes for verification.
-  RawBuffer buffer = GetRawBufferArgument(thrower, args);
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
   if (thrower.error()) return;
 
   internal::wasm::FunctionResult result;
@@ -104,7 +139,8 @@ void CompileRun(const v8::FunctionCallbackInfo<v8::Value>& args) {
   i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
   ErrorThrower thrower(isolate, "WASM.compileRun()");
 
-  RawBuffer buffer = GetRawBufferArgument(thrower, args);
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
   if (thrower.error()) return;
 
   // Decode and pre-verify the functions before compiling and running.
@@ -171,14 +207,21 @@ void AsmCompileRun(const v8::FunctionCallbackInfo<v8::Value>& args) {
   args.GetReturnValue().Set(result);
 }
 
-void InstantiateModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  HandleScope scope(args.GetIsolate());
-  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
-  ErrorThrower thrower(isolate, "WASM.instantiateModule()");
-
-  RawBuffer buffer = GetRawBufferArgument(thrower, args);
-  if (buffer.start == nullptr) return;
+// Returns the object passed as the FFI argument, or an empty handle.
+i::Handle<i::JSObject> GetFFIArgument(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  i::Handle<i::JSObject> ffi = i::Handle<i::JSObject>::null();
+  if (args.Length() > 1 && args[1]->IsObject()) {
+    Local<Object> obj = Local<Object>::Cast(args[1]);
+    ffi = i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*obj));
+  }
+  return ffi;
+}
 
+// Returns the array buffer passed as the memory argument, whose backing store
+// the instance takes over, or an empty handle.
+i::Handle<i::JSArrayBuffer> GetMemoryArgument(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
   i::Handle<i::JSArrayBuffer> memory = i::Handle<i::JSArrayBuffer>::null();
   if (args.Length() > 2 && args[2]->IsArrayBuffer()) {
     Local<Object> obj = Local<Object>::Cast(args[2]);
@@ -188,6 +231,19 @@ void InstantiateModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
     memory->set_is_external(true);
     isolate->heap()->UnregisterArrayBuffer(*memory);
   }
+  return memory;
+}
+
+void InstantiateModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.instantiateModule()");
+
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
+  if (buffer.start == nullptr) return;
+
+  i::Handle<i::JSArrayBuffer> memory = GetMemoryArgument(args);
 
   // Decode but avoid a redundant pass over function bodies for verification.
   // Verification will happen during compilation.
@@ -199,11 +255,7 @@ void InstantiateModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
     thrower.Failed("", result);
   } else {
     // Success. Instantiate the module and return the object.
-    i::Handle<i::JSObject> ffi = i::Handle<i::JSObject>::null();
-    if (args.Length() > 1 && args[1]->IsObject()) {
-      Local<Object> obj = Local<Object>::Cast(args[1]);
-      ffi = i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*obj));
-    }
+    i::Handle<i::JSObject> ffi = GetFFIArgument(args);
 
     i::MaybeHandle<i::JSObject> object =
         result.val->Instantiate(isolate, ffi, memory);
@@ -215,6 +267,283 @@ void InstantiateModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
 
   if (result.val) delete result.val;
 }
+
+// Decodes and compiles a module into a compiled module object, which
+// WASM.instantiate() instantiates without decoding or compiling again.
+void CompileModule(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.compileModule()");
+
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
+  if (buffer.start == nullptr) return;
+
+  i::MaybeHandle<i::JSObject> compiled_module =
+      i::wasm::CompileModule(thrower, isolate, buffer.start, buffer.end);
+  if (!compiled_module.is_null()) {
+    args.GetReturnValue().Set(
+        v8::Utils::ToLocal(compiled_module.ToHandleChecked()));
+  }
+}
+
+void Instantiate(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.instantiate()");
+
+  if (args.Length() < 1 ||
+      !i::wasm::IsCompiledModule(v8::Utils::OpenHandle(*args[0]))) {
+    thrower.Error("Argument 0 must be a compiled module");
+    return;
+  }
+  i::Handle<i::JSObject> compiled_module =
+      i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*args[0]));
+
+  i::MaybeHandle<i::JSObject> object = i::wasm::InstantiateCompiledModule(
+      isolate, compiled_module, GetFFIArgument(args), GetMemoryArgument(args));
+  if (!object.is_null()) {
+    args.GetReturnValue().Set(v8::Utils::ToLocal(object.ToHandleChecked()));
+  }
+}
+
+// Restores the memory and globals of an instance of a compiled module to their
+// state after instantiation. Returns false if the instance cannot be reset.
+void ResetInstance(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.resetInstance()");
+
+  if (args.Length() < 1 || !v8::Utils::OpenHandle(*args[0])->IsJSObject()) {
+    thrower.Error("Argument 0 must be an instance");
+    return;
+  }
+  i::Handle<i::JSObject> instance =
+      i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*args[0]));
+  args.GetReturnValue().Set(i::wasm::ResetInstance(isolate, instance));
+}
+
+// Captures the memory and globals of an instance of a compiled module into a
+// snapshot, which WASM.instantiateSnapshot() creates instances from.
+void SnapshotInstance(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.snapshotInstance()");
+
+  if (args.Length() < 1 || !v8::Utils::OpenHandle(*args[0])->IsJSObject()) {
+    thrower.Error("Argument 0 must be an instance");
+    return;
+  }
+  i::Handle<i::JSObject> instance =
+      i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*args[0]));
+
+  i::MaybeHandle<i::JSObject> snapshot =
+      i::wasm::SnapshotInstance(thrower, isolate, instance);
+  if (!snapshot.is_null()) {
+    args.GetReturnValue().Set(v8::Utils::ToLocal(snapshot.ToHandleChecked()));
+  }
+}
+
+void InstantiateSnapshot(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.instantiateSnapshot()");
+
+  if (args.Length() < 1 ||
+      !i::wasm::IsInstanceSnapshot(v8::Utils::OpenHandle(*args[0]))) {
+    thrower.Error("Argument 0 must be a snapshot");
+    return;
+  }
+  i::Handle<i::JSObject> snapshot =
+      i::Handle<i::JSObject>::cast(v8::Utils::OpenHandle(*args[0]));
+
+  i::MaybeHandle<i::JSObject> object = i::wasm::InstantiateSnapshot(
+      thrower, isolate, snapshot, GetFFIArgument(args));
+  if (!object.is_null()) {
+    args.GetReturnValue().Set(v8::Utils::ToLocal(object.ToHandleChecked()));
+  }
+}
+
+// Like WASM.instantiateModule(), but returns a promise of the instance, and
+// decodes and compiles the module without blocking the caller. Throws unless
+// the embedder enabled it through v8::WasmAsyncInstantiation.
+void InstantiateModuleAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.instantiateModuleAsync()");
+  if (!i::wasm::AsyncInstantiationsEnabled(isolate)) {
+    // The embedder has not promised to abort the jobs at teardown.
+    thrower.Error("Asynchronous instantiation is not enabled by the embedder");
+    return;
+  }
+
+  RawBuffer buffer;
+  GetRawBufferArgument(thrower, args, &buffer);
+  if (buffer.start == nullptr) return;
+
+  Local<Context> context = args.GetIsolate()->GetCurrentContext();
+  Local<Promise::Resolver> resolver;
+  if (!Promise::Resolver::New(context).ToLocal(&resolver)) return;
+
+  // The job copies the bytes, which the caller may change in the meantime.
+  std::vector<byte> bytes(buffer.start, buffer.end);
+  i::wasm::InstantiateModuleAsync(
+      isolate, std::move(bytes), GetFFIArgument(args), GetMemoryArgument(args),
+      v8::Utils::OpenHandle(*resolver));
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// Returns the typed array passed as argument {index} if its elements have the
+// wasm type {type}, or an empty handle.
+Local<TypedArray> GetBatchArrayArgument(
+    const v8::FunctionCallbackInfo<v8::Value>& args, int index,
+    i::wasm::LocalType type) {
+  Local<Value> value = args[index];
+  bool matches = false;
+  switch (type) {
+    case i::wasm::kAstI32:
+      matches = value->IsInt32Array();
+      break;
+    case i::wasm::kAstF32:
+      matches = value->IsFloat32Array();
+      break;
+    case i::wasm::kAstF64:
+      matches = value->IsFloat64Array();
+      break;
+    default:
+      break;
+  }
+  return matches ? Local<TypedArray>::Cast(value) : Local<TypedArray>();
+}
+
+// Returns the batch wrapper of the exported {function}, compiling it upon the
+// first batch.
+i::MaybeHandle<i::JSFunction> GetBatchWrapper(i::Isolate* isolate,
+                                              i::Handle<i::JSFunction> function,
+                                              i::wasm::FunctionSig* sig) {
+  i::Handle<i::String> key =
+      isolate->factory()->InternalizeUtf8String("wasm_batch");
+  i::Object* cached = function->GetHiddenProperty(key);
+  if (cached->IsJSFunction()) {
+    return i::handle(i::JSFunction::cast(cached), isolate);
+  }
+  i::Handle<i::Code> wasm_code(function->shared()->code(), isolate);
+  i::Handle<i::JSFunction> batch =
+      i::compiler::CompileWasmBatchWrapper(isolate, wasm_code, sig);
+  if (batch.is_null()) return i::MaybeHandle<i::JSFunction>();
+  i::JSObject::SetHiddenProperty(function, key, batch);
+  return batch;
+}
+
+// Calls an exported function once for each element of typed arrays, i.e.
+// WASM.callBatch(func, results, args0, args1, ...) stores func(args0[i],
+// args1[i], ...) into results[i]. The results are undefined for functions
+// that return no value.
+void CallBatch(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  HandleScope scope(args.GetIsolate());
+  i::Isolate* isolate = reinterpret_cast<i::Isolate*>(args.GetIsolate());
+  ErrorThrower thrower(isolate, "WASM.callBatch()");
+
+  i::Zone zone;
+  i::wasm::FunctionSig* sig = nullptr;
+  i::Handle<i::JSFunction> function;
+  if (args.Length() > 0 && args[0]->IsFunction()) {
+    function = i::Handle<i::JSFunction>::cast(v8::Utils::OpenHandle(*args[0]));
+    sig = i::compiler::GetWasmExportSignature(&zone, *function);
+  }
+  if (sig == nullptr) {
+    thrower.Error("Argument 0 must be an exported wasm function");
+    return;
+  }
+  int params = static_cast<int>(sig->parameter_count());
+  if (args.Length() != params + 2) {
+    thrower.Error("Invalid argument count");
+    return;
+  }
+
+  // Arrays of the results and of the arguments of each parameter.
+  std::vector<Local<TypedArray>> arrays(params + 1);
+  if (sig->return_count() > 0) {
+    arrays[0] = GetBatchArrayArgument(args, 1, sig->GetReturn());
+    if (arrays[0].IsEmpty()) {
+      thrower.Error("Argument 1 must be a typed array of %s",
+                    i::wasm::WasmOpcodes::TypeName(sig->GetReturn()));
+      return;
+    }
+  } else if (!args[1]->IsUndefined()) {
+    thrower.Error("Argument 1 must be undefined");
+    return;
+  }
+  for (int i = 0; i < params; i++) {
+    arrays[i + 1] = GetBatchArrayArgument(args, i + 2, sig->GetParam(i));
+    if (arrays[i + 1].IsEmpty()) {
+      thrower.Error("Argument %d must be a typed array of %s", i + 2,
+                    i::wasm::WasmOpcodes::TypeName(sig->GetParam(i)));
+      return;
+    }
+  }
+
+  // All arrays have as many elements as there are calls.
+  size_t count = 0;
+  bool has_count = false;
+  for (Local<TypedArray> array : arrays) {
+    if (array.IsEmpty()) continue;
+    if (has_count && array->Length() != count) {
+      thrower.Error("Typed arrays must have the same length");
+      return;
+    }
+    count = array->Length();
+    has_count = true;
+  }
+  if (!has_count) {
+    thrower.Error("Function has no parameters or results");
+    return;
+  }
+  if (count > static_cast<size_t>(i::kMaxInt)) {
+    thrower.Error("Typed arrays are too long");
+    return;
+  }
+  if (count == 0) return;
+
+  i::Handle<i::JSFunction> batch;
+  if (!GetBatchWrapper(isolate, function, sig).ToHandle(&batch)) {
+    thrower.Error("Failed to compile batch wrapper");
+    return;
+  }
+
+  // Imports called by the function must not neuter the buffers, whose
+  // addresses the batch wrapper holds until it returns.
+  const int kSlotSize = i::compiler::kWasmEntrySlotSize;
+  i::Handle<i::ByteArray> slots =
+      isolate->factory()->NewByteArray((params + 2) * kSlotSize);
+  int32_t count_value = static_cast<int32_t>(count);
+  memcpy(slots->GetDataStartAddress(), &count_value, sizeof(count_value));
+  std::vector<i::Handle<i::JSArrayBuffer>> pinned;
+  for (size_t i = 0; i < arrays.size(); i++) {
+    byte* data = nullptr;
+    if (!arrays[i].IsEmpty()) {
+      Local<ArrayBuffer> buffer = arrays[i]->Buffer();
+      data = reinterpret_cast<byte*>(buffer->GetContents().Data()) +
+             arrays[i]->ByteOffset();
+      i::Handle<i::JSArrayBuffer> internal = v8::Utils::OpenHandle(*buffer);
+      if (internal->is_neuterable()) {
+        internal->set_is_neuterable(false);
+        pinned.push_back(internal);
+      }
+    }
+    memcpy(slots->GetDataStartAddress() + (i + 1) * kSlotSize, &data,
+           sizeof(data));
+  }
+
+  Local<Value> argv[] = {v8::Utils::ToLocal(i::Handle<i::Object>(slots))};
+  Local<Function> callee = v8::Utils::ToLocal(batch);
+  // A trap is rethrown when the callback returns.
+  USE(callee->Call(args.GetIsolate()->GetCurrentContext(),
+                   v8::Undefined(args.GetIsolate()), 1, argv));
+  for (i::Handle<i::JSArrayBuffer> buffer : pinned) {
+    buffer->set_is_neuterable(true);
+  }
+}
 }
 
 // TODO(titzer): we use the API to create the function template because the
@@ -257,10 +586,19 @@ void WasmJs::Install(Isolate* isolate, Handle<JSGlobalObject> global) {
 
   // Install functions on the WASM object.
   InstallFunc(isolate, wasm_object, "instantiateModule", InstantiateModule);
+  InstallFunc(isolate, wasm_object, "instantiateModuleAsync",
+              InstantiateModuleAsync);
+  InstallFunc(isolate, wasm_object, "compileModule", CompileModule);
+  InstallFunc(isolate, wasm_object, "instantiate", Instantiate);
+  InstallFunc(isolate, wasm_object, "resetInstance", ResetInstance);
+  InstallFunc(isolate, wasm_object, "snapshotInstance", SnapshotInstance);
+  InstallFunc(isolate, wasm_object, "instantiateSnapshot",
+              InstantiateSnapshot);
   InstallFunc(isolate, wasm_object, "verifyModule", VerifyModule);
   InstallFunc(isolate, wasm_object, "verifyFunction", VerifyFunction);
   InstallFunc(isolate, wasm_object, "compileRun", CompileRun);
   InstallFunc(isolate, wasm_object, "asmCompileRun", AsmCompileRun);
+  InstallFunc(isolate, wasm_object, "callBatch", CallBatch);
 }
 }  // namespace internal
 }  // namespace v8
@@ -2,7 +2,13 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <map>
+#include <vector>
+
 #include "src/assembler.h"
+#include "src/base/lazy-instance.h"
+#include "src/base/platform/mutex.h"
+#include "src/base/platform/platform.h"
 #include "src/macro-assembler.h"
 
 #include "src/wasm/wasm-module.h"
@@ -126,6 +132,25 @@ LinkageLocation stackloc(int i) {
 // Don't define anything. We'll just always use the stack.
 #endif
 
+// Registers in which native host functions receive their parameters and
+// return their result under the platform's C calling convention. Only
+// parameters passed in registers are supported. Where the stack of wasm code
+// is not kept aligned as C code expects, host functions are called through
+// a trampoline that aligns it, which takes their address in
+// HOST_TARGET_REGISTER.
+#if V8_TARGET_ARCH_X64 && !V8_OS_WIN
+#define HOST_GP_PARAM_REGISTERS rdi, rsi, rdx, rcx, r8, r9
+#define HOST_FP_PARAM_REGISTERS xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7
+#define HOST_GP_RETURN_REGISTER rax
+#define HOST_FP_RETURN_REGISTER xmm0
+#define HOST_TARGET_REGISTER rax
+#elif V8_TARGET_ARCH_ARM64 && !USE_SIMULATOR
+#define HOST_GP_PARAM_REGISTERS x0, x1, x2, x3, x4, x5, x6, x7
+#define HOST_FP_PARAM_REGISTERS d0, d1, d2, d3, d4, d5, d6, d7
+#define HOST_GP_RETURN_REGISTER x0
+#define HOST_FP_RETURN_REGISTER d0
+#endif
+
 // Helper for allocating either an GP or FP reg, or the next stack slot.
 struct Allocator {
   Allocator(const Register* gp, int gpc, const DoubleRegister* fp, int fpc)
@@ -178,11 +203,9 @@ struct Allocator {
     return 1;
   }
 };
-}  // namespace
 
 // General code uses the above configuration data.
-CallDescriptor* ModuleEnv::GetWasmCallDescriptor(Zone* zone,
-                                                 FunctionSig* fsig) {
+CallDescriptor* BuildWasmCallDescriptor(Zone* zone, FunctionSig* fsig) {
   MachineSignature::Builder msig(zone, fsig->return_count(),
                                  fsig->parameter_count());
   LocationSignature::Builder locations(zone, fsig->return_count(),
@@ -265,6 +288,133 @@ CallDescriptor* ModuleEnv::GetWasmCallDescriptor(Zone* zone,
       CallDescriptor::kUseNativeStack,    // flags
       "c-call");
 }
+
+// Call descriptors only depend on the signature, so they are shared by all
+// isolates and kept alive in a zone of their own. The key is the return count
+// followed by the return and parameter types.
+struct CallDescriptorCache {
+  static const size_t kMaxEntries = 1024;
+
+  base::Mutex mutex;
+  Zone zone;
+  std::map<std::vector<int>, CallDescriptor*> entries;
+};
+
+base::LazyInstance<CallDescriptorCache>::type call_descriptor_cache =
+    LAZY_INSTANCE_INITIALIZER;
+}  // namespace
+
+CallDescriptor* ModuleEnv::GetWasmCallDescriptor(Zone* zone,
+                                                 FunctionSig* fsig) {
+  std::vector<int> key;
+  key.reserve(fsig->return_count() + fsig->parameter_count() + 1);
+  key.push_back(static_cast<int>(fsig->return_count()));
+  for (size_t i = 0; i < fsig->return_count(); i++) {
+    key.push_back(fsig->GetReturn(i));
+  }
+  for (size_t i = 0; i < fsig->parameter_count(); i++) {
+    key.push_back(fsig->GetParam(i));
+  }
+
+  CallDescriptorCache* cache = call_descriptor_cache.Pointer();
+  base::LockGuard<base::Mutex> guard(&cache->mutex);
+  auto it = cache->entries.find(key);
+  if (it != cache->entries.end()) return it->second;
+  if (cache->entries.size() >= CallDescriptorCache::kMaxEntries) {
+    // Don't let unusual signatures grow the cache without bounds.
+    return BuildWasmCallDescriptor(zone, fsig);
+  }
+  CallDescriptor* descriptor = BuildWasmCallDescriptor(&cache->zone, fsig);
+  cache->entries.insert(std::make_pair(key, descriptor));
+  return descriptor;
+}
+
+CallDescriptor* ModuleEnv::GetHostCallDescriptor(Zone* zone,
+                                                 FunctionSig* fsig) {
+#ifdef HOST_GP_PARAM_REGISTERS
+  static const Register kGPParamRegisters[] = {HOST_GP_PARAM_REGISTERS};
+  static const int kGPParamRegistersCount =
+      static_cast<int>(arraysize(kGPParamRegisters));
+  static const DoubleRegister kFPParamRegisters[] = {HOST_FP_PARAM_REGISTERS};
+  static const int kFPParamRegistersCount =
+      static_cast<int>(arraysize(kFPParamRegisters));
+
+  if (fsig->return_count() > 1) return nullptr;
+#ifdef HOST_TARGET_REGISTER
+  const size_t extra_params = 1;
+#else
+  const size_t extra_params = 0;
+#endif
+  MachineSignature::Builder msig(zone, fsig->return_count(),
+                                 extra_params + fsig->parameter_count());
+  LocationSignature::Builder locations(
+      zone, fsig->return_count(), extra_params + fsig->parameter_count());
+  if (fsig->return_count() == 1) {
+    LocalType ret = fsig->GetReturn();
+    msig.AddReturn(MachineTypeFor(ret));
+    if (ret == kAstF32 || ret == kAstF64) {
+      locations.AddReturn(regloc(HOST_FP_RETURN_REGISTER));
+    } else {
+      locations.AddReturn(regloc(HOST_GP_RETURN_REGISTER));
+    }
+  }
+
+#ifdef HOST_TARGET_REGISTER
+  // The trampoline is called with the address of the host function.
+  msig.AddParam(kMachPtr);
+  locations.AddParam(regloc(HOST_TARGET_REGISTER));
+  CallDescriptor::Kind kind = CallDescriptor::kCallCodeObject;
+  MachineType target_type = kMachAnyTagged;
+#else
+  CallDescriptor::Kind kind = CallDescriptor::kCallAddress;
+  MachineType target_type = kMachPtr;
+#endif
+  Allocator params(kGPParamRegisters, kGPParamRegistersCount, kFPParamRegisters,
+                   kFPParamRegistersCount);
+  for (size_t i = 0; i < fsig->parameter_count(); i++) {
+    LocalType param = fsig->GetParam(i);
+    msig.AddParam(MachineTypeFor(param));
+    locations.AddParam(params.Next(param));
+  }
+  if (params.stack_offset > 0) return nullptr;
+
+  return new (zone) CallDescriptor(       // --
+      kind,                               // kind
+      target_type,                        // target MachineType
+      LinkageLocation::ForAnyRegister(),  // target location
+      msig.Build(),                       // machine_sig
+      locations.Build(),                  // location_sig
+      0,                                  // stack_parameter_count
+      compiler::Operator::kNoProperties,  // properties
+      0,                                  // callee-saved registers
+      0,                                  // callee-saved fp regs
+      CallDescriptor::kUseNativeStack,    // flags
+      "host-call");
+#else
+  return nullptr;
+#endif
+}
+
+Handle<Code> ModuleEnv::CompileHostCallTrampoline(Isolate* isolate) {
+#ifdef HOST_TARGET_REGISTER
+  // Aligns the stack for the call like CallCFunction does, and restores it
+  // from the frame pointer afterwards.
+  MacroAssembler masm(isolate, nullptr, 0, CodeObjectRequired::kYes);
+  masm.pushq(rbp);
+  masm.movp(rbp, rsp);
+  masm.andp(rsp, Immediate(-base::OS::ActivationFrameAlignment()));
+  masm.call(HOST_TARGET_REGISTER);
+  masm.movp(rsp, rbp);
+  masm.popq(rbp);
+  masm.ret(0);
+  CodeDesc desc;
+  masm.GetCode(&desc);
+  return isolate->factory()->NewCode(desc, Code::ComputeFlags(Code::STUB),
+                                     masm.CodeObject());
+#else
+  return Handle<Code>::null();
+#endif
+}
 }
 }
 }
@@ -102,6 +102,7 @@
       v8::internal::wasm::WasmOpcodes::LoadStoreOpcodeOf(type, true)), \
       v8::internal::wasm::WasmOpcodes::LoadStoreAccessOf(true),        \
       static_cast<byte>(offset), index, val
+#define WASM_GROW_MEMORY(delta) kExprGrowMemory, delta
 #define WASM_CALL_FUNCTION(index, ...) \
   kExprCallFunction, static_cast<byte>(index), __VA_ARGS__
 #define WASM_CALL_INDIRECT(index, func, ...) \
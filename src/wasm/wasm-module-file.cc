@@ -0,0 +1,72 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/wasm/wasm-module-file.h"
+
+#include <stdio.h>
+
+#include "src/base/platform/platform.h"
+
+#if V8_OS_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace v8 {
+namespace internal {
+namespace wasm {
+
+WasmModuleFile* WasmModuleFile::Open(const char* path) {
+#if V8_OS_POSIX
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = static_cast<size_t>(info.st_size);
+  void* memory = MAP_FAILED;
+  if (size > 0) {
+    memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  // The mapping stays valid after the file is closed.
+  close(fd);
+  if (memory != MAP_FAILED) {
+    return new WasmModuleFile(reinterpret_cast<const byte*>(memory), size,
+                              true);
+  }
+#endif
+
+  // Read files that cannot be mapped.
+  FILE* file = base::OS::FOpen(path, "rb");
+  if (file == nullptr) return nullptr;
+  std::vector<byte> bytes;
+  byte buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    bytes.insert(bytes.end(), buffer, buffer + read);
+  }
+  bool failed = ferror(file) != 0;
+  fclose(file);
+  if (failed) return nullptr;
+  WasmModuleFile* result = new WasmModuleFile(nullptr, 0, false);
+  result->bytes_.swap(bytes);
+  result->start_ = result->bytes_.data();
+  result->size_ = result->bytes_.size();
+  return result;
+}
+
+WasmModuleFile::~WasmModuleFile() {
+#if V8_OS_POSIX
+  if (mapped_) {
+    munmap(const_cast<byte*>(start_), size_);
+  }
+#endif
+}
+}
+}
+}  // namespace v8::internal::wasm
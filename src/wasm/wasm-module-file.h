@@ -0,0 +1,46 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V8_WASM_MODULE_FILE_H_
+#define V8_WASM_MODULE_FILE_H_
+
+#include <vector>
+
+#include "src/base/macros.h"
+#include "src/globals.h"
+
+namespace v8 {
+namespace internal {
+namespace wasm {
+
+// The bytes of a module file. Where supported, the file is mapped read-only,
+// so that only the parts that are decoded or copied are read, and the pages
+// stay shared with the page cache. Elsewhere the file is read into memory.
+// The file must not be truncated while it is mapped.
+class WasmModuleFile {
+ public:
+  // Opens the file at {path}, or returns nullptr if it cannot be read.
+  static WasmModuleFile* Open(const char* path);
+
+  ~WasmModuleFile();
+
+  const byte* start() const { return start_; }
+  const byte* end() const { return start_ + size_; }
+
+ private:
+  WasmModuleFile(const byte* start, size_t size, bool mapped)
+      : start_(start), size_(size), mapped_(mapped) {}
+
+  const byte* start_;
+  size_t size_;
+  bool mapped_;              // true if {start_} is a mapping of the file.
+  std::vector<byte> bytes_;  // the contents of a file that is not mapped.
+
+  DISALLOW_COPY_AND_ASSIGN(WasmModuleFile);
+};
+}
+}
+}  // namespace v8::internal::wasm
+
+#endif  // V8_WASM_MODULE_FILE_H_
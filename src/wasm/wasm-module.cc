@@ -2,17 +2,43 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <tuple>
+
 #include "src/v8.h"
 #include "src/macro-assembler.h"
 #include "src/objects.h"
 
+#include "src/base/atomicops.h"
+#include "src/base/lazy-instance.h"
+#include "src/base/platform/mutex.h"
+#include "src/base/platform/platform.h"
+#include "src/base/platform/semaphore.h"
+#include "src/global-handles.h"
 #include "src/simulator.h"
 
 #include "src/wasm/ast-decoder.h"
 #include "src/wasm/wasm-compiler.h"
 #include "src/wasm/module-decoder.h"
 #include "src/wasm/wasm-module.h"
+#include "src/wasm/wasm-module-file.h"
 #include "src/wasm/wasm-result.h"
+#include "src/wasm/wasm-serializer.h"
+#include "src/wasm/wasm-trap-handler.h"
+
+#if V8_OS_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_memfd_create) && defined(F_ADD_SEALS) && \
+    defined(MFD_ALLOW_SEALING)
+#define V8_WASM_MEMORY_IMAGE 1
+#endif
+#endif
 
 namespace v8 {
 namespace internal {
@@ -56,6 +82,20 @@ std::ostream& operator<<(std::ostream& os, const WasmFunction& function) {
   return os;
 }
 
+bool SameSignature(FunctionSig* a, FunctionSig* b) {
+  if (a->return_count() != b->return_count() ||
+      a->parameter_count() != b->parameter_count()) {
+    return false;
+  }
+  for (size_t i = 0; i < a->return_count(); i++) {
+    if (a->GetReturn(i) != b->GetReturn(i)) return false;
+  }
+  for (size_t i = 0; i < a->parameter_count(); i++) {
+    if (a->GetParam(i) != b->GetParam(i)) return false;
+  }
+  return true;
+}
+
 // A helper class for compiling multiple wasm functions that offers
 // placeholder code objects for calling functions that are not yet compiled.
 class WasmLinker {
@@ -83,6 +123,13 @@ class WasmLinker {
     return function_code_[index];
   }
 
+  // Makes room for more functions, for a module that is still arriving.
+  void Resize(size_t size) {
+    DCHECK_GE(size, function_code_.size());
+    placeholder_code_.resize(size);
+    function_code_.resize(size);
+  }
+
   void Finish(uint32_t index, Handle<Code> code) {
     DCHECK(index < function_code_.size());
     function_code_[index] = code;
@@ -91,7 +138,8 @@ class WasmLinker {
   void Link(Handle<FixedArray> function_table,
             std::vector<uint16_t>* functions) {
     for (size_t i = 0; i < function_code_.size(); i++) {
-      LinkFunction(function_code_[i]);
+      // External functions are missing when compiling shared code.
+      if (!function_code_[i].is_null()) LinkFunction(function_code_[i]);
     }
     if (functions && !function_table.is_null()) {
       int table_size = static_cast<int>(functions->size());
@@ -143,11 +191,61 @@ class WasmLinker {
 
 namespace {
 // Internal constants for the layout of the module object.
-const int kWasmModuleInternalFieldCount = 4;
+const int kWasmModuleInternalFieldCount = 10;
 const int kWasmModuleFunctionTable = 0;
 const int kWasmModuleCodeTable = 1;
 const int kWasmMemArrayBuffer = 2;
 const int kWasmGlobalsArrayBuffer = 3;
+const int kWasmModuleDeferredData = 4;
+const int kWasmModuleInstanceContext = 5;
+const int kWasmModuleCompiledModule = 6;
+const int kWasmMemReservation = 7;
+const int kWasmModuleSnapshot = 8;
+const int kWasmModuleOutOfBoundsStub = 9;
+
+// Internal constants for the layout of the compiled module object.
+const int kCompiledModuleInternalFieldCount = 2;
+const int kCompiledModuleCodeTable = 0;
+const int kCompiledModuleSharedData = 1;
+
+// Internal constants for the layout of the snapshot object.
+const int kSnapshotInternalFieldCount = 3;
+const int kSnapshotCompiledModule = 0;
+const int kSnapshotGlobals = 1;
+const int kSnapshotData = 2;
+
+// The brands of the objects created by this file. Private symbols cannot be
+// read, set or copied by script, unlike the layout of the internal fields,
+// which any object created from a template can mimic.
+const char* const kCompiledModuleBrand = "WASM.compiledModule";
+const char* const kInstanceBrand = "WASM.instance";
+const char* const kSnapshotBrand = "WASM.instanceSnapshot";
+
+v8::Local<v8::Private> GetBrand(Isolate* isolate, const char* brand) {
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  return v8::Private::ForApi(
+      v8_isolate, v8::String::NewFromUtf8(v8_isolate, brand,
+                                          v8::NewStringType::kInternalized)
+                      .ToLocalChecked());
+}
+
+void SetBrand(Isolate* isolate, Handle<JSObject> object, const char* brand) {
+  v8::Local<v8::Context> context =
+      v8::Utils::ToLocal(handle(isolate->native_context(), isolate));
+  CHECK(v8::Utils::ToLocal(object)
+            ->SetPrivate(context, GetBrand(isolate, brand),
+                         v8::True(reinterpret_cast<v8::Isolate*>(isolate)))
+            .FromJust());
+}
+
+bool HasBrand(Isolate* isolate, Handle<Object> object, const char* brand) {
+  if (!object->IsJSObject() || isolate->context() == nullptr) return false;
+  v8::Local<v8::Context> context =
+      v8::Utils::ToLocal(handle(isolate->native_context(), isolate));
+  return v8::Utils::ToLocal(Handle<JSObject>::cast(object))
+      ->HasPrivate(context, GetBrand(isolate, brand))
+      .FromMaybe(false);
+}
 
 size_t AllocateGlobalsOffsets(std::vector<WasmGlobal>* globals) {
   uint32_t offset = 0;
@@ -173,6 +271,240 @@ void LoadDataSegments(WasmModule* module, byte* mem_addr, size_t mem_size) {
   }
 }
 
+#if V8_WASM_MEMORY_IMAGE
+// The contents of some pages of a linear memory, kept in a sealed memory file.
+// Instances map these pages copy-on-write instead of copying their contents,
+// so that they share the pages until they write to them. The image either
+// holds the pages that large data segments initialize, or all pages of a
+// memory that are not zero.
+class MemoryImage {
+ public:
+  // Builds the image of the pages that large, page-aligned data segments of
+  // {module} initialize, or returns nullptr if no segment is large enough or
+  // the memory file cannot be created.
+  static MemoryImage* ForDataSegments(WasmModule* module) {
+    size_t page_size = base::OS::CommitPageSize();
+    std::vector<Run> runs;
+    for (const WasmDataSegment& segment : *module->data_segments) {
+      if (!segment.init || segment.dest_addr % page_size != 0 ||
+          segment.source_size < page_size) {
+        continue;
+      }
+      size_t end = static_cast<size_t>(segment.dest_addr) + segment.source_size;
+      runs.push_back({segment.dest_addr, RoundUp(end, page_size)});
+    }
+    if (runs.empty()) return nullptr;
+
+    // Merge the pages of overlapping and adjacent segments.
+    std::sort(runs.begin(), runs.end(),
+              [](const Run& a, const Run& b) { return a.start < b.start; });
+    size_t last = 0;
+    for (size_t i = 1; i < runs.size(); i++) {
+      if (runs[i].start <= runs[last].end) {
+        runs[last].end = std::max(runs[last].end, runs[i].end);
+      } else {
+        runs[++last] = runs[i];
+      }
+    }
+    runs.resize(last + 1);
+
+    MemoryImage* image = Create(&runs, true);
+    if (!image) return nullptr;
+    // The pages hold the contents of all segments, applied in order like
+    // {LoadDataSegments}.
+    std::vector<byte> contents;
+    for (const Run& run : image->runs_) {
+      contents.assign(run.end - run.start, 0);
+      for (const WasmDataSegment& segment : *module->data_segments) {
+        if (!segment.init) continue;
+        size_t start = std::max<size_t>(segment.dest_addr, run.start);
+        size_t end = std::min<size_t>(
+            static_cast<size_t>(segment.dest_addr) + segment.source_size,
+            run.end);
+        CopySegmentPart(module, segment, contents.data(), run.start, start,
+                        end);
+      }
+      if (!image->WriteRun(run, contents.data())) {
+        delete image;
+        return nullptr;
+      }
+    }
+    if (!image->Seal()) {
+      delete image;
+      return nullptr;
+    }
+    return image;
+  }
+
+  // Builds the image of the pages of the {mem_size} bytes at {mem_addr} that
+  // are not zero, or returns nullptr if the memory file cannot be created.
+  static MemoryImage* ForMemory(const byte* mem_addr, size_t mem_size) {
+    size_t page_size = base::OS::CommitPageSize();
+    size_t size = RoundUp(mem_size, page_size);
+    std::vector<Run> runs;
+    for (size_t page = 0; page < size; page += page_size) {
+      if (IsZero(mem_addr + page, page_size)) continue;
+      if (!runs.empty() && runs.back().end == page) {
+        runs.back().end = page + page_size;
+      } else {
+        runs.push_back({page, page + page_size});
+      }
+    }
+    MemoryImage* image = Create(&runs, false);
+    if (!image) return nullptr;
+    for (const Run& run : image->runs_) {
+      if (!image->WriteRun(run, mem_addr + run.start)) {
+        delete image;
+        return nullptr;
+      }
+    }
+    if (!image->Seal()) {
+      delete image;
+      return nullptr;
+    }
+    return image;
+  }
+
+  ~MemoryImage() { close(fd_); }
+
+  // Maps the image over the pages of the freshly committed or discarded
+  // memory at {mem_addr}. Returns false if that fails, in which case all
+  // pages are committed again, and their contents have to be copied instead.
+  bool Map(byte* mem_addr, size_t mem_size) {
+    if (runs_.empty()) return true;
+    size_t page_size = base::OS::CommitPageSize();
+    if (runs_.back().end > RoundUp(mem_size, page_size)) return false;
+    for (const Run& run : runs_) {
+      size_t size = run.end - run.start;
+      void* addr =
+          mmap(mem_addr + run.start, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_FIXED, fd_, static_cast<off_t>(run.start));
+      if (addr == MAP_FAILED) {
+        // A failed fixed mapping may leave a hole in the memory.
+        CHECK(base::VirtualMemory::CommitRegion(mem_addr + run.start, size,
+                                                false));
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Copies the parts of the segments of {module} that lie outside the mapped
+  // pages of an image of its data segments, which already hold the contents
+  // of all segments. Images of memories need nothing copied.
+  void CopyUnmappedParts(WasmModule* module, byte* mem_addr, size_t mem_size) {
+    if (!for_segments_) return;
+    for (const WasmDataSegment& segment : *module->data_segments) {
+      if (!segment.init) continue;
+      CHECK_LE(static_cast<size_t>(segment.dest_addr) + segment.source_size,
+               mem_size);
+      size_t start = segment.dest_addr;
+      size_t end = start + segment.source_size;
+      for (const Run& run : runs_) {
+        if (run.start >= end) break;
+        if (run.end <= start) continue;
+        if (start < run.start) {
+          CopySegmentPart(module, segment, mem_addr, 0, start, run.start);
+        }
+        start = run.end;
+      }
+      CopySegmentPart(module, segment, mem_addr, 0, start, end);
+    }
+  }
+
+ private:
+  // A range of pages of the memory, and of the file.
+  struct Run {
+    size_t start;
+    size_t end;
+  };
+
+  MemoryImage(int fd, bool for_segments)
+      : fd_(fd), for_segments_(for_segments) {}
+
+  // Creates the memory file for the given runs, which the image takes.
+  static MemoryImage* Create(std::vector<Run>* runs, bool for_segments) {
+    int fd = static_cast<int>(syscall(__NR_memfd_create, "wasm-memory",
+                                      MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    if (fd < 0) return nullptr;
+    MemoryImage* image = new MemoryImage(fd, for_segments);
+    image->runs_.swap(*runs);
+    size_t size = image->runs_.empty() ? 0 : image->runs_.back().end;
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      delete image;
+      return nullptr;
+    }
+    return image;
+  }
+
+  // Writes the contents of the pages of {run}.
+  bool WriteRun(const Run& run, const byte* contents) {
+    size_t size = run.end - run.start;
+    size_t written = 0;
+    while (written < size) {
+      ssize_t result = pwrite(fd_, contents + written, size - written,
+                              static_cast<off_t>(run.start + written));
+      if (result <= 0) return false;
+      written += static_cast<size_t>(result);
+    }
+    return true;
+  }
+
+  // Seals the file after all runs are written.
+  bool Seal() {
+    return fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE |
+                                       F_SEAL_SEAL) == 0;
+  }
+
+  // Copies the part of {segment} that goes to [{start}, {end}) of the memory
+  // into {dest}, which holds the memory from offset {dest_offset} on.
+  static void CopySegmentPart(WasmModule* module,
+                              const WasmDataSegment& segment, byte* dest,
+                              size_t dest_offset, size_t start, size_t end) {
+    if (start >= end) return;
+    memcpy(dest + (start - dest_offset),
+           module->module_start + segment.source_offset +
+               (start - segment.dest_addr),
+           end - start);
+  }
+
+  static bool IsZero(const byte* start, size_t size) {
+    const uintptr_t* words = reinterpret_cast<const uintptr_t*>(start);
+    for (size_t i = 0; i < size / sizeof(uintptr_t); i++) {
+      if (words[i] != 0) return false;
+    }
+    return true;
+  }
+
+  int fd_;
+  bool for_segments_;
+  std::vector<Run> runs_;  // sorted, disjoint ranges of pages.
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryImage);
+};
+
+#else
+
+class MemoryImage {
+ public:
+  static MemoryImage* ForDataSegments(WasmModule* module) { return nullptr; }
+
+  static MemoryImage* ForMemory(const byte* mem_addr, size_t mem_size) {
+    return nullptr;
+  }
+
+  bool Map(byte* mem_addr, size_t mem_size) {
+    UNREACHABLE();
+    return false;
+  }
+
+  void CopyUnmappedParts(WasmModule* module, byte* mem_addr, size_t mem_size) {
+    UNREACHABLE();
+  }
+};
+
+#endif  // V8_WASM_MEMORY_IMAGE
+
 Handle<FixedArray> BuildFunctionTable(Isolate* isolate, WasmModule* module) {
   if (!module->function_table || module->function_table->size() == 0) {
     return Handle<FixedArray>::null();
@@ -187,227 +519,2387 @@ Handle<FixedArray> BuildFunctionTable(Isolate* isolate, WasmModule* module) {
   return fixed;
 }
 
-Handle<JSArrayBuffer> NewArrayBuffer(Isolate* isolate, int size,
-                                     byte** backing_store) {
-  void* memory = isolate->array_buffer_allocator()->Allocate(size);
-  if (!memory) return Handle<JSArrayBuffer>::null();
-  *backing_store = reinterpret_cast<byte*>(memory);
+// A queue of compilation units that are executed by the isolate's thread
+// together with a number of background tasks.
+class WasmCompilationQueue {
+ public:
+  explicit WasmCompilationQueue(
+      std::vector<compiler::WasmCompilationUnit*>* units)
+      : units_(units), next_(0) {}
 
-#if DEBUG
-  // Double check the API allocator actually zero-initialized the memory.
-  for (uint32_t i = 0; i < size; i++) {
-    DCHECK_EQ(0, (*backing_store)[i]);
+  // Executes units until the queue is exhausted. Can be called from any
+  // thread.
+  void ExecuteUnits() {
+    while (compiler::WasmCompilationUnit* unit = Next()) {
+      compiler::ExecuteCompilation(unit);
+    }
   }
-#endif
 
-  Handle<JSArrayBuffer> buffer = isolate->factory()->NewJSArrayBuffer();
-  JSArrayBuffer::Setup(buffer, isolate, true, memory, size);
-  buffer->set_is_neuterable(false);
-  return buffer;
-}
+ private:
+  std::vector<compiler::WasmCompilationUnit*>* units_;
+  size_t next_;
+  base::Mutex mutex_;
 
-}  // namespace
+  compiler::WasmCompilationUnit* Next() {
+    base::LockGuard<base::Mutex> guard(&mutex_);
+    if (next_ >= units_->size()) return nullptr;
+    return units_->at(next_++);
+  }
+};
 
-// Instantiates a wasm module as a JSObject.
-//  * allocates a backing store of {mem_size} bytes.
-//  * installs a named property "memory" for that buffer if exported
-//  * installs named properties on the object for exported functions
-//  * compiles wasm code to machine code
-MaybeHandle<JSObject> WasmModule::Instantiate(Isolate* isolate,
-                                              Handle<JSObject> ffi,
-                                              Handle<JSArrayBuffer> memory) {
-  this->shared_isolate = isolate;  // TODO: have a real shared isolate.
-  ErrorThrower thrower(isolate, "WasmModule::Instantiate()");
+// A background task that helps executing the units of a queue.
+class WasmCompilationTask : public v8::Task {
+ public:
+  WasmCompilationTask(WasmCompilationQueue* queue, base::Semaphore* done)
+      : queue_(queue), done_(done) {}
 
-  Factory* factory = isolate->factory();
-  // Memory is bigger than maximum supported size.
-  if (memory.is_null() && min_mem_size_log2 > kMaxMemSize) {
-    thrower.Error("Out of memory: wasm memory too large");
-    return MaybeHandle<JSObject>();
+  void Run() override {
+    queue_->ExecuteUnits();
+    done_->Signal();
   }
 
-  Handle<Map> map = factory->NewMap(
-      JS_OBJECT_TYPE,
-      JSObject::kHeaderSize + kWasmModuleInternalFieldCount * kPointerSize);
+ private:
+  WasmCompilationQueue* queue_;
+  base::Semaphore* done_;
+};
 
-  //-------------------------------------------------------------------------
-  // Allocate the module object.
-  //-------------------------------------------------------------------------
-  Handle<JSObject> module = factory->NewJSObjectFromMap(map, TENURED);
-  Handle<FixedArray> code_table =
-      factory->NewFixedArray(static_cast<int>(functions->size()), TENURED);
+// Compiles all functions in the module that are not external to the given
+// tier, storing the code into {results} and installing it into the linker.
+// Functions whose code is in {results} already are skipped.
+// The optimization of the graphs is distributed over background threads;
+// the isolate's thread builds the graphs when creating the units, and runs
+// the backend pipeline when finishing them.
+void CompileFunctions(ErrorThrower& thrower, Isolate* isolate,
+                      ModuleEnv* module_env, compiler::WasmCodeTier tier,
+                      std::vector<Handle<Code>>* results) {
+  WasmModule* module = module_env->module;
+  results->resize(module->functions->size());
 
-  //-------------------------------------------------------------------------
-  // Allocate the linear memory.
-  //-------------------------------------------------------------------------
-  uint32_t mem_size = 1 << min_mem_size_log2;
-  byte* mem_addr = nullptr;
-  Handle<JSArrayBuffer> mem_buffer;
-  if (!memory.is_null()) {
-    memory->set_is_neuterable(false);
-    mem_addr = reinterpret_cast<byte*>(memory->backing_store());
-    mem_size = memory->byte_length()->Number();
-    mem_buffer = memory;
-  } else {
-    mem_buffer = NewArrayBuffer(isolate, mem_size, &mem_addr);
-    if (!mem_addr) {
-      // Not enough space for backing store of memory
-      thrower.Error("Out of memory: wasm memory");
-      return MaybeHandle<JSObject>();
+  // Create the compilation units on the isolate's thread.
+  std::vector<compiler::WasmCompilationUnit*> units;
+  int index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external && results->at(index).is_null()) {
+      units.push_back(compiler::CreateWasmCompilationUnit(
+          thrower, isolate, module_env, func, index, tier));
     }
+    index++;
   }
 
-  // Load initialized data segments.
-  LoadDataSegments(this, mem_addr, mem_size);
-
-  module->SetInternalField(kWasmMemArrayBuffer, *mem_buffer);
-
-  if (mem_export) {
-    // Export the memory as a named property.
-    Handle<String> name = factory->InternalizeUtf8String("memory");
-    JSObject::AddProperty(module, name, mem_buffer, READ_ONLY);
+  // Execute the units concurrently. The isolate's thread takes part.
+  WasmCompilationQueue queue(&units);
+  base::Semaphore done(0);
+  v8::Platform* platform = V8::GetCurrentPlatform();
+  size_t num_tasks = 0;
+  if (units.size() > 1) {
+    num_tasks = Min(units.size() - 1,
+                    platform->NumberOfAvailableBackgroundThreads());
   }
+  for (size_t i = 0; i < num_tasks; i++) {
+    platform->CallOnBackgroundThread(new WasmCompilationTask(&queue, &done),
+                                     v8::Platform::kShortRunningTask);
+  }
+  queue.ExecuteUnits();
+  for (size_t i = 0; i < num_tasks; i++) done.Wait();
 
-  //-------------------------------------------------------------------------
-  // Allocate the globals area if necessary.
-  //-------------------------------------------------------------------------
-  size_t globals_size = AllocateGlobalsOffsets(globals);
-  byte* globals_addr = nullptr;
-  if (globals_size > 0) {
-    Handle<JSArrayBuffer> globals_buffer =
-        NewArrayBuffer(isolate, mem_size, &globals_addr);
-    if (!globals_addr) {
-      // Not enough space for backing store of globals.
-      thrower.Error("Out of memory: wasm globals");
-      return MaybeHandle<JSObject>();
+  // Generate the code on the isolate's thread. Every unit is finished, even
+  // after an error, so that all of them are deleted.
+  index = 0;
+  size_t unit_index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external && results->at(index).is_null()) {
+      Handle<Code> code = compiler::FinishCompilation(units[unit_index++]);
+      if (!code.is_null()) {
+        results->at(index) = code;
+        module_env->linker->Finish(index, code);
+      } else {
+        thrower.Error("Compilation of #%d:%s failed.", index,
+                      module->GetName(func.name_offset));
+      }
     }
+    index++;
+  }
+}
 
-    module->SetInternalField(kWasmGlobalsArrayBuffer, *globals_buffer);
-  } else {
-    module->SetInternalField(kWasmGlobalsArrayBuffer, Smi::FromInt(0));
+// The number of function entries and loop iterations after which quick tier
+// code asks for the function to be optimized.
+const int32_t kTierUpBudget = 1000;
+
+// A copy of the module bytes, or the file they were read from, together with
+// the module decoded from them, for data that outlives the bytes passed to
+// instantiation.
+class OwnedModule {
+ public:
+  OwnedModule() : module_(nullptr) {}
+
+  ~OwnedModule() {
+    if (!module_) return;
+    delete module_->globals;
+    delete module_->signatures;
+    delete module_->functions;
+    delete module_->data_segments;
+    delete module_->function_table;
+    delete module_;
   }
 
-  //-------------------------------------------------------------------------
-  // Compile all functions in the module.
-  //-------------------------------------------------------------------------
-  int index = 0;
-  WasmLinker linker(isolate, functions->size());
-  ModuleEnv module_env;
-  module_env.module = this;
-  module_env.mem_start = reinterpret_cast<uintptr_t>(mem_addr);
-  module_env.mem_end = reinterpret_cast<uintptr_t>(mem_addr) + mem_size;
-  module_env.globals_area = reinterpret_cast<uintptr_t>(globals_addr);
-  module_env.linker = &linker;
-  module_env.function_code = nullptr;
-  module_env.function_table = BuildFunctionTable(isolate, this);
-  module_env.memory = memory;
-  module_env.context = isolate->native_context();
-  module_env.asm_js = false;
+  // Copies and decodes the bytes. Returns the result of decoding, whose value
+  // this object owns.
+  ModuleResult Decode(Isolate* isolate, const byte* start, const byte* end) {
+    bytes_.assign(start, end);
+    const byte* copy = bytes_.data();
+    return DecodeOwnedBytes(isolate, copy, copy + bytes_.size());
+  }
 
-  // First pass: compile each function and initialize the code table.
-  for (const WasmFunction& func : *functions) {
-    if (thrower.error()) break;
+  // Takes ownership of {file} and decodes its bytes in place.
+  ModuleResult Decode(Isolate* isolate, WasmModuleFile* file) {
+    file_.Reset(file);
+    return DecodeOwnedBytes(isolate, file->start(), file->end());
+  }
 
-    const char* cstr = GetName(func.name_offset);
-    Handle<String> name = factory->InternalizeUtf8String(cstr);
-    Handle<Code> code = Handle<Code>::null();
-    Handle<JSFunction> function = Handle<JSFunction>::null();
-    if (func.external) {
-      // Lookup external function in FFI object.
-      if (!ffi.is_null()) {
-        MaybeHandle<Object> result = Object::GetProperty(ffi, name);
-        if (!result.is_null()) {
-          Handle<Object> obj = result.ToHandleChecked();
-          if (obj->IsJSFunction()) {
-            function = Handle<JSFunction>::cast(obj);
-            code = compiler::CompileWasmToJSWrapper(isolate, &module_env,
-                                                    function, index);
-          } else {
-            thrower.Error("FFI function #%d:%s is not a JSFunction.", index,
-                          cstr);
-            return MaybeHandle<JSObject>();
-          }
-        } else {
-          thrower.Error("FFI function #%d:%s not found.", index, cstr);
-          return MaybeHandle<JSObject>();
-        }
-      } else {
-        thrower.Error("FFI table is not an object.");
-        return MaybeHandle<JSObject>();
-      }
-    } else {
-      // Compile the function.
-      code = compiler::CompileWasmFunction(thrower, isolate, &module_env, func,
-                                           index);
-      if (code.is_null()) {
-        thrower.Error("Compilation of #%d:%s failed.", index, cstr);
-        return MaybeHandle<JSObject>();
+  // Copies the bytes of {module}, which has been decoded already, together
+  // with the decoded module, so that they need not be decoded again.
+  void Copy(Isolate* isolate, const WasmModule* module) {
+    bytes_.assign(module->module_start, module->module_end);
+    module_ = new WasmModule(*module);
+    module_->shared_isolate = isolate;
+    module_->module_start = bytes_.data();
+    module_->module_end = bytes_.data() + bytes_.size();
+    module_->globals = new std::vector<WasmGlobal>(*module->globals);
+    module_->signatures = new std::vector<FunctionSig*>();
+    for (FunctionSig* sig : *module->signatures) {
+      FunctionSig::Builder builder(&zone_, sig->return_count(),
+                                   sig->parameter_count());
+      for (size_t i = 0; i < sig->return_count(); i++) {
+        builder.AddReturn(sig->GetReturn(i));
       }
-      if (func.exported) {
-        function = compiler::CompileJSToWasmWrapper(isolate, &module_env, name,
-                                                    code, index);
+      for (size_t i = 0; i < sig->parameter_count(); i++) {
+        builder.AddParam(sig->GetParam(i));
       }
+      module_->signatures->push_back(builder.Build());
     }
-    if (!code.is_null()) {
-      // Install the code into the linker table.
-      linker.Finish(index, code);
-      code_table->set(index, *code);
-    }
-    if (func.exported) {
-      // Exported functions are installed as read-only properties on the module.
-      JSObject::AddProperty(module, name, function, READ_ONLY);
+    module_->functions = new std::vector<WasmFunction>(*module->functions);
+    for (WasmFunction& func : *module_->functions) {
+      func.sig = module_->signatures->at(func.sig_index);
     }
-    index++;
+    module_->data_segments =
+        new std::vector<WasmDataSegment>(*module->data_segments);
+    module_->function_table =
+        new std::vector<uint16_t>(*module->function_table);
   }
 
-  // Second pass: patch all direct call sites.
-  linker.Link(module_env.function_table, this->function_table);
+  WasmModule* module() { return module_; }
 
-  module->SetInternalField(kWasmModuleFunctionTable, Smi::FromInt(0));
-  module->SetInternalField(kWasmModuleCodeTable, *code_table);
-  return module;
-}
+ private:
+  Zone zone_;
+  std::vector<byte> bytes_;
+  base::SmartPointer<WasmModuleFile> file_;
+  WasmModule* module_;
 
-Handle<Code> ModuleEnv::GetFunctionCode(uint32_t index) {
-  DCHECK(IsValidFunction(index));
-  if (linker) return linker->GetFunctionCode(index);
-  if (function_code) return function_code->at(index);
-  return Handle<Code>::null();
-}
+  ModuleResult DecodeOwnedBytes(Isolate* isolate, const byte* start,
+                                const byte* end) {
+    ModuleResult result =
+        DecodeWasmModule(isolate, &zone_, start, end, false, false);
+    if (result.ok()) {
+      module_ = result.val;
+      module_->shared_isolate = isolate;
+      AllocateGlobalsOffsets(module_->globals);
+    } else if (result.val) {
+      delete result.val;
+      result.val = nullptr;
+    }
+    return result;
+  }
+};
 
-compiler::CallDescriptor* ModuleEnv::GetCallDescriptor(Zone* zone,
-                                                       uint32_t index) {
-  DCHECK(IsValidFunction(index));
-  // Always make a direct call to whatever is in the table at that location.
-  // A wrapper will be generated for FFI calls.
-  WasmFunction* function = &module->functions->at(index);
-  return GetWasmCallDescriptor(zone, function->sig);
-}
+struct TierUpJob;
 
-int32_t CompileAndRunWasmModule(Isolate* isolate, const byte* module_start,
-                                const byte* module_end, bool asm_js) {
-  HandleScope scope(isolate);
-  Zone zone;
-  // Decode the module, but don't verify function bodies, since we'll
-  // be compiling them anyway.
-  ModuleResult result =
-      DecodeWasmModule(isolate, &zone, module_start, module_end, false, false);
-  if (result.failed()) {
-    // Module verification failed. throw.
-    std::ostringstream str;
-    str << "WASM.compileRun() failed: " << result;
-    isolate->Throw(
-        *isolate->factory()->NewStringFromAsciiChecked(str.str().c_str()));
-    return -1;
+// The data needed to compile the functions of an instance after
+// instantiation. It owns a copy of the module bytes and of the module decoded
+// from them, and is deleted when the instance object dies. For tiered
+// compilation, it also holds the tier-up budgets of the functions and the
+// recompilations that are running, which keep the instance alive.
+class DeferredCompileData {
+ public:
+  // The state of the code of a function.
+  enum CodeState { kLazyStub, kQuickCode, kOptimizing, kOptimizedCode };
+
+  static DeferredCompileData* New(Isolate* isolate, WasmModule* module,
+                                  CodeState initial_state) {
+    DeferredCompileData* data = new DeferredCompileData();
+    data->owned_.Copy(isolate, module);
+    size_t function_count = data->module()->functions->size();
+    data->budgets_.assign(function_count, kTierUpBudget);
+    data->states_.assign(function_count, initial_state);
+    return data;
   }
 
-  int32_t retval = CompileAndRunWasmModule(isolate, result.val);
-  delete result.val;
-  return retval;
-}
+  WasmModule* module() { return owned_.module(); }
+  int32_t* budgets() { return &budgets_[0]; }
+  CodeState state(int index) { return states_[index]; }
+  void set_state(int index, CodeState state) { states_[index] = state; }
 
+  // The number of tier-up jobs that have been started and not finished.
+  int running_jobs() { return running_jobs_; }
+  void JobStarted() { running_jobs_++; }
+  void JobFinished() { running_jobs_--; }
 
-int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module) {
+  // Called on a background thread once the unit of {job} has been executed.
+  void AddExecutedJob(TierUpJob* job) {
+    {
+      base::LockGuard<base::Mutex> guard(&mutex_);
+      executed_jobs_.push_back(job);
+    }
+    job_executed_.Signal();
+  }
+
+  // Removes the jobs whose units have been executed, for finishing them.
+  std::vector<TierUpJob*> TakeExecutedJobs() {
+    base::LockGuard<base::Mutex> guard(&mutex_);
+    std::vector<TierUpJob*> jobs;
+    jobs.swap(executed_jobs_);
+    return jobs;
+  }
+
+  // Removes {job} if its unit has been executed and it has not been taken.
+  bool TakeExecutedJob(TierUpJob* job) {
+    base::LockGuard<base::Mutex> guard(&mutex_);
+    auto it = std::find(executed_jobs_.begin(), executed_jobs_.end(), job);
+    if (it == executed_jobs_.end()) return false;
+    executed_jobs_.erase(it);
+    return true;
+  }
+
+  // Blocks until the unit of another job has been executed.
+  void WaitForExecutedJob() { job_executed_.Wait(); }
+
+  // Ties the lifetime of this data to the given instance object.
+  void MakeWeak(Isolate* isolate, Handle<JSObject> instance) {
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+    instance_.Reset(v8_isolate, v8::Utils::ToLocal(instance));
+    instance_.SetWeak(this, &DeferredCompileData::Delete,
+                      v8::WeakCallbackType::kParameter);
+  }
+
+ private:
+  OwnedModule owned_;
+  std::vector<int32_t> budgets_;
+  std::vector<CodeState> states_;
+  v8::Global<v8::Object> instance_;
+  int running_jobs_;
+  base::Mutex mutex_;
+  std::vector<TierUpJob*> executed_jobs_;
+  base::Semaphore job_executed_;
+
+  DeferredCompileData() : running_jobs_(0), job_executed_(0) {}
+
+  static void Delete(const v8::WeakCallbackInfo<DeferredCompileData>& info) {
+    DeferredCompileData* data = info.GetParameter();
+    data->instance_.Reset();
+    delete data;
+  }
+};
+
+DeferredCompileData* GetDeferredCompileData(Handle<JSObject> instance) {
+  return reinterpret_cast<DeferredCompileData*>(
+      Foreign::cast(instance->GetInternalField(kWasmModuleDeferredData))
+          ->foreign_address());
+}
+
+// Creates the deferred compile data for the instance and stores it into the
+// instance object.
+DeferredCompileData* CreateDeferredCompileData(
+    Isolate* isolate, WasmModule* module, Handle<JSObject> instance,
+    DeferredCompileData::CodeState initial_state) {
+  DeferredCompileData* data =
+      DeferredCompileData::New(isolate, module, initial_state);
+  data->MakeWeak(isolate, instance);
+  instance->SetInternalField(
+      kWasmModuleDeferredData,
+      *isolate->factory()->NewForeign(reinterpret_cast<Address>(data)));
+  return data;
+}
+
+// Creates a JS function that calls {callback} with the instance as receiver.
+Handle<JSFunction> NewInstanceCallback(Isolate* isolate,
+                                       v8::FunctionCallback callback) {
+  v8::Local<v8::Function> local =
+      v8::Function::New(v8::Utils::ToLocal(isolate->native_context()),
+                        callback)
+          .ToLocalChecked();
+  return Handle<JSFunction>::cast(v8::Utils::OpenHandle(*local));
+}
+
+// The data of a compiled module, holding the location of the context of the
+// instance currently executing its code, and the module it was compiled from
+// if the compiled module owns it. It is deleted when the compiled module
+// object dies, which the instances sharing its code keep alive.
+class SharedCodeData {
+ public:
+  SharedCodeData()
+      : current_instance_(nullptr),
+        owned_(nullptr),
+        data_image_(nullptr),
+        data_image_built_(false) {}
+
+  ~SharedCodeData() {
+    delete data_image_;
+    delete owned_;
+  }
+
+  WasmInstanceContext** current_instance() { return &current_instance_; }
+
+  // The module owned by the compiled module, or nullptr.
+  WasmModule* module() { return owned_ ? owned_->module() : nullptr; }
+  void set_owned_module(OwnedModule* owned) { owned_ = owned; }
+
+  // The image of the data segments of the owned module, which is built when
+  // it is first instantiated, or nullptr if there is none.
+  MemoryImage* data_image() {
+    if (!data_image_built_ && module()) {
+      data_image_ = MemoryImage::ForDataSegments(module());
+      data_image_built_ = true;
+    }
+    return data_image_;
+  }
+
+  // Ties the lifetime of this data to the given compiled module object.
+  void MakeWeak(Isolate* isolate, Handle<JSObject> compiled_module) {
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+    compiled_module_.Reset(v8_isolate, v8::Utils::ToLocal(compiled_module));
+    compiled_module_.SetWeak(this, &SharedCodeData::Delete,
+                             v8::WeakCallbackType::kParameter);
+  }
+
+ private:
+  WasmInstanceContext* current_instance_;
+  OwnedModule* owned_;
+  MemoryImage* data_image_;
+  bool data_image_built_;
+  v8::Global<v8::Object> compiled_module_;
+
+  static void Delete(const v8::WeakCallbackInfo<SharedCodeData>& info) {
+    SharedCodeData* data = info.GetParameter();
+    data->compiled_module_.Reset();
+    delete data;
+  }
+};
+
+SharedCodeData* GetSharedCodeData(Handle<JSObject> compiled_module) {
+  Object* data = compiled_module->GetInternalField(kCompiledModuleSharedData);
+  return reinterpret_cast<SharedCodeData*>(
+      Foreign::cast(data)->foreign_address());
+}
+
+// Allocates a compiled module object together with its shared data.
+Handle<JSObject> NewCompiledModule(Isolate* isolate) {
+  Factory* factory = isolate->factory();
+  Handle<Map> map = factory->NewMap(
+      JS_OBJECT_TYPE,
+      JSObject::kHeaderSize + kCompiledModuleInternalFieldCount * kPointerSize);
+  Handle<JSObject> compiled_module = factory->NewJSObjectFromMap(map, TENURED);
+  SharedCodeData* data = new SharedCodeData();
+  data->MakeWeak(isolate, compiled_module);
+  compiled_module->SetInternalField(
+      kCompiledModuleSharedData,
+      *factory->NewForeign(reinterpret_cast<Address>(data)));
+  SetBrand(isolate, compiled_module, kCompiledModuleBrand);
+  return compiled_module;
+}
+
+// Links the code of the functions of {module} compiled by {linker} and stores
+// it into the code table of {compiled_module}. Calls to external functions go
+// through the code table of the current instance.
+void SetCompiledModuleCode(Isolate* isolate, Handle<JSObject> compiled_module,
+                           WasmModule* module, WasmLinker* linker,
+                           const std::vector<Handle<Code>>& results) {
+  linker->Link(Handle<FixedArray>::null(), module->function_table);
+  Handle<FixedArray> code_table = isolate->factory()->NewFixedArray(
+      static_cast<int>(module->functions->size()), TENURED);
+  int index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external) code_table->set(index, *results[index]);
+    index++;
+  }
+  compiled_module->SetInternalField(kCompiledModuleCodeTable, *code_table);
+}
+
+// Clears the field holding the location of a weak global handle once the
+// object it refers to dies. The parameter is the address of the field.
+void ClearWeakField(const v8::WeakCallbackInfo<void>& info) {
+  Object*** field = static_cast<Object***>(info.GetParameter());
+  GlobalHandles::Destroy(*field);
+  *field = nullptr;
+}
+
+// The context of an instance of shared code or of an instance whose memory
+// can grow, together with global handles for the objects it refers to. It is
+// deleted when the instance object dies. The handles of the tables are weak,
+// as the code in them refers to the instance; the instance holds on to both.
+class InstanceContextData {
+ public:
+  InstanceContextData(Isolate* isolate, Handle<JSArrayBuffer> mem_buffer,
+                      uint32_t mem_max_size, byte* globals_start,
+                      Handle<FixedArray> code_table,
+                      Handle<FixedArray> function_table)
+      : slot_(&context_), grow_memory_stub_(nullptr) {
+    GlobalHandles* global_handles = isolate->global_handles();
+    context_.mem_start = reinterpret_cast<byte*>(mem_buffer->backing_store());
+    context_.mem_size =
+        static_cast<uint32_t>(mem_buffer->byte_length()->Number());
+    context_.mem_max_size = mem_max_size;
+    context_.guard_pages = false;
+    context_.mem_buffer = global_handles->Create(*mem_buffer).location();
+    context_.globals_start = globals_start;
+    // Only shared code loads the tables from the context.
+    context_.code_table = nullptr;
+    if (!code_table.is_null()) {
+      context_.code_table = global_handles->Create(*code_table).location();
+      GlobalHandles::MakeWeak(context_.code_table, &context_.code_table,
+                              &ClearWeakField,
+                              v8::WeakCallbackType::kParameter);
+    }
+    context_.function_table = nullptr;
+    if (!code_table.is_null() && !function_table.is_null()) {
+      context_.function_table =
+          global_handles->Create(*function_table).location();
+      GlobalHandles::MakeWeak(context_.function_table,
+                              &context_.function_table, &ClearWeakField,
+                              v8::WeakCallbackType::kParameter);
+    }
+  }
+
+  ~InstanceContextData() {
+    GlobalHandles::Destroy(context_.mem_buffer);
+    if (context_.code_table) GlobalHandles::Destroy(context_.code_table);
+    if (context_.function_table) {
+      GlobalHandles::Destroy(context_.function_table);
+    }
+    if (grow_memory_stub_) GlobalHandles::Destroy(grow_memory_stub_);
+  }
+
+  WasmInstanceContext* context() { return &context_; }
+
+  // The location of the context, for growing the memory of an instance whose
+  // code is not shared.
+  WasmInstanceContext** slot() { return &slot_; }
+
+  Handle<Code> grow_memory_stub() {
+    if (!grow_memory_stub_) return Handle<Code>::null();
+    return Handle<Code>(reinterpret_cast<Code**>(grow_memory_stub_));
+  }
+
+  void set_grow_memory_stub(Isolate* isolate, Handle<Code> stub) {
+    DCHECK_NULL(grow_memory_stub_);
+    grow_memory_stub_ = isolate->global_handles()->Create(*stub).location();
+  }
+
+  bool guard_pages() { return context_.guard_pages; }
+  void set_guard_pages(bool guard_pages) { context_.guard_pages = guard_pages; }
+
+  // Ties the lifetime of this data to the given instance object.
+  void MakeWeak(Isolate* isolate, Handle<JSObject> instance) {
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+    instance_.Reset(v8_isolate, v8::Utils::ToLocal(instance));
+    instance_.SetWeak(this, &InstanceContextData::Delete,
+                      v8::WeakCallbackType::kParameter);
+  }
+
+ private:
+  WasmInstanceContext context_;
+  WasmInstanceContext* slot_;
+  Object** grow_memory_stub_;
+  v8::Global<v8::Object> instance_;
+
+  static void Delete(const v8::WeakCallbackInfo<InstanceContextData>& info) {
+    info.GetParameter()->instance_.Reset();
+    // Other global handles can only be destroyed in the second pass.
+    info.SetSecondPassCallback(&InstanceContextData::DeleteSecondPass);
+  }
+
+  static void DeleteSecondPass(
+      const v8::WeakCallbackInfo<InstanceContextData>& info) {
+    delete info.GetParameter();
+  }
+};
+
+InstanceContextData* GetInstanceContextData(Handle<JSObject> instance) {
+  Object* data = instance->GetInternalField(kWasmModuleInstanceContext);
+  if (!data->IsForeign()) return nullptr;
+  return reinterpret_cast<InstanceContextData*>(
+      Foreign::cast(data)->foreign_address());
+}
+
+// Called by the grow memory stub with the delta in bytes as the argument.
+// The data of the function is the location of the context of the instance
+// whose memory grows. Commits more of the address space reserved for the
+// memory and returns the old size of the memory, or -1 if it cannot grow.
+void GrowMemory(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = reinterpret_cast<Isolate*>(args.GetIsolate());
+  HandleScope scope(isolate);
+
+  WasmInstanceContext* context = *reinterpret_cast<WasmInstanceContext**>(
+      Foreign::cast(*v8::Utils::OpenHandle(*args.Data()))->foreign_address());
+  uint32_t old_size = context->mem_size;
+  double delta = v8::Utils::OpenHandle(*args[0])->Number();
+  args.GetReturnValue().Set(-1);
+  if (delta < 0 || delta > context->mem_max_size - old_size) return;
+  uint32_t new_size = old_size + static_cast<uint32_t>(delta);
+
+  // Memories protected by guard pages cannot grow, so every memory that
+  // grows has its bounds checked explicitly and grows by any number of bytes.
+  DCHECK(!context->guard_pages);
+  size_t page_size = base::OS::CommitPageSize();
+  size_t committed = RoundUp(old_size, page_size);
+  size_t needed = RoundUp(new_size, page_size);
+  if (needed > committed &&
+      !base::VirtualMemory::CommitRegion(context->mem_start + committed,
+                                         needed - committed, false)) {
+    return;
+  }
+  context->mem_size = new_size;
+  JSArrayBuffer::cast(*context->mem_buffer)
+      ->set_byte_length(*isolate->factory()->NewNumberFromUint(new_size));
+  args.GetReturnValue().Set(static_cast<int32_t>(old_size));
+}
+
+// Creates the grow memory stub for the instance context found in {slot}.
+Handle<Code> CreateGrowMemoryStub(Isolate* isolate, ModuleEnv* module_env,
+                                  WasmInstanceContext** slot) {
+  v8::Local<v8::Value> data = v8::Utils::ToLocal(Handle<Object>::cast(
+      isolate->factory()->NewForeign(reinterpret_cast<Address>(slot))));
+  v8::Local<v8::Function> local =
+      v8::Function::New(v8::Utils::ToLocal(isolate->native_context()),
+                        GrowMemory, data)
+          .ToLocalChecked();
+  return compiler::CompileWasmGrowMemoryStub(
+      isolate, module_env,
+      Handle<JSFunction>::cast(v8::Utils::OpenHandle(*local)));
+}
+
+// Sets up a module environment for compiling the functions of {instance}
+// after instantiation. Direct calls go through the code table.
+void InitModuleEnv(Isolate* isolate, Handle<JSObject> instance,
+                   WasmModule* module, ModuleEnv* module_env) {
+  Handle<JSArrayBuffer> memory(
+      JSArrayBuffer::cast(instance->GetInternalField(kWasmMemArrayBuffer)));
+  byte* mem_addr = reinterpret_cast<byte*>(memory->backing_store());
+  size_t mem_size = static_cast<size_t>(memory->byte_length()->Number());
+  Object* globals = instance->GetInternalField(kWasmGlobalsArrayBuffer);
+  byte* globals_addr = nullptr;
+  if (globals->IsJSArrayBuffer()) {
+    globals_addr =
+        reinterpret_cast<byte*>(JSArrayBuffer::cast(globals)->backing_store());
+  }
+  Object* function_table = instance->GetInternalField(kWasmModuleFunctionTable);
+
+  module_env->module = module;
+  module_env->mem_start = reinterpret_cast<uintptr_t>(mem_addr);
+  module_env->mem_end = reinterpret_cast<uintptr_t>(mem_addr) + mem_size;
+  module_env->globals_area = reinterpret_cast<uintptr_t>(globals_addr);
+  module_env->linker = nullptr;
+  module_env->function_code = nullptr;
+  module_env->code_table = handle(
+      FixedArray::cast(instance->GetInternalField(kWasmModuleCodeTable)));
+  if (function_table->IsFixedArray()) {
+    module_env->function_table =
+        handle(FixedArray::cast(function_table), isolate);
+  }
+  module_env->tier_up_budgets = nullptr;
+  InstanceContextData* context_data = GetInstanceContextData(instance);
+  if (context_data) {
+    module_env->instance_context = context_data->context();
+    module_env->grow_memory_stub = context_data->grow_memory_stub();
+    module_env->guard_pages = context_data->guard_pages();
+  }
+  module_env->memory = memory;
+  module_env->context = isolate->native_context();
+  module_env->asm_js = false;
+}
+
+// Installs the code for the function {index} into the code table and the
+// function table of the module environment.
+void InstallCode(ModuleEnv* module_env, int index, Handle<Code> code) {
+  WasmModule* module = module_env->module;
+  module_env->code_table->set(index, *code);
+  if (!module_env->function_table.is_null()) {
+    int table_size = static_cast<int>(module->function_table->size());
+    for (int i = 0; i < table_size; i++) {
+      if (module->function_table->at(i) == index) {
+        module_env->function_table->set(i + table_size, *code);
+      }
+    }
+  }
+}
+
+// Called by the lazy compile stub of a function, with the instance as the
+// receiver and the index of the function as the argument. Compiles the
+// function upon its first call and installs the code into the code table
+// and the function table. Returns the index of the function, which the stub
+// then calls through the code table.
+void LazyCompile(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = reinterpret_cast<Isolate*>(args.GetIsolate());
+  HandleScope scope(isolate);
+  ErrorThrower thrower(isolate, "WASM lazy compilation");
+
+  Handle<JSObject> instance =
+      Handle<JSObject>::cast(v8::Utils::OpenHandle(*args.This()));
+  int index = static_cast<int>(v8::Utils::OpenHandle(*args[0])->Number());
+  DeferredCompileData* data = GetDeferredCompileData(instance);
+  if (data->state(index) == DeferredCompileData::kLazyStub) {
+    ModuleEnv module_env;
+    InitModuleEnv(isolate, instance, data->module(), &module_env);
+    Handle<Code> code = compiler::CompileWasmFunction(
+        thrower, isolate, &module_env, data->module()->functions->at(index),
+        index);
+    if (code.is_null()) return;  // The thrower has scheduled an exception.
+    InstallCode(&module_env, index, code);
+    data->set_state(index, DeferredCompileData::kOptimizedCode);
+  }
+  args.GetReturnValue().Set(index);
+}
+
+// A recompilation of a hot function with the optimizing tier. The unit is
+// executed on a background thread and finished on the isolate's thread,
+// either when a tier-up budget of the instance is exhausted again or in a
+// task posted to the isolate's thread, whichever comes first. The deferred
+// handles keep the instance alive until then. The task deletes the job.
+struct TierUpJob {
+  TierUpJob(Isolate* isolate, int index)
+      : isolate(isolate),
+        index(index),
+        thrower(isolate, "WASM tier up"),
+        data(nullptr),
+        unit(nullptr),
+        handles(nullptr) {}
+
+  Isolate* isolate;
+  int index;
+  ErrorThrower thrower;
+  Handle<JSObject> instance;
+  DeferredCompileData* data;
+  ModuleEnv module_env;
+  compiler::WasmCompilationUnit* unit;
+  DeferredHandles* handles;  // null once the job has been finished.
+};
+
+// Installs the optimized code of a job whose unit has been executed, and
+// releases the instance.
+void FinishTierUpJob(TierUpJob* job) {
+  HandleScope scope(job->isolate);
+  Handle<Code> code = compiler::FinishCompilation(job->unit);
+  if (code.is_null()) {
+    // Keep running the quick tier code.
+    job->data->set_state(job->index, DeferredCompileData::kQuickCode);
+  } else {
+    InstallCode(&job->module_env, job->index, code);
+    job->data->set_state(job->index, DeferredCompileData::kOptimizedCode);
+  }
+  job->data->JobFinished();
+  delete job->handles;
+  job->handles = nullptr;
+}
+
+// Finishes the jobs of the instance of {data} whose units have been executed.
+void FinishExecutedTierUpJobs(DeferredCompileData* data) {
+  for (TierUpJob* job : data->TakeExecutedJobs()) FinishTierUpJob(job);
+}
+
+// A task on the isolate's thread that finishes its job, unless that has
+// happened already, and deletes it.
+class FinishTierUpTask : public v8::Task {
+ public:
+  explicit FinishTierUpTask(TierUpJob* job) : job_(job) {}
+
+  void Run() override {
+    if (job_->handles && job_->data->TakeExecutedJob(job_)) {
+      FinishTierUpJob(job_);
+    }
+    delete job_;
+  }
+
+ private:
+  TierUpJob* job_;
+};
+
+// A background task that executes the unit of a tier-up job.
+class TierUpTask : public v8::Task {
+ public:
+  explicit TierUpTask(TierUpJob* job) : job_(job) {}
+
+  void Run() override {
+    compiler::ExecuteCompilation(job_->unit);
+    // The job may be finished and its data deleted as soon as it is added.
+    TierUpJob* job = job_;
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(job->isolate);
+    job->data->AddExecutedJob(job);
+    V8::GetCurrentPlatform()->CallOnForegroundThread(
+        v8_isolate, new FinishTierUpTask(job));
+  }
+
+ private:
+  TierUpJob* job_;
+};
+
+// Called by the tier-up stub with the instance as the receiver and the
+// index of the function as the argument, when the tier-up budget of the
+// function is exhausted. Installs the code of the recompilations of the
+// instance that have finished in the meantime, and starts recompiling the
+// function with the optimizing tier on a background thread.
+void TierUp(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = reinterpret_cast<Isolate*>(args.GetIsolate());
+  HandleScope scope(isolate);
+
+  Handle<JSObject> instance =
+      Handle<JSObject>::cast(v8::Utils::OpenHandle(*args.This()));
+  int index = static_cast<int>(v8::Utils::OpenHandle(*args[0])->Number());
+  DeferredCompileData* data = GetDeferredCompileData(instance);
+  data->budgets()[index] = kTierUpBudget;
+  FinishExecutedTierUpJobs(data);
+
+  if (data->state(index) == DeferredCompileData::kQuickCode) {
+    data->set_state(index, DeferredCompileData::kOptimizing);
+    TierUpJob* job = new TierUpJob(isolate, index);
+    job->data = data;
+    {
+      DeferredHandleScope deferred(isolate);
+      job->instance = handle(*instance, isolate);
+      InitModuleEnv(isolate, instance, data->module(), &job->module_env);
+      job->unit = compiler::CreateWasmCompilationUnit(
+          job->thrower, isolate, &job->module_env,
+          data->module()->functions->at(index), index,
+          compiler::kOptimizedTier);
+      job->handles = deferred.Detach();
+    }
+    data->JobStarted();
+    V8::GetCurrentPlatform()->CallOnBackgroundThread(
+        new TierUpTask(job), v8::Platform::kShortRunningTask);
+  }
+}
+
+// Copies the stub {templ}, replacing the embedded {marker} by the index of
+// the function that the copy is for.
+Handle<Code> CopyLazyCompileStub(Isolate* isolate, Handle<Code> templ,
+                                 Handle<HeapNumber> marker, int index) {
+  Factory* factory = isolate->factory();
+  Handle<Code> stub = factory->CopyCode(templ);
+  Handle<HeapNumber> number = factory->NewHeapNumber(index, IMMUTABLE, TENURED);
+  int mode_mask = RelocInfo::ModeMask(RelocInfo::EMBEDDED_OBJECT);
+  for (RelocIterator it(*stub, mode_mask); !it.done(); it.next()) {
+    if (it.rinfo()->target_object() == *marker) {
+      it.rinfo()->set_target_object(*number, UPDATE_WRITE_BARRIER,
+                                    SKIP_ICACHE_FLUSH);
+    }
+  }
+  Assembler::FlushICache(isolate, stub->instruction_start(),
+                         stub->instruction_size());
+  return stub;
+}
+
+// Maps the index of every signature of {module} to the index of the first
+// signature with the same return and parameter types, under which the wrappers
+// for all of them are cached.
+std::vector<uint32_t> CanonicalSignatureIndices(WasmModule* module) {
+  std::vector<FunctionSig*>* sigs = module->signatures;
+  std::vector<uint32_t> result(sigs->size());
+  for (uint32_t i = 0; i < sigs->size(); i++) {
+    result[i] = i;
+    for (uint32_t j = 0; j < i; j++) {
+      if (SameSignature(sigs->at(i), sigs->at(j))) {
+        result[i] = result[j];
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// Returns the host function named {name}, or nullptr.
+const WasmHostFunction* FindHostFunction(
+    const std::vector<WasmHostFunction>* host_functions, const char* name) {
+  if (host_functions == nullptr) return nullptr;
+  for (const WasmHostFunction& host : *host_functions) {
+    if (strcmp(host.name, name) == 0) return &host;
+  }
+  return nullptr;
+}
+
+// Creates a lazy compile stub for every function in the module that is not
+// external, storing it into {results} and installing it into the linker.
+// Functions with the same signature share a template stub that is compiled
+// only once.
+bool CreateLazyCompileStubs(ErrorThrower& thrower, Isolate* isolate,
+                            Handle<JSObject> instance, ModuleEnv* module_env,
+                            std::vector<Handle<Code>>* results) {
+  WasmModule* module = module_env->module;
+  Factory* factory = isolate->factory();
+  results->resize(module->functions->size());
+
+  CreateDeferredCompileData(isolate, module, instance,
+                            DeferredCompileData::kLazyStub);
+  Handle<JSFunction> lazy_compile = NewInstanceCallback(isolate, LazyCompile);
+
+  Handle<HeapNumber> marker = factory->NewHeapNumber(-1, IMMUTABLE, TENURED);
+  std::vector<Handle<Code>> templates(module->signatures->size());
+  int index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external) {
+      Handle<Code>& templ = templates[func.sig_index];
+      if (templ.is_null()) {
+        templ = compiler::CompileWasmLazyCompileStub(
+            isolate, module_env, lazy_compile, instance, marker, func.sig);
+        if (templ.is_null()) {
+          thrower.Error("Compilation of lazy compile stub failed.");
+          return false;
+        }
+      }
+      Handle<Code> stub = CopyLazyCompileStub(isolate, templ, marker, index);
+      results->at(index) = stub;
+      module_env->linker->Finish(index, stub);
+    }
+    index++;
+  }
+  return true;
+}
+
+// Sets up the module environment for compiling quick tier code that counts
+// down the tier-up budgets and calls the tier-up stub.
+bool PrepareTierUp(ErrorThrower& thrower, Isolate* isolate,
+                   Handle<JSObject> instance, ModuleEnv* module_env) {
+  DeferredCompileData* data =
+      CreateDeferredCompileData(isolate, module_env->module, instance,
+                                DeferredCompileData::kQuickCode);
+  Handle<JSFunction> tier_up = NewInstanceCallback(isolate, TierUp);
+  module_env->tier_up_stub =
+      compiler::CompileWasmTierUpStub(isolate, module_env, tier_up, instance);
+  if (module_env->tier_up_stub.is_null()) {
+    thrower.Error("Compilation of tier-up stub failed.");
+    return false;
+  }
+  module_env->tier_up_budgets = data->budgets();
+  return true;
+}
+
+// Drops the committed pages of [{start}, {start} + {size}), so that they read
+// as zero again, or as the memory image mapped over them. Returns false if
+// the pages cannot be dropped, in which case they keep their contents.
+bool DiscardPages(void* start, size_t size) {
+#if V8_OS_LINUX
+  return madvise(start, size, MADV_DONTNEED) == 0;
+#else
+  return false;
+#endif
+}
+
+// An address space reservation for a memory or globals area, which may be
+// larger than the buffer so that a memory can grow in place, or be protected
+// by guard pages. It is released when the buffer dies.
+class ReservedMemory {
+ public:
+  ReservedMemory(void* start, size_t size)
+      : start_(start),
+        size_(size),
+        guarded_(false),
+        landing_(nullptr),
+        code_table_(nullptr),
+        image_(nullptr) {}
+
+  // Ties the lifetime of the reservation to the given buffer.
+  void MakeWeak(Isolate* isolate, Handle<JSArrayBuffer> buffer) {
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+    buffer_.Reset(v8_isolate, v8::Utils::ToLocal(buffer));
+    buffer_.SetWeak(this, &ReservedMemory::Release,
+                    v8::WeakCallbackType::kParameter);
+  }
+
+  // Turns faults on the reservation from the functions in {code_table} into
+  // the out of bounds trap thrown by {stub}. Returns false if the trap
+  // handler cannot take the reservation. The handles of the stub and the
+  // table are weak, as the code in the table refers to the instance that
+  // keeps the buffer alive; the instance has to hold on to both. The
+  // reservation is unregistered as soon as either of them dies.
+  bool Guard(Isolate* isolate, Handle<Code> stub,
+             Handle<FixedArray> code_table) {
+    DCHECK_NULL(landing_);
+    GlobalHandles* global_handles = isolate->global_handles();
+    landing_ = global_handles->Create(*stub).location();
+    code_table_ = global_handles->Create(*code_table).location();
+    if (!RegisterGuardRegion(start_, size_, landing_, code_table_)) {
+      GlobalHandles::Destroy(landing_);
+      GlobalHandles::Destroy(code_table_);
+      landing_ = nullptr;
+      code_table_ = nullptr;
+      return false;
+    }
+    guarded_ = true;
+    GlobalHandles::MakeWeak(landing_, this, &ReservedMemory::ReleaseLanding,
+                            v8::WeakCallbackType::kParameter);
+    GlobalHandles::MakeWeak(code_table_, this,
+                            &ReservedMemory::ReleaseCodeTable,
+                            v8::WeakCallbackType::kParameter);
+    return true;
+  }
+
+  // Records that {image} is mapped over the memory.
+  void set_image(MemoryImage* image) { image_ = image; }
+
+  // Replaces the first {mem_size} bytes of the memory by a mapping of
+  // {image}. Returns false if the image cannot be mapped.
+  bool MapImage(MemoryImage* image, size_t mem_size) {
+    // Dropping the pages would keep the data segment image mapped.
+    image_ = nullptr;
+    CHECK(base::VirtualMemory::CommitRegion(
+        start_, RoundUp(mem_size, base::OS::CommitPageSize()), false));
+    if (!image->Map(reinterpret_cast<byte*>(start_), mem_size)) return false;
+    image_ = image;
+    return true;
+  }
+
+  // Restores the first {mem_size} bytes of the memory of an instance of
+  // {module} to their contents after instantiation, which are those of the
+  // mapped image and of the data segments it leaves out. Returns false if the
+  // image cannot be mapped again, which leaves the memory cleared.
+  bool Reset(WasmModule* module, size_t mem_size) {
+    byte* mem_addr = reinterpret_cast<byte*>(start_);
+    size_t size = RoundUp(mem_size, base::OS::CommitPageSize());
+    if (!DiscardPages(start_, size)) {
+      // Clear the pages instead, which also clears a mapped image, and map
+      // the image over them again.
+      memset(start_, 0, size);
+      if (image_ && !image_->Map(mem_addr, mem_size)) {
+        image_ = nullptr;
+        return false;
+      }
+    }
+    if (image_) {
+      image_->CopyUnmappedParts(module, mem_addr, mem_size);
+    } else {
+      LoadDataSegments(module, mem_addr, mem_size);
+    }
+    return true;
+  }
+
+ private:
+  void* start_;
+  size_t size_;
+  bool guarded_;
+  Object** landing_;
+  Object** code_table_;
+  MemoryImage* image_;  // owned by the compiled module or snapshot.
+  v8::Global<v8::ArrayBuffer> buffer_;
+
+  // Stops handling faults on the reservation, before the handles that the
+  // signal handler reads are destroyed.
+  void Unguard() {
+    if (!guarded_) return;
+    UnregisterGuardRegion(start_);
+    guarded_ = false;
+  }
+
+  static void ReleaseLanding(const v8::WeakCallbackInfo<void>& info) {
+    ReservedMemory* memory = static_cast<ReservedMemory*>(info.GetParameter());
+    memory->Unguard();
+    GlobalHandles::Destroy(memory->landing_);
+    memory->landing_ = nullptr;
+  }
+
+  static void ReleaseCodeTable(const v8::WeakCallbackInfo<void>& info) {
+    ReservedMemory* memory = static_cast<ReservedMemory*>(info.GetParameter());
+    memory->Unguard();
+    GlobalHandles::Destroy(memory->code_table_);
+    memory->code_table_ = nullptr;
+  }
+
+  static void Release(const v8::WeakCallbackInfo<ReservedMemory>& info) {
+    info.GetParameter()->buffer_.Reset();
+    // Other global handles can only be destroyed in the second pass.
+    info.SetSecondPassCallback(&ReservedMemory::ReleaseSecondPass);
+  }
+
+  static void ReleaseSecondPass(
+      const v8::WeakCallbackInfo<ReservedMemory>& info) {
+    ReservedMemory* memory = info.GetParameter();
+    memory->Unguard();
+    if (memory->landing_) GlobalHandles::Destroy(memory->landing_);
+    if (memory->code_table_) GlobalHandles::Destroy(memory->code_table_);
+    base::VirtualMemory::ReleaseRegion(memory->start_, memory->size_);
+    delete memory;
+  }
+};
+
+// Allocates a buffer of {size} bytes at the start of a reservation of
+// {reserved_size} bytes of address space, so that the memory can grow in
+// place and accesses beyond it fault.
+Handle<JSArrayBuffer> NewReservedArrayBuffer(Isolate* isolate, uint32_t size,
+                                             size_t reserved_size,
+                                             byte** backing_store,
+                                             ReservedMemory** reservation) {
+  void* memory = base::VirtualMemory::ReserveRegion(reserved_size);
+  if (!memory) return Handle<JSArrayBuffer>::null();
+  if (!base::VirtualMemory::CommitRegion(
+          memory, RoundUp(size, base::OS::CommitPageSize()), false)) {
+    base::VirtualMemory::ReleaseRegion(memory, reserved_size);
+    return Handle<JSArrayBuffer>::null();
+  }
+  *backing_store = reinterpret_cast<byte*>(memory);
+
+  Handle<JSArrayBuffer> buffer = isolate->factory()->NewJSArrayBuffer();
+  JSArrayBuffer::Setup(buffer, isolate, true, memory, size);
+  buffer->set_is_neuterable(false);
+  *reservation = new ReservedMemory(memory, reserved_size);
+  (*reservation)->MakeWeak(isolate, buffer);
+  return buffer;
+}
+
+// Allocates a buffer of {size} bytes. It is mapped directly from the OS
+// instead of coming from the array buffer allocator, so that its pages read as
+// zero without being cleared and only take up memory once they are written.
+Handle<JSArrayBuffer> NewArrayBuffer(Isolate* isolate, uint32_t size,
+                                     byte** backing_store) {
+  ReservedMemory* reservation = nullptr;
+  return NewReservedArrayBuffer(isolate, size,
+                                RoundUp(size, base::OS::CommitPageSize()),
+                                backing_store, &reservation);
+}
+
+// Checks whether the body of {function} only refers to functions and globals
+// of {module} that have arrived already, and to the function table or the
+// grow memory stub only if they are known, so that it can be compiled before
+// the rest of the module has arrived.
+bool CanCompileEarly(WasmModule* module, const WasmFunction& function,
+                     bool has_function_table, bool can_grow_memory) {
+  const byte* pc = module->module_start + function.code_start_offset;
+  const byte* end = module->module_start + function.code_end_offset;
+  while (pc < end) {
+    WasmOpcode opcode = static_cast<WasmOpcode>(*pc);
+    int length;
+    uint32_t operand;
+    switch (opcode) {
+#define DECLARE_OPCODE_CASE(name, opcode, sig) case kExpr##name:
+    FOREACH_LOAD_MEM_OPCODE(DECLARE_OPCODE_CASE)
+    FOREACH_STORE_MEM_OPCODE(DECLARE_OPCODE_CASE)
+#undef DECLARE_OPCODE_CASE
+      if (end - pc < 2) return false;
+      if (MemoryAccess::OffsetField::decode(pc[1])) {
+        if (ReadUnsignedLEB128Operand(pc + 2, end, &length, &operand) !=
+            kNoError) {
+          return false;
+        }
+        length += 2;
+      } else {
+        length = 2;
+      }
+      break;
+    case kExprCallFunction:
+    case kExprCallIndirect:
+    case kExprLoadGlobal:
+    case kExprStoreGlobal:
+    case kExprGetLocal:
+    case kExprSetLocal:
+      if (ReadUnsignedLEB128Operand(pc + 1, end, &length, &operand) !=
+          kNoError) {
+        return false;
+      }
+      length++;
+      if (opcode == kExprCallFunction &&
+          operand >= module->functions->size()) {
+        return false;
+      }
+      if ((opcode == kExprLoadGlobal || opcode == kExprStoreGlobal) &&
+          operand >= module->globals->size()) {
+        return false;
+      }
+      if (opcode == kExprCallIndirect && !has_function_table) return false;
+      break;
+    case kExprGrowMemory:
+      if (!can_grow_memory) return false;
+      length = 1;
+      break;
+    case kExprTableSwitch:
+      if (end - pc < 5) return false;
+      length = OpcodeLength(pc);
+      break;
+    default:
+      length = OpcodeLength(pc);
+      break;
+    }
+    pc += length;
+  }
+  return true;
+}
+}  // namespace
+
+// Instantiates a wasm module as a JSObject.
+//  * allocates a backing store of {mem_size} bytes.
+//  * reserves address space for the memory to grow in place, if it can
+//  * installs a named property "memory" for that buffer if exported
+//  * installs named properties on the object for exported functions
+//  * compiles wasm code to machine code, or lazy compile stubs for it
+//  * deserializes previously compiled machine code instead, if given
+//  * uses the code of a compiled module instead, if given
+MaybeHandle<JSObject> WasmModule::Instantiate(
+    Isolate* isolate, Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+    WasmCompilationMode mode, Vector<const byte> serialized_code,
+    Handle<JSObject> compiled_module,
+    const std::vector<WasmHostFunction>* host_functions) {
+  this->shared_isolate = isolate;  // TODO: have a real shared isolate.
+  ErrorThrower thrower(isolate, "WasmModule::Instantiate()");
+
+  Factory* factory = isolate->factory();
+  // Memory is bigger than maximum supported size.
+  if (memory.is_null() && min_mem_size_log2 > kMaxMemSize) {
+    thrower.Error("Out of memory: wasm memory too large");
+    return MaybeHandle<JSObject>();
+  }
+
+  Handle<Map> map = factory->NewMap(
+      JS_OBJECT_TYPE,
+      JSObject::kHeaderSize + kWasmModuleInternalFieldCount * kPointerSize);
+
+  //-------------------------------------------------------------------------
+  // Allocate the module object.
+  //-------------------------------------------------------------------------
+  Handle<JSObject> module = factory->NewJSObjectFromMap(map, TENURED);
+  SetBrand(isolate, module, kInstanceBrand);
+  Handle<FixedArray> code_table =
+      factory->NewFixedArray(static_cast<int>(functions->size()), TENURED);
+  Handle<FixedArray> shared_code;
+  if (!compiled_module.is_null()) {
+    shared_code = handle(FixedArray::cast(compiled_module->GetInternalField(
+                             kCompiledModuleCodeTable)),
+                         isolate);
+    if (shared_code->length() != code_table->length()) {
+      thrower.Error("Compiled module does not match the module.");
+      return MaybeHandle<JSObject>();
+    }
+  }
+
+  //-------------------------------------------------------------------------
+  // Allocate the linear memory.
+  //-------------------------------------------------------------------------
+  uint32_t mem_size = 1 << min_mem_size_log2;
+  uint32_t mem_max_size = mem_size;
+  byte* mem_addr = nullptr;
+  ReservedMemory* reservation = nullptr;
+  bool guard = false;
+  Handle<JSArrayBuffer> mem_buffer;
+  // A compiled module that owns this module maps the pages of its large data
+  // segments into the memory instead of copying them.
+  MemoryImage* data_image = nullptr;
+  if (memory.is_null() && !compiled_module.is_null() &&
+      GetSharedCodeData(compiled_module)->module() == this) {
+    data_image = GetSharedCodeData(compiled_module)->data_image();
+  }
+  if (!memory.is_null()) {
+    memory->set_is_neuterable(false);
+    mem_addr = reinterpret_cast<byte*>(memory->backing_store());
+    mem_size = memory->byte_length()->Number();
+    mem_max_size = mem_size;
+    mem_buffer = memory;
+  } else {
+    int max_size_log2 =
+        max_mem_size_log2 > kMaxMemSize ? kMaxMemSize : max_mem_size_log2;
+    uint32_t max_size = 1u << max_size_log2;
+    // Only code that is not shared with instances of other memories can rely
+    // on guard pages instead of bounds checks. Accesses beyond the size of
+    // the memory only fault if it ends on a page boundary, so memories that
+    // can grow by any number of bytes keep checking the bounds.
+    guard = compiled_module.is_null() && max_size <= mem_size &&
+            mem_size % base::OS::CommitPageSize() == 0 && EnableTrapHandler();
+    if (guard || max_size > mem_size || !compiled_module.is_null()) {
+      // Reserve the address space for the maximum size, so that the memory
+      // can grow in place, or for the guard pages. Instances of compiled
+      // modules always get reserved memory, which memory images can be
+      // mapped into, and which can be reset.
+      mem_buffer = NewReservedArrayBuffer(
+          isolate, mem_size, guard ? kGuardRegionSize : max_size, &mem_addr,
+          &reservation);
+      if (mem_addr) mem_max_size = max_size;
+    }
+    if (!mem_addr) {
+      guard = false;
+      mem_buffer = NewArrayBuffer(isolate, mem_size, &mem_addr);
+    }
+    if (!mem_addr) {
+      // Not enough space for backing store of memory
+      thrower.Error("Out of memory: wasm memory");
+      return MaybeHandle<JSObject>();
+    }
+  }
+
+  // Load initialized data segments.
+  if (reservation && data_image && data_image->Map(mem_addr, mem_size)) {
+    data_image->CopyUnmappedParts(this, mem_addr, mem_size);
+    reservation->set_image(data_image);
+  } else {
+    LoadDataSegments(this, mem_addr, mem_size);
+  }
+
+  module->SetInternalField(kWasmMemArrayBuffer, *mem_buffer);
+  if (reservation) {
+    // Only memories allocated for the instance can be reset.
+    module->SetInternalField(
+        kWasmMemReservation,
+        *factory->NewForeign(reinterpret_cast<Address>(reservation)));
+  } else {
+    module->SetInternalField(kWasmMemReservation, Smi::FromInt(0));
+  }
+  module->SetInternalField(kWasmModuleSnapshot, Smi::FromInt(0));
+  module->SetInternalField(kWasmModuleOutOfBoundsStub, Smi::FromInt(0));
+
+  if (mem_export) {
+    // Export the memory as a named property.
+    Handle<String> name = factory->InternalizeUtf8String("memory");
+    JSObject::AddProperty(module, name, mem_buffer, READ_ONLY);
+  }
+
+  //-------------------------------------------------------------------------
+  // Allocate the globals area if necessary.
+  //-------------------------------------------------------------------------
+  size_t globals_size = AllocateGlobalsOffsets(globals);
+  byte* globals_addr = nullptr;
+  if (globals_size > 0) {
+    Handle<JSArrayBuffer> globals_buffer =
+        NewArrayBuffer(isolate, mem_size, &globals_addr);
+    if (!globals_addr) {
+      // Not enough space for backing store of globals.
+      thrower.Error("Out of memory: wasm globals");
+      return MaybeHandle<JSObject>();
+    }
+
+    module->SetInternalField(kWasmGlobalsArrayBuffer, *globals_buffer);
+  } else {
+    module->SetInternalField(kWasmGlobalsArrayBuffer, Smi::FromInt(0));
+  }
+
+  //-------------------------------------------------------------------------
+  // Compile all functions in the module.
+  //-------------------------------------------------------------------------
+  int index = 0;
+  WasmLinker linker(isolate, functions->size());
+  ModuleEnv module_env;
+  module_env.module = this;
+  module_env.mem_start = reinterpret_cast<uintptr_t>(mem_addr);
+  module_env.mem_end = reinterpret_cast<uintptr_t>(mem_addr) + mem_size;
+  module_env.globals_area = reinterpret_cast<uintptr_t>(globals_addr);
+  module_env.linker = &linker;
+  module_env.function_code = nullptr;
+  if (mode != kEagerCompilation) {
+    // Functions are compiled or replaced after instantiation, so calls go
+    // through the code table.
+    module_env.code_table = code_table;
+  }
+  module_env.function_table = BuildFunctionTable(isolate, this);
+  module_env.tier_up_budgets = nullptr;
+  module_env.memory = memory;
+  module_env.context = isolate->native_context();
+  module_env.asm_js = false;
+  if (compiled_module.is_null()) {
+    module->SetInternalField(kWasmModuleCompiledModule, Smi::FromInt(0));
+    if (guard) {
+      // Out of bounds accesses fault on the guard pages and continue in the
+      // stub that throws the trap.
+      Handle<Code> stub =
+          compiler::CompileWasmOutOfBoundsStub(isolate, &module_env);
+      if (stub.is_null()) {
+        thrower.Error("Compilation of out of bounds stub failed.");
+        return MaybeHandle<JSObject>();
+      }
+      module_env.guard_pages = reservation->Guard(isolate, stub, code_table);
+      module->SetInternalField(kWasmModuleOutOfBoundsStub, *stub);
+    }
+    if (mem_max_size > mem_size || module_env.guard_pages) {
+      // The code loads the size of the memory, which can grow, from the
+      // context of the instance, which also records whether the memory is
+      // protected by guard pages for code compiled later.
+      InstanceContextData* context_data = new InstanceContextData(
+          isolate, mem_buffer, mem_max_size, globals_addr,
+          Handle<FixedArray>::null(), Handle<FixedArray>::null());
+      context_data->set_guard_pages(module_env.guard_pages);
+      context_data->MakeWeak(isolate, module);
+      module->SetInternalField(
+          kWasmModuleInstanceContext,
+          *factory->NewForeign(reinterpret_cast<Address>(context_data)));
+      module_env.instance_context = context_data->context();
+      if (mem_max_size > mem_size) {
+        module_env.grow_memory_stub =
+            CreateGrowMemoryStub(isolate, &module_env, context_data->slot());
+        if (module_env.grow_memory_stub.is_null()) {
+          thrower.Error("Compilation of grow memory stub failed.");
+          return MaybeHandle<JSObject>();
+        }
+        context_data->set_grow_memory_stub(isolate,
+                                           module_env.grow_memory_stub);
+      }
+    } else {
+      module->SetInternalField(kWasmModuleInstanceContext, Smi::FromInt(0));
+    }
+  } else {
+    // The shared code loads the memory, the globals and the tables from the
+    // context of the instance, which the wrappers install.
+    InstanceContextData* context_data = new InstanceContextData(
+        isolate, mem_buffer, mem_max_size, globals_addr, code_table,
+        module_env.function_table);
+    context_data->MakeWeak(isolate, module);
+    module->SetInternalField(
+        kWasmModuleInstanceContext,
+        *factory->NewForeign(reinterpret_cast<Address>(context_data)));
+    module->SetInternalField(kWasmModuleCompiledModule, *compiled_module);
+    module_env.current_instance =
+        GetSharedCodeData(compiled_module)->current_instance();
+    module_env.instance_context = context_data->context();
+  }
+
+  // Wrappers are compiled once per signature and copied for the other
+  // functions with that signature. Wrappers for JS functions are also keyed
+  // by the number of arguments they pass when calling them directly, or -1
+  // when calling them through the Call builtin, and by whether they pass the
+  // global proxy as the receiver.
+  typedef std::tuple<uint32_t, int, bool> ImportKey;
+  std::vector<uint32_t> canonical_sigs = CanonicalSignatureIndices(this);
+  std::map<ImportKey, Handle<JSFunction>> import_templates;
+  std::map<ImportKey, Handle<Code>> import_template_code;
+  std::vector<Handle<JSFunction>> export_templates(signatures->size());
+
+  // First pass: compile wrappers for external functions.
+  std::vector<Handle<JSFunction>> exports(functions->size());
+  for (const WasmFunction& func : *functions) {
+    if (!func.external) {
+      index++;
+      continue;
+    }
+
+    const char* cstr = GetName(func.name_offset);
+    Handle<String> name = factory->InternalizeUtf8String(cstr);
+    // Native host functions are called without entering JavaScript.
+    const WasmHostFunction* host = FindHostFunction(host_functions, cstr);
+    if (host != nullptr) {
+      if (!SameSignature(host->sig, func.sig)) {
+        thrower.Error("Host function #%d:%s has a different signature.", index,
+                      cstr);
+        return MaybeHandle<JSObject>();
+      }
+      Handle<Code> code = compiler::CompileWasmToHostWrapper(
+          isolate, &module_env, host->function, func.sig);
+      if (code.is_null()) {
+        thrower.Error("Host function #%d:%s is not supported.", index, cstr);
+        return MaybeHandle<JSObject>();
+      }
+      linker.Finish(index, code);
+      code_table->set(index, *code);
+      if (func.exported) {
+        exports[index] = compiler::CompileJSToWasmWrapper(
+            isolate, &module_env, name, code, index);
+      }
+      index++;
+      continue;
+    }
+    // Lookup external function in FFI object.
+    if (ffi.is_null()) {
+      thrower.Error("FFI table is not an object.");
+      return MaybeHandle<JSObject>();
+    }
+    MaybeHandle<Object> result = Object::GetProperty(ffi, name);
+    if (result.is_null()) {
+      thrower.Error("FFI function #%d:%s not found.", index, cstr);
+      return MaybeHandle<JSObject>();
+    }
+    Handle<Object> obj = result.ToHandleChecked();
+    if (!obj->IsJSFunction()) {
+      thrower.Error("FFI function #%d:%s is not a JSFunction.", index, cstr);
+      return MaybeHandle<JSObject>();
+    }
+    Handle<JSFunction> function = Handle<JSFunction>::cast(obj);
+    ImportKey key(canonical_sigs[func.sig_index],
+                  compiler::GetDirectCallArgumentCount(*function, func.sig),
+                  compiler::HasGlobalProxyReceiver(*function));
+    Handle<Code> code;
+    if (import_templates[key].is_null()) {
+      code = compiler::CompileWasmToJSWrapper(isolate, &module_env, function,
+                                              index);
+      import_templates[key] = function;
+      import_template_code[key] = code;
+    } else {
+      code = compiler::CopyWasmToJSWrapper(isolate, import_template_code[key],
+                                           import_templates[key], function);
+    }
+    // Install the code into the linker table.
+    linker.Finish(index, code);
+    code_table->set(index, *code);
+    if (func.exported) exports[index] = function;
+    index++;
+  }
+
+  // Second pass: compile all other functions, in parallel where possible.
+  // Lazily compiled functions get a stub that compiles them upon first call.
+  // Tiered compilation starts with quick tier code for all functions.
+  std::vector<Handle<Code>> results;
+  module->SetInternalField(kWasmModuleDeferredData, Smi::FromInt(0));
+  if (!compiled_module.is_null()) {
+    // The code of the functions is shared with the compiled module.
+    results.resize(functions->size());
+    index = 0;
+    for (const WasmFunction& func : *functions) {
+      if (!func.external) {
+        results[index] = handle(Code::cast(shared_code->get(index)), isolate);
+        linker.Finish(index, results[index]);
+      }
+      index++;
+    }
+  } else {
+    switch (mode) {
+      case kEagerCompilation:
+        // Code that loads the size of the memory cannot be deserialized.
+        if (!serialized_code.is_empty() && !module_env.instance_context &&
+            DeserializeWasmCode(isolate, &module_env, globals_size, code_table,
+                                serialized_code, &results)) {
+          index = 0;
+          for (const WasmFunction& func : *functions) {
+            if (!func.external) linker.Finish(index, results[index]);
+            index++;
+          }
+        } else {
+          CompileFunctions(thrower, isolate, &module_env,
+                           compiler::kOptimizedTier, &results);
+        }
+        break;
+      case kLazyCompilation:
+        CreateLazyCompileStubs(thrower, isolate, module, &module_env,
+                               &results);
+        break;
+      case kTieredCompilation:
+        if (PrepareTierUp(thrower, isolate, module, &module_env)) {
+          CompileFunctions(thrower, isolate, &module_env, compiler::kQuickTier,
+                           &results);
+        }
+        break;
+    }
+  }
+  if (thrower.error()) return MaybeHandle<JSObject>();
+
+  // Third pass: initialize the code table and install the exports.
+  index = 0;
+  for (const WasmFunction& func : *functions) {
+    const char* cstr = GetName(func.name_offset);
+    Handle<String> name = factory->InternalizeUtf8String(cstr);
+    if (!func.external) {
+      Handle<Code> code = results[index];
+      code_table->set(index, *code);
+      if (func.exported) {
+        // Wrappers that load the code from the code table embed the index.
+        Handle<JSFunction>& templ =
+            export_templates[canonical_sigs[func.sig_index]];
+        if (templ.is_null() || !module_env.code_table.is_null()) {
+          exports[index] = compiler::CompileJSToWasmWrapper(
+              isolate, &module_env, name, code, index);
+          if (module_env.code_table.is_null()) templ = exports[index];
+        } else {
+          exports[index] =
+              compiler::CopyJSToWasmWrapper(isolate, name, templ, code);
+        }
+      }
+    }
+    if (func.exported) {
+      // Exported functions are installed as read-only properties on the module.
+      JSObject::AddProperty(module, name, exports[index], READ_ONLY);
+    }
+    index++;
+  }
+
+  // Fourth pass: patch all direct call sites.
+  linker.Link(module_env.function_table, this->function_table);
+
+  if (module_env.function_table.is_null()) {
+    module->SetInternalField(kWasmModuleFunctionTable, Smi::FromInt(0));
+  } else {
+    module->SetInternalField(kWasmModuleFunctionTable,
+                             *module_env.function_table);
+  }
+  module->SetInternalField(kWasmModuleCodeTable, *code_table);
+  return module;
+}
+
+MaybeHandle<JSObject> WasmModule::Instantiate(
+    Isolate* isolate, Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+    Handle<JSObject> compiled_module) {
+  return Instantiate(isolate, ffi, memory, kEagerCompilation,
+                     Vector<const byte>(), compiled_module);
+}
+
+// Compiles all functions of the module into a compiled module object, whose
+// code loads the memory, the globals and the tables from the context of the
+// current instance instead of embedding them.
+MaybeHandle<JSObject> WasmModule::Compile(Isolate* isolate) {
+  this->shared_isolate = isolate;  // TODO: have a real shared isolate.
+  ErrorThrower thrower(isolate, "WasmModule::Compile()");
+  Handle<JSObject> compiled_module = NewCompiledModule(isolate);
+  SharedCodeData* data = GetSharedCodeData(compiled_module);
+
+  AllocateGlobalsOffsets(globals);
+  WasmLinker linker(isolate, functions->size());
+  ModuleEnv module_env;
+  module_env.module = this;
+  module_env.mem_start = 0;
+  module_env.mem_end = 0;
+  module_env.globals_area = 0;
+  module_env.linker = &linker;
+  module_env.function_code = nullptr;
+  module_env.tier_up_budgets = nullptr;
+  module_env.current_instance = data->current_instance();
+  module_env.context = isolate->native_context();
+  module_env.asm_js = false;
+  if (max_mem_size_log2 > min_mem_size_log2) {
+    module_env.grow_memory_stub =
+        CreateGrowMemoryStub(isolate, &module_env, data->current_instance());
+    if (module_env.grow_memory_stub.is_null()) {
+      thrower.Error("Compilation of grow memory stub failed.");
+      return MaybeHandle<JSObject>();
+    }
+  }
+
+  std::vector<Handle<Code>> results;
+  CompileFunctions(thrower, isolate, &module_env, compiler::kOptimizedTier,
+                   &results);
+  if (thrower.error()) return MaybeHandle<JSObject>();
+
+  SetCompiledModuleCode(isolate, compiled_module, this, &linker, results);
+  return compiled_module;
+}
+
+// The state of a streaming compilation. The graphs of the functions that
+// arrived are built on the isolate's thread when their units are created, so
+// that executing the units, by background tasks while the next chunk is
+// being read, neither reads the module nor touches the heap. The isolate's
+// thread waits for the tasks before creating more units, and the units are
+// finished once the module is complete.
+class WasmStreamingCompiler::State {
+ public:
+  explicit State(Isolate* isolate)
+      : isolate_(isolate),
+        thrower_(isolate, "WasmStreamingCompiler"),
+        decoder_(&zone_),
+        linker_(isolate, 0),
+        queue_(&units_),
+        done_(0),
+        num_tasks_(0),
+        next_function_(0),
+        module_(nullptr) {
+    DeferredHandleScope deferred(isolate);
+    compiled_module_ = NewCompiledModule(isolate);
+    module_env_.module = decoder_.module();
+    module_env_.mem_start = 0;
+    module_env_.mem_end = 0;
+    module_env_.globals_area = 0;
+    module_env_.linker = &linker_;
+    module_env_.function_code = nullptr;
+    module_env_.tier_up_budgets = nullptr;
+    module_env_.current_instance =
+        GetSharedCodeData(compiled_module_)->current_instance();
+    module_env_.context = isolate->native_context();
+    module_env_.asm_js = false;
+    handles_.push_back(deferred.Detach());
+  }
+
+  ~State() {
+    WaitForTasks();
+    for (compiler::WasmCompilationUnit* unit : units_) {
+      compiler::AbortCompilation(unit);
+    }
+    for (DeferredHandles* handles : handles_) delete handles;
+  }
+
+  bool AddBytes(const byte* bytes, size_t size) {
+    if (decoder_.failed()) return false;
+    WaitForTasks();
+    if (!decoder_.AddBytes(bytes, size)) {
+      thrower_.Failed("", decoder_.error());
+      return false;
+    }
+
+    WasmModule* module = decoder_.module();
+    size_t first_unit = units_.size();
+    {
+      DeferredHandleScope deferred(isolate_);
+      if (decoder_.IsComplete(kDeclMemory) &&
+          module->max_mem_size_log2 > module->min_mem_size_log2 &&
+          module_env_.grow_memory_stub.is_null()) {
+        module_env_.grow_memory_stub = CreateGrowMemoryStub(
+            isolate_, &module_env_, module_env_.current_instance);
+      }
+      bool can_grow_memory =
+          !module_env_.grow_memory_stub.is_null() ||
+          (decoder_.IsComplete(kDeclMemory) &&
+           module->max_mem_size_log2 <= module->min_mem_size_log2);
+      AllocateGlobalsOffsets(module->globals);
+
+      uint32_t count = static_cast<uint32_t>(module->functions->size());
+      linker_.Resize(count);
+      for (; next_function_ < count; next_function_++) {
+        const WasmFunction& func = module->functions->at(next_function_);
+        if (func.external ||
+            !CanCompileEarly(module, func,
+                             decoder_.IsComplete(kDeclFunctionTable),
+                             can_grow_memory)) {
+          continue;
+        }
+        units_.push_back(compiler::CreateWasmCompilationUnit(
+            thrower_, isolate_, &module_env_, func, next_function_));
+        unit_indices_.push_back(next_function_);
+      }
+      handles_.push_back(deferred.Detach());
+    }
+
+    // Execute the new units while the next chunk is being read.
+    v8::Platform* platform = V8::GetCurrentPlatform();
+    num_tasks_ = Min(units_.size() - first_unit,
+                     platform->NumberOfAvailableBackgroundThreads());
+    for (size_t i = 0; i < num_tasks_; i++) {
+      platform->CallOnBackgroundThread(new WasmCompilationTask(&queue_, &done_),
+                                       v8::Platform::kShortRunningTask);
+    }
+    return true;
+  }
+
+  MaybeHandle<JSObject> Finish() {
+    WaitForTasks();
+    // {AddBytes} has thrown the error already.
+    if (decoder_.failed()) return MaybeHandle<JSObject>();
+    // Check the rest of the module, and compile the functions that could
+    // not be compiled early for it.
+    ModuleResult result = decoder_.Finish();
+    if (result.failed()) {
+      thrower_.Failed("", result);
+      return MaybeHandle<JSObject>();
+    }
+    module_ = result.val;
+    module_->shared_isolate = isolate_;
+    if (module_->max_mem_size_log2 > module_->min_mem_size_log2 &&
+        module_env_.grow_memory_stub.is_null()) {
+      module_env_.grow_memory_stub = CreateGrowMemoryStub(
+          isolate_, &module_env_, module_env_.current_instance);
+      if (module_env_.grow_memory_stub.is_null()) {
+        thrower_.Error("Compilation of grow memory stub failed.");
+        return MaybeHandle<JSObject>();
+      }
+    }
+
+    // Generate the code of the units executed early. Every unit is finished,
+    // even after an error, so that all of them are deleted.
+    std::vector<Handle<Code>> results(module_->functions->size());
+    for (size_t i = 0; i < units_.size(); i++) {
+      Handle<Code> code = compiler::FinishCompilation(units_[i]);
+      if (!code.is_null()) {
+        results[unit_indices_[i]] = code;
+        linker_.Finish(unit_indices_[i], code);
+      }
+    }
+    units_.clear();
+    if (thrower_.error()) return MaybeHandle<JSObject>();
+
+    CompileFunctions(thrower_, isolate_, &module_env_,
+                     compiler::kOptimizedTier, &results);
+    if (thrower_.error()) return MaybeHandle<JSObject>();
+
+    Handle<JSObject> compiled_module = handle(*compiled_module_, isolate_);
+    SetCompiledModuleCode(isolate_, compiled_module, module_, &linker_,
+                          results);
+    return compiled_module;
+  }
+
+  WasmModule* module() const { return module_; }
+
+ private:
+  Isolate* isolate_;
+  ErrorThrower thrower_;
+  Zone zone_;
+  StreamingModuleDecoder decoder_;
+  WasmLinker linker_;
+  ModuleEnv module_env_;
+  Handle<JSObject> compiled_module_;
+  std::vector<DeferredHandles*> handles_;
+  std::vector<compiler::WasmCompilationUnit*> units_;
+  std::vector<uint32_t> unit_indices_;
+  WasmCompilationQueue queue_;
+  base::Semaphore done_;
+  size_t num_tasks_;
+  uint32_t next_function_;
+  WasmModule* module_;
+
+  // Takes part in executing the pending units until all tasks are done.
+  void WaitForTasks() {
+    queue_.ExecuteUnits();
+    for (size_t i = 0; i < num_tasks_; i++) done_.Wait();
+    num_tasks_ = 0;
+  }
+};
+
+WasmStreamingCompiler::WasmStreamingCompiler(Isolate* isolate)
+    : state_(new State(isolate)) {}
+
+WasmStreamingCompiler::~WasmStreamingCompiler() { delete state_; }
+
+bool WasmStreamingCompiler::AddBytes(const byte* bytes, size_t size) {
+  return state_->AddBytes(bytes, size);
+}
+
+MaybeHandle<JSObject> WasmStreamingCompiler::Finish() {
+  return state_->Finish();
+}
+
+WasmModule* WasmStreamingCompiler::module() { return state_->module(); }
+
+namespace {
+// Compiles the module of {owned}, which the compiled module takes ownership
+// of. {result} is the result of decoding it.
+MaybeHandle<JSObject> CompileOwnedModule(ErrorThrower& thrower,
+                                         Isolate* isolate, OwnedModule* owned,
+                                         ModuleResult& result) {
+  if (result.failed()) {
+    thrower.Failed("", result);
+    delete owned;
+    return MaybeHandle<JSObject>();
+  }
+  Handle<JSObject> compiled_module;
+  if (!owned->module()->Compile(isolate).ToHandle(&compiled_module)) {
+    delete owned;
+    return MaybeHandle<JSObject>();
+  }
+  GetSharedCodeData(compiled_module)->set_owned_module(owned);
+  return compiled_module;
+}
+}  // namespace
+
+MaybeHandle<JSObject> CompileModule(ErrorThrower& thrower, Isolate* isolate,
+                                    const byte* start, const byte* end) {
+  OwnedModule* owned = new OwnedModule();
+  ModuleResult result = owned->Decode(isolate, start, end);
+  return CompileOwnedModule(thrower, isolate, owned, result);
+}
+
+MaybeHandle<JSObject> CompileModuleFile(ErrorThrower& thrower,
+                                        Isolate* isolate, const char* path) {
+  WasmModuleFile* file = WasmModuleFile::Open(path);
+  if (file == nullptr) {
+    thrower.Error("cannot read module file %s", path);
+    return MaybeHandle<JSObject>();
+  }
+  OwnedModule* owned = new OwnedModule();
+  ModuleResult result = owned->Decode(isolate, file);
+  return CompileOwnedModule(thrower, isolate, owned, result);
+}
+
+bool IsCompiledModule(Handle<Object> object) {
+  if (!object->IsJSObject()) return false;
+  Handle<JSObject> obj = Handle<JSObject>::cast(object);
+  if (!HasBrand(obj->GetIsolate(), obj, kCompiledModuleBrand)) return false;
+  DCHECK_EQ(kCompiledModuleInternalFieldCount, obj->GetInternalFieldCount());
+  return GetSharedCodeData(obj)->module() != nullptr;
+}
+
+MaybeHandle<JSObject> InstantiateCompiledModule(
+    Isolate* isolate, Handle<JSObject> compiled_module, Handle<JSObject> ffi,
+    Handle<JSArrayBuffer> memory) {
+  DCHECK(IsCompiledModule(compiled_module));
+  WasmModule* module = GetSharedCodeData(compiled_module)->module();
+  return module->Instantiate(isolate, ffi, memory, compiled_module);
+}
+
+namespace {
+// The memory image of a snapshot. It is deleted when the snapshot object
+// dies, which the instances created from it keep alive.
+class SnapshotData {
+ public:
+  explicit SnapshotData(MemoryImage* image) : image_(image) {}
+
+  ~SnapshotData() { delete image_; }
+
+  MemoryImage* image() { return image_; }
+
+  // Ties the lifetime of this data to the given snapshot object.
+  void MakeWeak(Isolate* isolate, Handle<JSObject> snapshot) {
+    v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+    snapshot_.Reset(v8_isolate, v8::Utils::ToLocal(snapshot));
+    snapshot_.SetWeak(this, &SnapshotData::Delete,
+                      v8::WeakCallbackType::kParameter);
+  }
+
+ private:
+  MemoryImage* image_;
+  v8::Global<v8::Object> snapshot_;
+
+  static void Delete(const v8::WeakCallbackInfo<SnapshotData>& info) {
+    SnapshotData* data = info.GetParameter();
+    data->snapshot_.Reset();
+    delete data;
+  }
+};
+
+SnapshotData* GetSnapshotData(Handle<JSObject> snapshot) {
+  return reinterpret_cast<SnapshotData*>(
+      Foreign::cast(snapshot->GetInternalField(kSnapshotData))
+          ->foreign_address());
+}
+
+ReservedMemory* GetReservedMemory(Handle<JSObject> instance) {
+  return reinterpret_cast<ReservedMemory*>(
+      Foreign::cast(instance->GetInternalField(kWasmMemReservation))
+          ->foreign_address());
+}
+
+// Returns the module of {instance} if it is an instance of a compiled module
+// created by {CompileModule}, whose memory was allocated at instantiation and
+// has not grown, or nullptr otherwise. The memory cannot shrink back to its
+// initial size, because views of it may extend beyond it.
+WasmModule* GetModuleWithOwnMemory(Isolate* isolate,
+                                   Handle<JSObject> instance) {
+  if (!HasBrand(isolate, instance, kInstanceBrand)) return nullptr;
+  DCHECK_EQ(kWasmModuleInternalFieldCount, instance->GetInternalFieldCount());
+  if (!instance->GetInternalField(kWasmMemReservation)->IsForeign()) {
+    return nullptr;
+  }
+  Handle<Object> compiled_module(
+      instance->GetInternalField(kWasmModuleCompiledModule), isolate);
+  if (!IsCompiledModule(compiled_module)) return nullptr;
+  WasmModule* module =
+      GetSharedCodeData(Handle<JSObject>::cast(compiled_module))->module();
+  JSArrayBuffer* mem_buffer =
+      JSArrayBuffer::cast(instance->GetInternalField(kWasmMemArrayBuffer));
+  size_t mem_size = static_cast<size_t>(mem_buffer->byte_length()->Number());
+  if (mem_size != (static_cast<size_t>(1) << module->min_mem_size_log2)) {
+    return nullptr;
+  }
+  return module;
+}
+
+// Copies the {size} bytes of globals in {source} to the globals of
+// {instance}, or clears them if {source} is null.
+void SetGlobals(Handle<JSObject> instance, ByteArray* source, size_t size) {
+  Object* globals = instance->GetInternalField(kWasmGlobalsArrayBuffer);
+  if (!globals->IsJSArrayBuffer()) return;
+  void* start = JSArrayBuffer::cast(globals)->backing_store();
+  if (source) {
+    memcpy(start, source->GetDataStartAddress(), size);
+  } else {
+    memset(start, 0, size);
+  }
+}
+}  // namespace
+
+bool ResetInstance(Isolate* isolate, Handle<JSObject> instance) {
+  WasmModule* module = GetModuleWithOwnMemory(isolate, instance);
+  if (!module) return false;
+  JSArrayBuffer* mem_buffer =
+      JSArrayBuffer::cast(instance->GetInternalField(kWasmMemArrayBuffer));
+  if (!GetReservedMemory(instance)->Reset(
+          module, static_cast<size_t>(mem_buffer->byte_length()->Number()))) {
+    return false;
+  }
+
+  // Globals start out as zero, or as in the snapshot of the instance.
+  ByteArray* globals = nullptr;
+  Object* snapshot = instance->GetInternalField(kWasmModuleSnapshot);
+  if (snapshot->IsJSObject()) {
+    globals = ByteArray::cast(
+        JSObject::cast(snapshot)->GetInternalField(kSnapshotGlobals));
+  }
+  SetGlobals(instance, globals, AllocateGlobalsOffsets(module->globals));
+  return true;
+}
+
+MaybeHandle<JSObject> SnapshotInstance(ErrorThrower& thrower, Isolate* isolate,
+                                       Handle<JSObject> instance) {
+  WasmModule* module = GetModuleWithOwnMemory(isolate, instance);
+  if (!module) {
+    thrower.Error("Only instances of compiled modules can be snapshotted.");
+    return MaybeHandle<JSObject>();
+  }
+  JSArrayBuffer* mem_buffer =
+      JSArrayBuffer::cast(instance->GetInternalField(kWasmMemArrayBuffer));
+  MemoryImage* image = MemoryImage::ForMemory(
+      reinterpret_cast<byte*>(mem_buffer->backing_store()),
+      static_cast<size_t>(mem_buffer->byte_length()->Number()));
+  if (!image) {
+    thrower.Error("Creating the memory image failed.");
+    return MaybeHandle<JSObject>();
+  }
+
+  Factory* factory = isolate->factory();
+  size_t globals_size = AllocateGlobalsOffsets(module->globals);
+  Handle<ByteArray> globals =
+      factory->NewByteArray(static_cast<int>(globals_size), TENURED);
+  Object* globals_buffer = instance->GetInternalField(kWasmGlobalsArrayBuffer);
+  if (globals_buffer->IsJSArrayBuffer()) {
+    memcpy(globals->GetDataStartAddress(),
+           JSArrayBuffer::cast(globals_buffer)->backing_store(), globals_size);
+  }
+
+  Handle<Map> map = factory->NewMap(
+      JS_OBJECT_TYPE,
+      JSObject::kHeaderSize + kSnapshotInternalFieldCount * kPointerSize);
+  Handle<JSObject> snapshot = factory->NewJSObjectFromMap(map, TENURED);
+  snapshot->SetInternalField(
+      kSnapshotCompiledModule,
+      instance->GetInternalField(kWasmModuleCompiledModule));
+  snapshot->SetInternalField(kSnapshotGlobals, *globals);
+  SnapshotData* data = new SnapshotData(image);
+  snapshot->SetInternalField(
+      kSnapshotData, *factory->NewForeign(reinterpret_cast<Address>(data)));
+  data->MakeWeak(isolate, snapshot);
+  SetBrand(isolate, snapshot, kSnapshotBrand);
+  return snapshot;
+}
+
+bool IsInstanceSnapshot(Handle<Object> object) {
+  if (!object->IsJSObject()) return false;
+  Handle<JSObject> obj = Handle<JSObject>::cast(object);
+  Isolate* isolate = obj->GetIsolate();
+  if (!HasBrand(isolate, obj, kSnapshotBrand)) return false;
+  DCHECK_EQ(kSnapshotInternalFieldCount, obj->GetInternalFieldCount());
+  return IsCompiledModule(
+      handle(obj->GetInternalField(kSnapshotCompiledModule), isolate));
+}
+
+MaybeHandle<JSObject> InstantiateSnapshot(ErrorThrower& thrower,
+                                          Isolate* isolate,
+                                          Handle<JSObject> snapshot,
+                                          Handle<JSObject> ffi) {
+  DCHECK(IsInstanceSnapshot(snapshot));
+  Handle<JSObject> compiled_module(
+      JSObject::cast(snapshot->GetInternalField(kSnapshotCompiledModule)),
+      isolate);
+  Handle<JSObject> instance;
+  if (!InstantiateCompiledModule(isolate, compiled_module, ffi,
+                                 Handle<JSArrayBuffer>::null())
+           .ToHandle(&instance)) {
+    return MaybeHandle<JSObject>();
+  }
+  WasmModule* module = GetModuleWithOwnMemory(isolate, instance);
+  JSArrayBuffer* mem_buffer =
+      JSArrayBuffer::cast(instance->GetInternalField(kWasmMemArrayBuffer));
+  if (!module ||
+      !GetReservedMemory(instance)->MapImage(
+          GetSnapshotData(snapshot)->image(),
+          static_cast<size_t>(mem_buffer->byte_length()->Number()))) {
+    thrower.Error("Mapping the memory image failed.");
+    return MaybeHandle<JSObject>();
+  }
+  SetGlobals(instance,
+             ByteArray::cast(snapshot->GetInternalField(kSnapshotGlobals)),
+             AllocateGlobalsOffsets(module->globals));
+  instance->SetInternalField(kWasmModuleSnapshot, *snapshot);
+  return instance;
+}
+
+namespace {
+class AsyncInstantiateJob;
+
+// The jobs whose promises have not settled yet, by id. Tasks posted to the
+// isolate's thread refer to their job by id, so that they do nothing once the
+// job has been aborted. Only the isolates whose embedder aborts their jobs at
+// teardown may start jobs.
+struct AsyncInstantiateJobs {
+  AsyncInstantiateJobs() : next_id(0) {}
+
+  base::Mutex mutex;
+  uint32_t next_id;
+  std::map<uint32_t, AsyncInstantiateJob*> jobs;
+  std::set<Isolate*> isolates;
+};
+
+base::LazyInstance<AsyncInstantiateJobs>::type async_instantiate_jobs =
+    LAZY_INSTANCE_INITIALIZER;
+
+// An asynchronous instantiation. Each step runs in a task, which posts the
+// next step either to background threads or to the isolate's thread. The
+// deferred handles keep the objects of the job alive between the steps, and
+// the task of the step that settles the promise deletes the job, after the
+// background tasks have signaled that they are done with it.
+class AsyncInstantiateJob {
+ public:
+  AsyncInstantiateJob(Isolate* isolate, std::vector<byte> bytes,
+                      Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+                      Handle<JSObject> resolver)
+      : isolate_(isolate),
+        bytes_(std::move(bytes)),
+        thrower_(isolate, "WASM.instantiateModuleAsync()"),
+        linker_(isolate, 0),
+        queue_(&units_),
+        background_done_(0),
+        num_background_tasks_(0),
+        pending_tasks_(0),
+        module_(nullptr),
+        settled_(false) {
+    DeferredHandleScope deferred(isolate);
+    if (!ffi.is_null()) ffi_ = handle(*ffi, isolate);
+    if (!memory.is_null()) memory_ = handle(*memory, isolate);
+    resolver_ = handle(*resolver, isolate);
+    context_ = handle(*isolate->native_context(), isolate);
+    handles_.push_back(deferred.Detach());
+
+    AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+    base::LockGuard<base::Mutex> guard(&registry->mutex);
+    id_ = registry->next_id++;
+    registry->jobs[id_] = this;
+  }
+
+  // Must be called on the isolate's thread, once the background tasks are
+  // done with the job.
+  ~AsyncInstantiateJob() {
+    for (compiler::WasmCompilationUnit* unit : units_) {
+      compiler::AbortCompilation(unit);
+    }
+    for (DeferredHandles* handles : handles_) delete handles;
+    delete module_;
+  }
+
+  void Start() { PostBackground(&AsyncInstantiateJob::Decode); }
+
+  Isolate* isolate() const { return isolate_; }
+
+  // Removes the job from the registry, so that its pending foreground tasks
+  // do nothing, and deletes it once its background tasks are done.
+  // Background tasks that are still executing units are helped, rather than
+  // cancelled, since the units may not be deleted while they execute.
+  static void Release(AsyncInstantiateJob* job) {
+    {
+      AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+      base::LockGuard<base::Mutex> guard(&registry->mutex);
+      registry->jobs.erase(job->id_);
+    }
+    job->queue_.ExecuteUnits();
+    for (size_t i = 0; i < job->num_background_tasks_; i++) {
+      job->background_done_.Wait();
+    }
+    delete job;
+  }
+
+ private:
+  typedef void (AsyncInstantiateJob::*Step)();
+
+  // Runs a step on the isolate's thread, if the job has not been aborted,
+  // and deletes the job once the step settled the promise.
+  class ForegroundTask : public v8::Task {
+   public:
+    ForegroundTask(uint32_t id, Step step) : id_(id), step_(step) {}
+
+    void Run() override {
+      AsyncInstantiateJob* job = nullptr;
+      {
+        AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+        base::LockGuard<base::Mutex> guard(&registry->mutex);
+        auto it = registry->jobs.find(id_);
+        if (it == registry->jobs.end()) return;
+        job = it->second;
+      }
+      (job->*step_)();
+      if (job->settled_) Release(job);
+    }
+
+   private:
+    uint32_t id_;
+    Step step_;
+  };
+
+  // Runs a step on a background thread. The job outlives the task, which
+  // signals when it no longer uses the job.
+  class BackgroundTask : public v8::Task {
+   public:
+    BackgroundTask(AsyncInstantiateJob* job, Step step)
+        : job_(job), step_(step) {}
+
+    void Run() override {
+      (job_->*step_)();
+      job_->background_done_.Signal();
+    }
+
+   private:
+    AsyncInstantiateJob* job_;
+    Step step_;
+  };
+
+  Isolate* isolate_;
+  uint32_t id_;
+  std::vector<byte> bytes_;
+  ErrorThrower thrower_;
+  Zone zone_;
+  WasmLinker linker_;
+  ModuleEnv module_env_;
+  Handle<JSObject> ffi_;
+  Handle<JSArrayBuffer> memory_;
+  Handle<JSObject> resolver_;
+  Handle<Context> context_;
+  Handle<JSObject> compiled_module_;
+  std::vector<DeferredHandles*> handles_;
+  std::vector<compiler::WasmCompilationUnit*> units_;
+  std::vector<uint32_t> unit_indices_;
+  WasmCompilationQueue queue_;
+  base::Semaphore background_done_;
+  size_t num_background_tasks_;  // only accessed on the isolate's thread.
+  base::AtomicWord pending_tasks_;
+  WasmModule* module_;
+  std::string decode_error_;
+  bool settled_;
+
+  // Must be called on the isolate's thread.
+  void PostBackground(Step step) {
+    num_background_tasks_++;
+    V8::GetCurrentPlatform()->CallOnBackgroundThread(
+        new BackgroundTask(this, step), v8::Platform::kShortRunningTask);
+  }
+
+  void PostForeground(Step step) {
+    V8::GetCurrentPlatform()->CallOnForegroundThread(
+        reinterpret_cast<v8::Isolate*>(isolate_),
+        new ForegroundTask(id_, step));
+  }
+
+  // Decodes the module on a background thread, which decoding allows since
+  // it does not allocate on the heap.
+  void Decode() {
+    const byte* start = bytes_.data();
+    ModuleResult result = DecodeWasmModule(
+        isolate_, &zone_, start, start + bytes_.size(), false, false);
+    if (result.failed()) {
+      std::ostringstream str;
+      str << result;
+      decode_error_ = str.str();
+      delete result.val;
+    } else {
+      module_ = result.val;
+    }
+    PostForeground(&AsyncInstantiateJob::CreateUnits);
+  }
+
+  // Creates the compilation units of the functions on the isolate's thread,
+  // like {WasmModule::Compile}, and executes them on background threads.
+  void CreateUnits() {
+    HandleScope scope(isolate_);
+    v8::Context::Scope context_scope(v8::Utils::ToLocal(context_));
+    if (module_ == nullptr) {
+      thrower_.Error("%s", decode_error_.c_str());
+      Settle(MaybeHandle<JSObject>());
+      return;
+    }
+    module_->shared_isolate = isolate_;
+    bool can_grow = module_->max_mem_size_log2 > module_->min_mem_size_log2;
+    {
+      DeferredHandleScope deferred(isolate_);
+      compiled_module_ = NewCompiledModule(isolate_);
+      AllocateGlobalsOffsets(module_->globals);
+      linker_.Resize(module_->functions->size());
+      module_env_.module = module_;
+      module_env_.mem_start = 0;
+      module_env_.mem_end = 0;
+      module_env_.globals_area = 0;
+      module_env_.linker = &linker_;
+      module_env_.function_code = nullptr;
+      module_env_.tier_up_budgets = nullptr;
+      module_env_.current_instance =
+          GetSharedCodeData(compiled_module_)->current_instance();
+      module_env_.context = context_;
+      module_env_.asm_js = false;
+      if (can_grow) {
+        module_env_.grow_memory_stub = CreateGrowMemoryStub(
+            isolate_, &module_env_, module_env_.current_instance);
+      }
+      handles_.push_back(deferred.Detach());
+    }
+    if (can_grow && module_env_.grow_memory_stub.is_null()) {
+      thrower_.Error("Compilation of grow memory stub failed.");
+      Settle(MaybeHandle<JSObject>());
+      return;
+    }
+
+    {
+      // Placeholders for all functions are allocated before any unit is
+      // executed, so that direct calls do not allocate.
+      DeferredHandleScope deferred(isolate_);
+      uint32_t index = 0;
+      for (const WasmFunction& func : *module_->functions) {
+        if (!func.external) module_env_.GetFunctionCode(index);
+        index++;
+      }
+      index = 0;
+      for (const WasmFunction& func : *module_->functions) {
+        if (!func.external) {
+          units_.push_back(compiler::CreateWasmCompilationUnit(
+              thrower_, isolate_, &module_env_, func, index,
+              compiler::kOptimizedTier));
+          unit_indices_.push_back(index);
+        }
+        index++;
+      }
+      handles_.push_back(deferred.Detach());
+    }
+
+    v8::Platform* platform = V8::GetCurrentPlatform();
+    size_t num_tasks =
+        Min(units_.size(), platform->NumberOfAvailableBackgroundThreads());
+    if (num_tasks == 0) {
+      queue_.ExecuteUnits();
+      Finish();
+      return;
+    }
+    base::NoBarrier_Store(&pending_tasks_,
+                          static_cast<base::AtomicWord>(num_tasks));
+    for (size_t i = 0; i < num_tasks; i++) {
+      PostBackground(&AsyncInstantiateJob::ExecuteUnits);
+    }
+  }
+
+  // Executes units on a background thread. The last task to run out of
+  // units finishes the job.
+  void ExecuteUnits() {
+    queue_.ExecuteUnits();
+    if (base::Barrier_AtomicIncrement(&pending_tasks_, -1) == 0) {
+      PostForeground(&AsyncInstantiateJob::Finish);
+    }
+  }
+
+  // Generates the code of the units and instantiates the compiled module on
+  // the isolate's thread. Every unit is finished, even after an error, so
+  // that all of them are deleted.
+  void Finish() {
+    HandleScope scope(isolate_);
+    v8::Context::Scope context_scope(v8::Utils::ToLocal(context_));
+    std::vector<Handle<Code>> results(module_->functions->size());
+    for (size_t i = 0; i < units_.size(); i++) {
+      uint32_t index = unit_indices_[i];
+      Handle<Code> code = compiler::FinishCompilation(units_[i]);
+      if (!code.is_null()) {
+        results[index] = code;
+        linker_.Finish(index, code);
+      } else {
+        const WasmFunction& func = module_->functions->at(index);
+        thrower_.Error("Compilation of #%d:%s failed.", index,
+                       module_->GetName(func.name_offset));
+      }
+    }
+    units_.clear();
+
+    MaybeHandle<JSObject> instance;
+    if (!thrower_.error()) {
+      Handle<JSObject> compiled_module(*compiled_module_, isolate_);
+      SetCompiledModuleCode(isolate_, compiled_module, module_, &linker_,
+                            results);
+      instance = module_->Instantiate(isolate_, ffi_, memory_, compiled_module);
+    }
+    Settle(instance);
+  }
+
+  // Resolves the promise with the instance, or rejects it with the error
+  // scheduled by the thrower. The reactions run at the next microtask
+  // checkpoint of the embedder.
+  void Settle(MaybeHandle<JSObject> instance) {
+    v8::Local<v8::Context> context = v8::Utils::ToLocal(context_);
+    v8::Local<v8::Promise::Resolver> resolver =
+        v8::Local<v8::Promise::Resolver>::Cast(v8::Utils::ToLocal(resolver_));
+    Handle<JSObject> result;
+    if (instance.ToHandle(&result)) {
+      USE(resolver->Resolve(context, v8::Utils::ToLocal(result)));
+    } else {
+      Handle<Object> error = isolate_->factory()->undefined_value();
+      if (isolate_->has_scheduled_exception()) {
+        error = handle(isolate_->scheduled_exception(), isolate_);
+        isolate_->clear_scheduled_exception();
+        isolate_->clear_pending_message();
+      }
+      USE(resolver->Reject(context, v8::Utils::ToLocal(error)));
+    }
+    settled_ = true;
+  }
+};
+}  // namespace
+
+void InstantiateModuleAsync(Isolate* isolate, std::vector<byte> bytes,
+                            Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+                            Handle<JSObject> resolver) {
+  DCHECK(AsyncInstantiationsEnabled(isolate));
+  AsyncInstantiateJob* job = new AsyncInstantiateJob(
+      isolate, std::move(bytes), ffi, memory, resolver);
+  job->Start();
+}
+
+void EnableAsyncInstantiations(Isolate* isolate) {
+  AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+  base::LockGuard<base::Mutex> guard(&registry->mutex);
+  registry->isolates.insert(isolate);
+}
+
+bool AsyncInstantiationsEnabled(Isolate* isolate) {
+  AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+  base::LockGuard<base::Mutex> guard(&registry->mutex);
+  return registry->isolates.count(isolate) != 0;
+}
+
+void AbortAsyncInstantiations(Isolate* isolate) {
+  std::vector<AsyncInstantiateJob*> jobs;
+  {
+    AsyncInstantiateJobs* registry = async_instantiate_jobs.Pointer();
+    base::LockGuard<base::Mutex> guard(&registry->mutex);
+    registry->isolates.erase(isolate);
+    for (const auto& entry : registry->jobs) {
+      if (entry.second->isolate() == isolate) jobs.push_back(entry.second);
+    }
+  }
+  for (AsyncInstantiateJob* job : jobs) AsyncInstantiateJob::Release(job);
+}
+
+bool WasmModule::Serialize(Isolate* isolate, Handle<JSObject> instance,
+                           std::vector<byte>* data) {
+  // Functions that are compiled after instantiation are called through the
+  // code table, and shared code or code for memory that can grow refers to
+  // an instance context, neither of which is supported by the serializer.
+  if (!instance->GetInternalField(kWasmModuleDeferredData)->IsSmi() ||
+      !instance->GetInternalField(kWasmModuleInstanceContext)->IsSmi()) {
+    return false;
+  }
+  ModuleEnv module_env;
+  InitModuleEnv(isolate, instance, this, &module_env);
+  size_t globals_size = AllocateGlobalsOffsets(globals);
+  return SerializeWasmCode(isolate, &module_env, globals_size,
+                           module_env.code_table, data);
+}
+
+Handle<Code> ModuleEnv::GetFunctionCode(uint32_t index) {
+  DCHECK(IsValidFunction(index));
+  if (linker) return linker->GetFunctionCode(index);
+  if (function_code) return function_code->at(index);
+  return Handle<Code>::null();
+}
+
+compiler::CallDescriptor* ModuleEnv::GetCallDescriptor(Zone* zone,
+                                                       uint32_t index) {
+  DCHECK(IsValidFunction(index));
+  // Always make a direct call to whatever is in the table at that location.
+  // A wrapper will be generated for FFI calls.
+  WasmFunction* function = &module->functions->at(index);
+  return GetWasmCallDescriptor(zone, function->sig);
+}
+
+int32_t CompileAndRunWasmModule(Isolate* isolate, const byte* module_start,
+                                const byte* module_end, bool asm_js) {
+  HandleScope scope(isolate);
+  Zone zone;
+  // Decode the module, but don't verify function bodies, since we'll
+  // be compiling them anyway.
+  ModuleResult result =
+      DecodeWasmModule(isolate, &zone, module_start, module_end, false, false);
+  if (result.failed()) {
+    // Module verification failed. throw.
+    std::ostringstream str;
+    str << "WASM.compileRun() failed: " << result;
+    isolate->Throw(
+        *isolate->factory()->NewStringFromAsciiChecked(str.str().c_str()));
+    return -1;
+  }
+
+  int32_t retval = CompileAndRunWasmModule(isolate, result.val);
+  delete result.val;
+  return retval;
+}
+
+
+int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module) {
   ErrorThrower thrower(isolate, "CompileAndRunWasmModule");
 
   // Allocate temporary linear memory and globals.
@@ -430,6 +2922,7 @@ int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module) {
   module_env.linker = &linker;
   module_env.function_code = nullptr;
   module_env.function_table = BuildFunctionTable(isolate, module);
+  module_env.tier_up_budgets = nullptr;
   module_env.asm_js = false;
 
   // Load data segments.
@@ -437,19 +2930,15 @@ int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module) {
   LoadDataSegments(module, mem_addr.get(), mem_size);
 
   // Compile all functions.
+  std::vector<Handle<Code>> results;
+  CompileFunctions(thrower, isolate, &module_env, compiler::kOptimizedTier,
+                   &results);
+  if (thrower.error()) return -1;
+
   Handle<Code> main_code = Handle<Code>::null();  // record last code.
   int index = 0;
   for (const WasmFunction& func : *module->functions) {
-    if (!func.external) {
-      // Compile the function and install it in the code table.
-      Handle<Code> code = compiler::CompileWasmFunction(
-          thrower, isolate, &module_env, func, index);
-      if (!code.is_null()) {
-        if (func.exported) main_code = code;
-        linker.Finish(index, code);
-      }
-      if (thrower.error()) return -1;
-    }
+    if (!func.external && func.exported) main_code = results[index];
     index++;
   }
 
@@ -478,6 +2967,23 @@ int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module) {
   }
   return -1;
 }
+
+
+void FinishTierUpForTesting(Handle<JSObject> instance) {
+  DeferredCompileData* data = GetDeferredCompileData(instance);
+  while (data->running_jobs() > 0) {
+    data->WaitForExecutedJob();
+    FinishExecutedTierUpJobs(data);
+  }
+}
+
+
+Handle<Code> GetFunctionCodeForTesting(Handle<JSObject> instance,
+                                       int index) {
+  FixedArray* code_table =
+      FixedArray::cast(instance->GetInternalField(kWasmModuleCodeTable));
+  return handle(Code::cast(code_table->get(index)), instance->GetIsolate());
+}
 }
 }
 }
@@ -47,6 +47,13 @@ static const size_t kDeclMemorySize = 3;
 static const size_t kDeclGlobalSize = 6;
 static const size_t kDeclDataSegmentSize = 13;
 
+// How the functions of a module are compiled upon instantiation.
+enum WasmCompilationMode {
+  kEagerCompilation,  // compile all functions before instantiation returns.
+  kLazyCompilation,   // compile each function upon its first call.
+  kTieredCompilation  // compile quickly first, then optimize hot functions.
+};
+
 // Static representation of a wasm function.
 struct WasmFunction {
   FunctionSig* sig;      // signature of the function.
@@ -72,6 +79,16 @@ struct WasmGlobal {
   bool exported;         // true if this global is exported.
 };
 
+// A native function that satisfies an import instead of a JS function. Wasm
+// code calls it under the C calling convention, with int32_t, int64_t, float
+// and double for the local types of {sig}, without entering JavaScript. It
+// must not call back into the isolate or throw.
+struct WasmHostFunction {
+  const char* name;  // name of the imports it satisfies.
+  FunctionSig* sig;  // must have the same types as the signature of imports.
+  Address function;  // address of the native function.
+};
+
 // Static representation of a wasm data segment.
 struct WasmDataSegment {
   uint32_t dest_addr;      // destination memory address of the data.
@@ -80,6 +97,20 @@ struct WasmDataSegment {
   bool init;               // true if loaded upon instantiation.
 };
 
+// The state of an instance that code compiled independently of the memory
+// and globals loads, instead of embedding it. Code of instances whose memory
+// can grow loads the size of the memory from here as well.
+struct WasmInstanceContext {
+  byte* mem_start;          // address of the start of linear memory.
+  byte* globals_start;      // address of the globals area.
+  Object** code_table;      // location of the weak handle of the code table.
+  Object** function_table;  // location of the weak handle of the func table.
+  Object** mem_buffer;      // location of the handle of the memory buffer.
+  uint32_t mem_size;        // size of linear memory.
+  uint32_t mem_max_size;    // size up to which linear memory can grow.
+  bool guard_pages;         // true if accesses beyond it fault.
+};
+
 // Static representation of a module.
 struct WasmModule {
   static const uint8_t kMinMemSize = 12;  // Minimum memory size = 4kb
@@ -112,11 +143,142 @@ struct WasmModule {
     return start < size && end < size;
   }
 
-  // Creates a new instantiation of the module in the given isolate.
+  // Creates a new instantiation of the module in the given isolate. Eagerly
+  // compiled functions are deserialized from {serialized_code} instead, if it
+  // was serialized for this module and memory size. If {compiled_module} is
+  // given, the instance shares its code instead of compiling. Imports are
+  // looked up in {host_functions} before {ffi}.
+  MaybeHandle<JSObject> Instantiate(
+      Isolate* isolate, Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+      WasmCompilationMode mode = kEagerCompilation,
+      Vector<const byte> serialized_code = Vector<const byte>(),
+      Handle<JSObject> compiled_module = Handle<JSObject>::null(),
+      const std::vector<WasmHostFunction>* host_functions = nullptr);
+
+  // Compiles the functions of the module independently of the memory and the
+  // globals, returning a compiled module from which {Instantiate} can create
+  // many instances that share its code.
+  MaybeHandle<JSObject> Compile(Isolate* isolate);
+
+  // Creates a new instantiation of the module from a compiled module.
   MaybeHandle<JSObject> Instantiate(Isolate* isolate, Handle<JSObject> ffi,
-                                    Handle<JSArrayBuffer> memory);
+                                    Handle<JSArrayBuffer> memory,
+                                    Handle<JSObject> compiled_module);
+
+  // Serializes the code of an eagerly compiled instance of the module, so
+  // that it can be cached under the hash of the module bytes and passed to
+  // {Instantiate}. Returns false if the code cannot be serialized.
+  bool Serialize(Isolate* isolate, Handle<JSObject> instance,
+                 std::vector<byte>* data);
+};
+
+// Decodes and compiles a module from bytes that arrive in chunks, e.g. from
+// slow storage or a pipe, into a compiled module like {WasmModule::Compile}.
+// Each function body is compiled on background threads as soon as all of its
+// bytes have arrived, overlapping compilation with reading the rest of the
+// module. Bodies that refer to parts of the module that have not arrived yet
+// are compiled once the module is complete.
+class WasmStreamingCompiler {
+ public:
+  explicit WasmStreamingCompiler(Isolate* isolate);
+  ~WasmStreamingCompiler();
+
+  // Appends the next chunk of the module bytes. Returns false after throwing
+  // an error once the bytes cannot be the start of a valid module; later
+  // chunks are ignored then, and {Finish} returns an empty handle.
+  bool AddBytes(const byte* bytes, size_t size);
+
+  // Completes decoding and compilation once all bytes have arrived. Returns
+  // the compiled module, or an empty handle after throwing an error.
+  MaybeHandle<JSObject> Finish();
+
+  // The module checked by {Finish}, which instantiates the compiled module.
+  // It refers to the bytes owned by this compiler.
+  WasmModule* module();
+
+ private:
+  class State;
+  State* state_;
 };
 
+// Decodes the module in [{start}, {end}) and compiles it into a compiled
+// module like {WasmModule::Compile}. The compiled module owns a copy of the
+// bytes and the decoded module, so that it can be instantiated any number of
+// times with {InstantiateCompiledModule} without decoding again.
+MaybeHandle<JSObject> CompileModule(ErrorThrower& thrower, Isolate* isolate,
+                                    const byte* start, const byte* end);
+
+// Like {CompileModule}, but decodes the module file at {path} in place instead
+// of copying it. Where supported, the file is mapped read-only, so that the
+// bytes are read from the page cache only as they are decoded, and the
+// compiled module keeps the mapping instead of a copy of the bytes. This is
+// an entry point for embedders and shells such as d8; it is not exposed to
+// script, which must not be able to read arbitrary files.
+MaybeHandle<JSObject> CompileModuleFile(ErrorThrower& thrower,
+                                        Isolate* isolate, const char* path);
+
+// Returns true if {object} is a compiled module created by {CompileModule}.
+bool IsCompiledModule(Handle<Object> object);
+
+// Instantiates a compiled module created by {CompileModule}.
+MaybeHandle<JSObject> InstantiateCompiledModule(
+    Isolate* isolate, Handle<JSObject> compiled_module, Handle<JSObject> ffi,
+    Handle<JSArrayBuffer> memory);
+
+// Restores the memory and globals of {instance} to their contents right after
+// instantiation, keeping its code and exports. Pages of the memory are
+// dropped rather than cleared where possible, so that resetting only costs
+// time for the pages written since. Only instances of compiled modules
+// created by {CompileModule} whose memory was allocated at instantiation and
+// has not grown can be reset; returns false for other instances, and if the
+// memory image of the instance cannot be mapped again. Instances created by
+// {InstantiateSnapshot} are restored to the state of the snapshot.
+bool ResetInstance(Isolate* isolate, Handle<JSObject> instance);
+
+// Captures the memory and globals of {instance}, e.g. after running its
+// initialization code, into a snapshot object. The pages of the memory that
+// are not zero are kept in a memory file, which instances created with
+// {InstantiateSnapshot} map copy-on-write. The same instances as for
+// {ResetInstance} are supported, on platforms with memory files.
+MaybeHandle<JSObject> SnapshotInstance(ErrorThrower& thrower, Isolate* isolate,
+                                       Handle<JSObject> instance);
+
+// Returns true if {object} is a snapshot created by {SnapshotInstance}.
+bool IsInstanceSnapshot(Handle<Object> object);
+
+// Instantiates the compiled module of {snapshot}, sharing its code, with the
+// memory and globals of the snapshot instead of the initial ones.
+MaybeHandle<JSObject> InstantiateSnapshot(ErrorThrower& thrower,
+                                          Isolate* isolate,
+                                          Handle<JSObject> snapshot,
+                                          Handle<JSObject> ffi);
+
+// Decodes, compiles and instantiates the module in {bytes} without blocking
+// the isolate's thread, like {WasmModule::Compile} followed by instantiating
+// the compiled module. Decoding and the compilation of the function bodies
+// run on background threads, and only the steps that allocate run in tasks
+// posted to the isolate's thread. The last of them resolves the promise of
+// {resolver} with the instance, or rejects it with the error. Asynchronous
+// instantiations must have been enabled for {isolate}.
+void InstantiateModuleAsync(Isolate* isolate, std::vector<byte> bytes,
+                            Handle<JSObject> ffi, Handle<JSArrayBuffer> memory,
+                            Handle<JSObject> resolver);
+
+// Allows asynchronous instantiations in {isolate}. Its embedder then has to
+// call {AbortAsyncInstantiations} before it disposes of the isolate, since
+// the jobs post tasks for it to the platform.
+void EnableAsyncInstantiations(Isolate* isolate);
+
+// Returns true if asynchronous instantiations are allowed in {isolate}.
+bool AsyncInstantiationsEnabled(Isolate* isolate);
+
+// Aborts the asynchronous instantiations of {isolate} whose promises have not
+// been settled, after waiting for their background tasks, and disallows new
+// ones. Their tasks posted to the isolate's thread do nothing when they run.
+// Must be called on the isolate's thread when the isolate is torn down,
+// before its heap.
+void AbortAsyncInstantiations(Isolate* isolate);
+
 // forward declaration.
 class WasmLinker;
 
@@ -130,7 +292,20 @@ struct ModuleEnv {
   WasmModule* module;
   WasmLinker* linker;
   std::vector<Handle<Code>>* function_code;
+  Handle<FixedArray> code_table;  // if set, calls go through the code table.
   Handle<FixedArray> function_table;
+  Handle<Code> tier_up_stub;  // if set, the quick tier counts for tiering up.
+  int32_t* tier_up_budgets;   // per-function budgets for tiering up.
+  // If set, the code loads the memory and the globals from the context of the
+  // current instance stored here, which wrappers set to {instance_context}.
+  WasmInstanceContext** current_instance = nullptr;
+  // If set without {current_instance}, the code loads the size of the memory,
+  // which can grow, from this context.
+  WasmInstanceContext* instance_context = nullptr;
+  Handle<Code> grow_memory_stub;  // if set, grow_memory calls this stub.
+  // If set, out of bounds memory accesses fault on guard pages instead of
+  // being checked explicitly.
+  bool guard_pages = false;
   Handle<JSArrayBuffer> memory;
   Handle<Context> context;
   bool asm_js;  // true if the module originated from asm.js.
@@ -163,7 +338,17 @@ struct ModuleEnv {
   Handle<Code> GetFunctionCode(uint32_t index);
   Handle<FixedArray> GetFunctionTable();
 
-  compiler::CallDescriptor* GetWasmCallDescriptor(Zone* zone, FunctionSig* sig);
+  static compiler::CallDescriptor* GetWasmCallDescriptor(Zone* zone,
+                                                         FunctionSig* sig);
+  // Returns the descriptor for calling a native host function with the
+  // signature {sig}, or nullptr if the platform or the signature is not
+  // supported.
+  static compiler::CallDescriptor* GetHostCallDescriptor(Zone* zone,
+                                                         FunctionSig* sig);
+  // Compiles the trampoline through which the host call descriptor calls
+  // native host functions, which aligns the stack for them. Returns null
+  // where host functions are called directly.
+  static Handle<Code> CompileHostCallTrampoline(Isolate* isolate);
   compiler::CallDescriptor* GetCallDescriptor(Zone* zone, uint32_t index);
 };
 
@@ -173,6 +358,9 @@ std::ostream& operator<<(std::ostream& os, const WasmFunction& function);
 typedef Result<WasmModule*> ModuleResult;
 typedef Result<WasmFunction*> FunctionResult;
 
+// Returns true if the signatures have the same return and parameter types.
+bool SameSignature(FunctionSig* a, FunctionSig* b);
+
 // For testing. Decode, verify, and run the last exported function in the
 // given encoded module.
 int32_t CompileAndRunWasmModule(Isolate* isolate, const byte* module_start,
@@ -181,6 +369,14 @@ int32_t CompileAndRunWasmModule(Isolate* isolate, const byte* module_start,
 // For testing. Decode, verify, and run the last exported function in the
 // given decoded module.
 int32_t CompileAndRunWasmModule(Isolate* isolate, WasmModule* module);
+
+// For testing. Waits for the running recompilations of the functions of a
+// tiered instance and installs their code.
+void FinishTierUpForTesting(Handle<JSObject> instance);
+
+// For testing. Returns the code of the function {index} in the code table of
+// the instance, which deferred compilation replaces.
+Handle<Code> GetFunctionCodeForTesting(Handle<JSObject> instance, int index);
 }
 }
 }
@@ -0,0 +1,652 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/v8.h"
+
+#include "src/assembler.h"
+#include "src/code-stubs.h"
+#include "src/flags.h"
+#include "src/snapshot/serialize.h"
+#include "src/v8memory.h"
+
+#include "src/wasm/decoder.h"
+#include "src/wasm/wasm-module.h"
+#include "src/wasm/wasm-serializer.h"
+
+namespace v8 {
+namespace internal {
+namespace wasm {
+
+namespace {
+// Magic number and version of the serialized format.
+const uint32_t kSerializedMagic = 0x6d736177;
+const uint32_t kSerializedVersion = 3;
+
+// The kinds of references from serialized code that are relinked upon
+// deserialization.
+enum ReferenceKind {
+  kFunctionCodeRef,   // code of the function with an index.
+  kStubCodeRef,       // code of the stub with a key.
+  kBuiltinCodeRef,    // code of the builtin with an index.
+  kFunctionTableRef,  // the function table.
+  kNativeContextRef,  // the native context.
+  kRootRef,           // the heap root with an index.
+  kStringRef,         // a one-byte string.
+  kNumberRef,         // a heap number.
+  kMemoryRef,         // the start of the linear memory.
+  kGlobalsRef,        // the start of the globals area.
+  kExternalRef,       // the external reference with an index in the table.
+  kInternalRef        // an offset into the instructions of the code.
+};
+
+// The relocation modes of references that are relinked. Code containing other
+// modes, except for those that only carry information, is not serialized.
+const int kRelinkedModeMask =
+    RelocInfo::kCodeTargetMask |
+    RelocInfo::ModeMask(RelocInfo::EMBEDDED_OBJECT) |
+    RelocInfo::ModeMask(RelocInfo::EXTERNAL_REFERENCE) |
+    RelocInfo::ModeMask(RelocInfo::INTERNAL_REFERENCE);
+
+bool IsInformational(RelocInfo::Mode mode) {
+  return RelocInfo::IsNone(mode) || RelocInfo::IsComment(mode) ||
+         RelocInfo::IsPosition(mode) || RelocInfo::IsDeoptReason(mode) ||
+         RelocInfo::IsConstPool(mode) || RelocInfo::IsVeneerPool(mode);
+}
+
+// Checks that a reference of the given kind can be relinked at a relocation
+// entry of the given mode.
+bool MatchesMode(ReferenceKind kind, RelocInfo::Mode mode) {
+  switch (kind) {
+    case kFunctionCodeRef:
+    case kStubCodeRef:
+    case kBuiltinCodeRef:
+      return RelocInfo::IsCodeTarget(mode);
+    case kFunctionTableRef:
+    case kNativeContextRef:
+    case kRootRef:
+    case kStringRef:
+    case kNumberRef:
+      return mode == RelocInfo::EMBEDDED_OBJECT;
+    case kMemoryRef:
+    case kGlobalsRef:
+    case kExternalRef:
+      return mode == RelocInfo::EXTERNAL_REFERENCE;
+    case kInternalRef:
+      return mode == RelocInfo::INTERNAL_REFERENCE;
+    default:
+      return false;
+  }
+}
+
+// Appends little endian integers and raw bytes to a buffer.
+class CodeWriter {
+ public:
+  explicit CodeWriter(std::vector<byte>* buffer) : buffer_(buffer) {}
+
+  void u8(uint8_t val) { buffer_->push_back(val); }
+
+  void u32(uint32_t val) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      buffer_->push_back(static_cast<byte>(val >> shift));
+    }
+  }
+
+  void u64(uint64_t val) {
+    u32(static_cast<uint32_t>(val));
+    u32(static_cast<uint32_t>(val >> 32));
+  }
+
+  void bytes(const byte* start, size_t size) {
+    buffer_->insert(buffer_->end(), start, start + size);
+  }
+
+ private:
+  std::vector<byte>* buffer_;
+};
+
+// Reads what a {CodeWriter} wrote.
+class CodeReader : public Decoder {
+ public:
+  CodeReader(const byte* start, const byte* end) : Decoder(start, end) {}
+
+  uint64_t u64(const char* name = nullptr) {
+    uint64_t low = u32(name);
+    uint64_t high = u32(name);
+    return low | (high << 32);
+  }
+
+  // Returns a pointer to {size} bytes and advances past them.
+  const byte* bytes(uint32_t size) {
+    if (size > kMaxInt || !checkAvailable(static_cast<int>(size))) {
+      error("bytes exceed the serialized data");
+      return nullptr;
+    }
+    const byte* result = pc_;
+    pc_ += size;
+    return result;
+  }
+
+  bool at_end() const { return pc_ == limit_; }
+};
+
+void WriteHeader(Isolate* isolate, ModuleEnv* module_env, size_t globals_size,
+                 CodeWriter* writer) {
+  WasmModule* module = module_env->module;
+  writer->u32(kSerializedMagic);
+  writer->u32(kSerializedVersion);
+  writer->u32(FlagList::Hash());
+  writer->u32(CpuFeatures::SupportedFeatures());
+  writer->u64(HashModuleBytes(module->module_start, module->module_end));
+  writer->u32(
+      static_cast<uint32_t>(module_env->mem_end - module_env->mem_start));
+  writer->u32(static_cast<uint32_t>(globals_size));
+  writer->u32(static_cast<uint32_t>(module->functions->size()));
+}
+
+bool CheckHeader(Isolate* isolate, ModuleEnv* module_env, size_t globals_size,
+                 CodeReader* reader) {
+  WasmModule* module = module_env->module;
+  if (reader->u32("magic") != kSerializedMagic) return false;
+  if (reader->u32("version") != kSerializedVersion) return false;
+  if (reader->u32("flags hash") != FlagList::Hash()) return false;
+  if (reader->u32("cpu features") != CpuFeatures::SupportedFeatures()) {
+    return false;
+  }
+  if (reader->u64("module hash") !=
+      HashModuleBytes(module->module_start, module->module_end)) {
+    return false;
+  }
+  uint32_t mem_size = reader->u32("memory size");
+  if (mem_size != module_env->mem_end - module_env->mem_start) return false;
+  if (reader->u32("globals size") != globals_size) return false;
+  if (reader->u32("function count") != module->functions->size()) return false;
+  return reader->ok();
+}
+
+int FindFunctionIndex(FixedArray* code_table, Code* code) {
+  for (int i = 0; i < code_table->length(); i++) {
+    if (code_table->get(i) == code) return i;
+  }
+  return -1;
+}
+
+int FindBuiltinIndex(Isolate* isolate, Code* code) {
+  Builtins* builtins = isolate->builtins();
+  for (int i = 0; i < Builtins::builtin_count; i++) {
+    if (builtins->builtin(static_cast<Builtins::Name>(i)) == code) return i;
+  }
+  return -1;
+}
+
+int FindRootIndex(Heap* heap, Object* object) {
+  for (int i = 0; i < Heap::kStrongRootListLength; i++) {
+    if (heap->root(static_cast<Heap::RootListIndex>(i)) == object) return i;
+  }
+  return -1;
+}
+
+int FindExternalReferenceIndex(Isolate* isolate, Address address) {
+  ExternalReferenceTable* table = ExternalReferenceTable::instance(isolate);
+  for (int i = 0; i < table->size(); i++) {
+    if (table->address(i) == address) return i;
+  }
+  return -1;
+}
+
+bool SerializeCodeTarget(Isolate* isolate, FixedArray* code_table,
+                         RelocInfo* rinfo, CodeWriter* writer) {
+  Code* target = Code::GetCodeFromTargetAddress(rinfo->target_address());
+  int index = FindFunctionIndex(code_table, target);
+  if (index >= 0) {
+    writer->u8(kFunctionCodeRef);
+    writer->u32(index);
+    return true;
+  }
+  if (target->kind() == Code::STUB) {
+    writer->u8(kStubCodeRef);
+    writer->u32(target->stub_key());
+    return true;
+  }
+  index = FindBuiltinIndex(isolate, target);
+  if (index >= 0) {
+    writer->u8(kBuiltinCodeRef);
+    writer->u32(index);
+    return true;
+  }
+  return false;
+}
+
+bool SerializeObject(Isolate* isolate, ModuleEnv* module_env, RelocInfo* rinfo,
+                     CodeWriter* writer) {
+  Object* object = rinfo->target_object();
+  if (!module_env->function_table.is_null() &&
+      object == *module_env->function_table) {
+    writer->u8(kFunctionTableRef);
+    return true;
+  }
+  if (object == *module_env->context) {
+    writer->u8(kNativeContextRef);
+    return true;
+  }
+  int index = FindRootIndex(isolate->heap(), object);
+  if (index >= 0) {
+    writer->u8(kRootRef);
+    writer->u32(index);
+    return true;
+  }
+  if (object->IsSeqOneByteString()) {
+    SeqOneByteString* string = SeqOneByteString::cast(object);
+    writer->u8(kStringRef);
+    writer->u32(string->length());
+    writer->bytes(string->GetChars(), string->length());
+    return true;
+  }
+  if (object->IsHeapNumber()) {
+    writer->u8(kNumberRef);
+    writer->u64(bit_cast<uint64_t>(HeapNumber::cast(object)->value()));
+    return true;
+  }
+  return false;
+}
+
+// The compiler embeds the start of the memory and the start of the globals
+// area as external references of their own, and adds offsets to them in
+// code, so references to both are recognized by their address. Neither
+// overlaps the entries of the external reference table. References to the
+// instance contexts are not serialized.
+bool SerializeExternalReference(Isolate* isolate, ModuleEnv* module_env,
+                                size_t globals_size, RelocInfo* rinfo,
+                                CodeWriter* writer) {
+  Address address = rinfo->target_external_reference();
+  uintptr_t value = reinterpret_cast<uintptr_t>(address);
+  if (globals_size > 0 && value == module_env->globals_area) {
+    writer->u8(kGlobalsRef);
+    return true;
+  }
+  if (value == module_env->mem_start) {
+    writer->u8(kMemoryRef);
+    return true;
+  }
+  int index = FindExternalReferenceIndex(isolate, address);
+  if (index < 0) return false;
+  writer->u8(kExternalRef);
+  writer->u32(index);
+  return true;
+}
+
+bool SerializeCode(Isolate* isolate, ModuleEnv* module_env,
+                   size_t globals_size, FixedArray* code_table, Code* code,
+                   CodeWriter* writer) {
+  // Exception handlers, deoptimization data and embedded constant pools are
+  // not generated for wasm functions, and not supported here.
+  if (code->kind() != Code::WASM_FUNCTION) return false;
+  if (code->handler_table()->length() > 0) return false;
+  if (code->deoptimization_data()->length() > 0) return false;
+  if (code->constant_pool_offset() != code->instruction_size()) return false;
+
+  writer->u32(code->flags());
+  writer->u8(code->is_crankshafted());
+  writer->u8(code->is_turbofanned());
+  if (code->is_crankshafted()) {
+    writer->u32(code->stack_slots());
+    writer->u32(code->safepoint_table_offset());
+  }
+  writer->u32(code->instruction_size());
+  writer->bytes(code->instruction_start(), code->instruction_size());
+  ByteArray* reloc_info = code->relocation_info();
+  writer->u32(reloc_info->length());
+  writer->bytes(reloc_info->GetDataStartAddress(), reloc_info->length());
+
+  // The references follow in the order of their relocation entries.
+  for (RelocIterator it(code); !it.done(); it.next()) {
+    RelocInfo* rinfo = it.rinfo();
+    RelocInfo::Mode mode = rinfo->rmode();
+    bool ok;
+    if (RelocInfo::IsCodeTarget(mode)) {
+      ok = SerializeCodeTarget(isolate, code_table, rinfo, writer);
+    } else if (mode == RelocInfo::EMBEDDED_OBJECT) {
+      ok = SerializeObject(isolate, module_env, rinfo, writer);
+    } else if (mode == RelocInfo::EXTERNAL_REFERENCE) {
+      ok = SerializeExternalReference(isolate, module_env, globals_size, rinfo,
+                                      writer);
+    } else if (mode == RelocInfo::INTERNAL_REFERENCE) {
+      writer->u8(kInternalRef);
+      writer->u32(static_cast<uint32_t>(Memory::Address_at(rinfo->pc()) -
+                                        code->instruction_start()));
+      ok = true;
+    } else {
+      ok = IsInformational(mode);
+    }
+    if (!ok) return false;
+  }
+  return true;
+}
+
+// A reference read from the serialized data, resolved before patching.
+struct Reference {
+  ReferenceKind kind;
+  uint64_t value;         // index, key, offset or bits of the reference.
+  const byte* chars;      // characters of a string reference.
+  Handle<Object> object;  // resolved object, for code and object references.
+  Address address;        // resolved address, for address references.
+};
+
+// A function read from the serialized data.
+struct SerializedFunction {
+  int index;
+  Code::Flags flags;
+  bool is_crankshafted;
+  bool is_turbofanned;
+  uint32_t stack_slots;
+  uint32_t safepoint_table_offset;
+  uint32_t instruction_size;
+  const byte* instructions;
+  uint32_t reloc_size;
+  const byte* reloc_info;
+  std::vector<Reference> references;
+};
+
+// Reads a function and its references, checking that the references match
+// the relocation entries.
+bool ReadFunction(CodeReader* reader, SerializedFunction* function) {
+  function->flags = static_cast<Code::Flags>(reader->u32("flags"));
+  function->is_crankshafted = reader->u8("crankshafted") != 0;
+  function->is_turbofanned = reader->u8("turbofanned") != 0;
+  if (function->is_crankshafted) {
+    function->stack_slots = reader->u32("stack slots");
+    function->safepoint_table_offset = reader->u32("safepoint table offset");
+  }
+  function->instruction_size = reader->u32("instruction size");
+  function->instructions = reader->bytes(function->instruction_size);
+  function->reloc_size = reader->u32("reloc size");
+  function->reloc_info = reader->bytes(function->reloc_size);
+  if (reader->failed()) return false;
+  if (Code::ExtractKindFromFlags(function->flags) != Code::WASM_FUNCTION) {
+    return false;
+  }
+
+  // Iterate the relocation entries as they will be found in the code.
+  CodeDesc desc;
+  desc.buffer = const_cast<byte*>(function->reloc_info);
+  desc.buffer_size = static_cast<int>(function->reloc_size);
+  desc.instr_size = 0;
+  desc.reloc_size = static_cast<int>(function->reloc_size);
+  desc.constant_pool_size = 0;
+  desc.origin = nullptr;
+  for (RelocIterator it(desc, ~0); !it.done(); it.next()) {
+    RelocInfo::Mode mode = it.rinfo()->rmode();
+    if ((RelocInfo::ModeMask(mode) & kRelinkedModeMask) == 0) {
+      if (!IsInformational(mode)) return false;
+      continue;
+    }
+    size_t offset = it.rinfo()->pc() - desc.buffer;
+    size_t size = RelocInfo::IsCodeTarget(mode) ? kIntSize : kPointerSize;
+    if (offset + size > function->instruction_size) return false;
+
+    Reference reference;
+    reference.kind = static_cast<ReferenceKind>(reader->u8("reference kind"));
+    reference.value = 0;
+    reference.chars = nullptr;
+    reference.address = nullptr;
+    if (!MatchesMode(reference.kind, mode)) return false;
+    switch (reference.kind) {
+      case kFunctionTableRef:
+      case kNativeContextRef:
+      case kMemoryRef:
+      case kGlobalsRef:
+        break;
+      case kNumberRef:
+        reference.value = reader->u64("reference");
+        break;
+      case kStringRef:
+        reference.value = reader->u32("string length");
+        reference.chars = reader->bytes(static_cast<uint32_t>(reference.value));
+        break;
+      default:
+        reference.value = reader->u32("reference");
+        break;
+    }
+    if (reader->failed()) return false;
+    function->references.push_back(reference);
+  }
+  return true;
+}
+
+// Resolves the objects and addresses of the references of a function, which
+// may allocate.
+bool ResolveReferences(Isolate* isolate, ModuleEnv* module_env,
+                       Handle<FixedArray> code_table,
+                       std::vector<Handle<Code>>* codes,
+                       SerializedFunction* function) {
+  Factory* factory = isolate->factory();
+  for (Reference& reference : function->references) {
+    uint64_t value = reference.value;
+    switch (reference.kind) {
+      case kFunctionCodeRef: {
+        if (value >= codes->size()) return false;
+        if (!codes->at(value).is_null()) {
+          reference.object = codes->at(value);
+        } else if (code_table->get(static_cast<int>(value))->IsCode()) {
+          reference.object =
+              handle(code_table->get(static_cast<int>(value)), isolate);
+        } else {
+          return false;
+        }
+        break;
+      }
+      case kStubCodeRef: {
+        Handle<Code> code;
+        if (!CodeStub::GetCode(isolate, static_cast<uint32_t>(value))
+                 .ToHandle(&code)) {
+          return false;
+        }
+        reference.object = code;
+        break;
+      }
+      case kBuiltinCodeRef:
+        if (value >= Builtins::builtin_count) return false;
+        reference.object = handle(
+            isolate->builtins()->builtin(static_cast<Builtins::Name>(value)),
+            isolate);
+        break;
+      case kFunctionTableRef:
+        if (module_env->function_table.is_null()) return false;
+        reference.object = module_env->function_table;
+        break;
+      case kNativeContextRef:
+        reference.object = module_env->context;
+        break;
+      case kRootRef:
+        if (value >= Heap::kStrongRootListLength) return false;
+        reference.object = handle(
+            isolate->heap()->root(static_cast<Heap::RootListIndex>(value)),
+            isolate);
+        break;
+      case kStringRef:
+        reference.object =
+            factory
+                ->NewStringFromOneByte(
+                    Vector<const uint8_t>(reference.chars,
+                                          static_cast<int>(value)),
+                    TENURED)
+                .ToHandleChecked();
+        break;
+      case kNumberRef:
+        reference.object =
+            factory->NewHeapNumber(bit_cast<double>(value), IMMUTABLE, TENURED);
+        break;
+      case kMemoryRef:
+        reference.address = reinterpret_cast<Address>(module_env->mem_start);
+        break;
+      case kGlobalsRef:
+        reference.address =
+            reinterpret_cast<Address>(module_env->globals_area);
+        break;
+      case kExternalRef: {
+        ExternalReferenceTable* table =
+            ExternalReferenceTable::instance(isolate);
+        if (value >= static_cast<uint64_t>(table->size())) return false;
+        reference.address = table->address(static_cast<int>(value));
+        break;
+      }
+      case kInternalRef:
+        if (value >= function->instruction_size) return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+// Installs the relocation information into the code of a function and
+// patches all references. Must not fail, since the code would otherwise be
+// left with relocation entries that do not point to valid objects.
+void RelinkFunction(Isolate* isolate, Handle<Code> code,
+                    Handle<ByteArray> reloc_info,
+                    SerializedFunction* function) {
+  DisallowHeapAllocation no_gc;
+  code->set_relocation_info(*reloc_info);
+  size_t next = 0;
+  for (RelocIterator it(*code, kRelinkedModeMask); !it.done(); it.next()) {
+    RelocInfo* rinfo = it.rinfo();
+    Reference& reference = function->references[next++];
+    switch (reference.kind) {
+      case kFunctionCodeRef:
+      case kStubCodeRef:
+      case kBuiltinCodeRef:
+        rinfo->set_target_address(
+            Code::cast(*reference.object)->instruction_start(),
+            UPDATE_WRITE_BARRIER, SKIP_ICACHE_FLUSH);
+        break;
+      case kInternalRef:
+        Memory::Address_at(rinfo->pc()) =
+            code->instruction_start() + reference.value;
+        break;
+      case kMemoryRef:
+      case kGlobalsRef:
+      case kExternalRef:
+        Memory::Address_at(rinfo->pc()) = reference.address;
+        break;
+      default:
+        rinfo->set_target_object(*reference.object, UPDATE_WRITE_BARRIER,
+                                 SKIP_ICACHE_FLUSH);
+        break;
+    }
+  }
+  CHECK_EQ(function->references.size(), next);
+  Assembler::FlushICache(isolate, code->instruction_start(),
+                         code->instruction_size());
+}
+}  // namespace
+
+uint64_t HashModuleBytes(const byte* start, const byte* end) {
+  // 64-bit FNV-1a.
+  uint64_t hash = V8_UINT64_C(0xcbf29ce484222325);
+  for (const byte* pc = start; pc < end; pc++) {
+    hash = (hash ^ *pc) * V8_UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+bool SerializeWasmCode(Isolate* isolate, ModuleEnv* module_env,
+                       size_t globals_size, Handle<FixedArray> code_table,
+                       std::vector<byte>* data) {
+#if V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
+  WasmModule* module = module_env->module;
+  DisallowHeapAllocation no_gc;
+  std::vector<byte> buffer;
+  CodeWriter writer(&buffer);
+  WriteHeader(isolate, module_env, globals_size, &writer);
+  int index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external) {
+      Object* code = code_table->get(index);
+      if (!code->IsCode() ||
+          !SerializeCode(isolate, module_env, globals_size, *code_table,
+                         Code::cast(code), &writer)) {
+        return false;
+      }
+    }
+    index++;
+  }
+  data->swap(buffer);
+  return true;
+#else
+  // Relinking patches addresses in place, which is only implemented for
+  // architectures that embed them as plain pointers.
+  return false;
+#endif
+}
+
+bool DeserializeWasmCode(Isolate* isolate, ModuleEnv* module_env,
+                         size_t globals_size, Handle<FixedArray> code_table,
+                         Vector<const byte> data,
+                         std::vector<Handle<Code>>* results) {
+#if V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
+  WasmModule* module = module_env->module;
+  CodeReader reader(data.start(), data.start() + data.length());
+  if (!CheckHeader(isolate, module_env, globals_size, &reader)) return false;
+
+  // Read and check all functions before creating any code.
+  std::vector<SerializedFunction> functions;
+  int index = 0;
+  for (const WasmFunction& func : *module->functions) {
+    if (!func.external) {
+      functions.push_back(SerializedFunction());
+      functions.back().index = index;
+      if (!ReadFunction(&reader, &functions.back())) return false;
+    }
+    index++;
+  }
+  if (!reader.at_end()) return false;
+
+  // Create the code objects without relocation information, so that the
+  // stale references in their instructions are not visited by the GC.
+  Factory* factory = isolate->factory();
+  std::vector<Handle<Code>> codes(module->functions->size());
+  for (SerializedFunction& function : functions) {
+    CodeDesc desc;
+    desc.buffer = const_cast<byte*>(function.instructions);
+    desc.buffer_size = static_cast<int>(function.instruction_size);
+    desc.instr_size = static_cast<int>(function.instruction_size);
+    desc.reloc_size = 0;
+    desc.constant_pool_size = 0;
+    desc.origin = nullptr;
+    Handle<Code> self(nullptr, isolate);
+    Handle<Code> code = factory->NewCode(desc, function.flags, self, false,
+                                         function.is_crankshafted);
+    code->set_is_turbofanned(function.is_turbofanned);
+    if (function.is_crankshafted) {
+      code->set_stack_slots(function.stack_slots);
+      code->set_safepoint_table_offset(function.safepoint_table_offset);
+    }
+    codes[function.index] = code;
+  }
+
+  // Resolve all references, then relink the code.
+  std::vector<Handle<ByteArray>> reloc_infos;
+  for (SerializedFunction& function : functions) {
+    if (!ResolveReferences(isolate, module_env, code_table, &codes,
+                           &function)) {
+      return false;
+    }
+    Handle<ByteArray> reloc_info =
+        factory->NewByteArray(static_cast<int>(function.reloc_size), TENURED);
+    reloc_info->copy_in(0, function.reloc_info, function.reloc_size);
+    reloc_infos.push_back(reloc_info);
+  }
+  for (size_t i = 0; i < functions.size(); i++) {
+    RelinkFunction(isolate, codes[functions[i].index], reloc_infos[i],
+                   &functions[i]);
+  }
+  results->swap(codes);
+  return true;
+#else
+  return false;
+#endif
+}
+}
+}
+}  // namespace v8::internal::wasm
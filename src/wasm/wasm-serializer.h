@@ -0,0 +1,46 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V8_WASM_SERIALIZER_H_
+#define V8_WASM_SERIALIZER_H_
+
+#include "src/handles.h"
+#include "src/vector.h"
+
+#include "src/wasm/wasm-module.h"
+
+namespace v8 {
+namespace internal {
+namespace wasm {
+
+// Computes the hash of the bytes of a module, under which embedders can cache
+// the serialized code of the module.
+uint64_t HashModuleBytes(const byte* start, const byte* end);
+
+// Serializes the code of the functions of a module that are not external, as
+// found in {code_table}, into {data}. References from the code to the memory,
+// the globals area and the function table of {module_env}, to other
+// functions, and to stubs, builtins, roots and external references are
+// recorded so that the code can be relinked into another instance, even in
+// another process running the same build. Returns false if the code cannot be
+// serialized.
+bool SerializeWasmCode(Isolate* isolate, ModuleEnv* module_env,
+                       size_t globals_size, Handle<FixedArray> code_table,
+                       std::vector<byte>* data);
+
+// Deserializes the code of the functions of a module that are not external
+// from {data} into {results}, relinking it against the memory, the globals
+// area and the function table of {module_env}, and against the code of the
+// external functions found in {code_table}. Returns false, without touching
+// {results}, if {data} was not serialized for this module, memory size, build
+// and CPU.
+bool DeserializeWasmCode(Isolate* isolate, ModuleEnv* module_env,
+                         size_t globals_size, Handle<FixedArray> code_table,
+                         Vector<const byte> data,
+                         std::vector<Handle<Code>>* results);
+}
+}
+}  // namespace v8::internal::wasm
+
+#endif  // V8_WASM_SERIALIZER_H_
@@ -0,0 +1,174 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "src/v8.h"
+
+#include "src/base/atomicops.h"
+#include "src/base/platform/mutex.h"
+#include "src/objects.h"
+#include "src/v8memory.h"
+
+#include "src/wasm/wasm-trap-handler.h"
+
+#if V8_OS_LINUX && V8_TARGET_ARCH_X64 && !USE_SIMULATOR
+#define V8_WASM_TRAP_HANDLER 1
+#include <signal.h>
+#include <ucontext.h>
+#endif
+
+namespace v8 {
+namespace internal {
+namespace wasm {
+
+#if V8_WASM_TRAP_HANDLER
+namespace {
+// A registered reservation. The signal handler reads the entries without
+// locking, so {start} is published after the other fields.
+struct GuardRegion {
+  base::AtomicWord start;
+  size_t size;
+  Object** landing;
+  Object** code_table;
+};
+
+const int kMaxGuardRegions = 256;
+GuardRegion guard_regions[kMaxGuardRegions];
+base::LazyMutex guard_regions_mutex = LAZY_MUTEX_INITIALIZER;
+
+bool guard_pages_enabled = false;
+bool trap_handler_installed = false;
+struct sigaction previous_action;
+
+// Checks whether {pc} is in the instructions of one of the wasm functions in
+// {code_table}. Code objects can move, but not while wasm code runs, so the
+// table is read rather than a copy of the ranges of its code.
+bool IsProtectedCode(Address pc, FixedArray* code_table) {
+  for (int i = 0; i < code_table->length(); i++) {
+    Object* entry = code_table->get(i);
+    if (!entry->IsCode()) continue;
+    Code* code = Code::cast(entry);
+    if (code->kind() == Code::WASM_FUNCTION &&
+        pc >= code->instruction_start() && pc < code->instruction_end()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HandleSignal(int signum, siginfo_t* info, void* context) {
+  Address fault = reinterpret_cast<Address>(info->si_addr);
+  greg_t* regs = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+  Address pc = reinterpret_cast<Address>(regs[REG_RIP]);
+  for (int i = 0; i < kMaxGuardRegions; i++) {
+    Address start = reinterpret_cast<Address>(
+        base::Acquire_Load(&guard_regions[i].start));
+    if (start == nullptr || fault < start ||
+        fault >= start + guard_regions[i].size) {
+      continue;
+    }
+    // Only faults of the functions of the instance that owns the reservation
+    // are traps; they fault within the frame of the function. The handles
+    // are weak, so they may have been cleared before the reservation is
+    // unregistered.
+    Object** code_table = guard_regions[i].code_table;
+    Object** landing = guard_regions[i].landing;
+    if (code_table == nullptr || !(*code_table)->IsFixedArray() ||
+        landing == nullptr || !(*landing)->IsCode() ||
+        !IsProtectedCode(pc, FixedArray::cast(*code_table))) {
+      break;
+    }
+    // Discard the frame of the function and continue in the stub, which then
+    // appears to be called by the caller of the function.
+    Address fp = reinterpret_cast<Address>(regs[REG_RBP]);
+    Code* stub = Code::cast(*landing);
+    regs[REG_RSP] = reinterpret_cast<greg_t>(fp + kPointerSize);
+    regs[REG_RBP] = reinterpret_cast<greg_t>(Memory::Address_at(fp));
+    regs[REG_RIP] = reinterpret_cast<greg_t>(stub->instruction_start());
+    return;
+  }
+
+  // Not a fault of wasm code on a guard page. Pass it on to the previous
+  // handler, which stays chained behind this one.
+  if (previous_action.sa_flags & SA_SIGINFO) {
+    previous_action.sa_sigaction(signum, info, context);
+  } else if (previous_action.sa_handler == SIG_IGN && info->si_code <= 0) {
+    // A signal sent by a process, rather than raised by a fault, which the
+    // previous disposition ignores.
+  } else if (previous_action.sa_handler == SIG_DFL ||
+             previous_action.sa_handler == SIG_IGN) {
+    // Faults cannot be ignored, so take the default action: restore it and
+    // raise the signal again, which is delivered once this handler returns.
+    signal(signum, SIG_DFL);
+    raise(signum);
+  } else {
+    previous_action.sa_handler(signum);
+  }
+}
+}  // namespace
+
+void SetGuardPagesEnabled(bool enabled) {
+  base::LockGuard<base::Mutex> guard(guard_regions_mutex.Pointer());
+  guard_pages_enabled = enabled;
+}
+
+bool EnableTrapHandler() {
+  base::LockGuard<base::Mutex> guard(guard_regions_mutex.Pointer());
+  if (!guard_pages_enabled) return false;
+  if (trap_handler_installed) return true;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = HandleSignal;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGSEGV, &action, &previous_action) != 0) return false;
+  trap_handler_installed = true;
+  return true;
+}
+
+bool RegisterGuardRegion(void* start, size_t size, Object** landing,
+                         Object** code_table) {
+  base::LockGuard<base::Mutex> guard(guard_regions_mutex.Pointer());
+  for (int i = 0; i < kMaxGuardRegions; i++) {
+    GuardRegion* region = &guard_regions[i];
+    if (base::NoBarrier_Load(&region->start) != 0) continue;
+    region->size = size;
+    region->landing = landing;
+    region->code_table = code_table;
+    base::Release_Store(&region->start,
+                        reinterpret_cast<base::AtomicWord>(start));
+    return true;
+  }
+  return false;
+}
+
+void UnregisterGuardRegion(void* start) {
+  base::LockGuard<base::Mutex> guard(guard_regions_mutex.Pointer());
+  for (int i = 0; i < kMaxGuardRegions; i++) {
+    GuardRegion* region = &guard_regions[i];
+    if (base::NoBarrier_Load(&region->start) ==
+        reinterpret_cast<base::AtomicWord>(start)) {
+      base::Release_Store(&region->start, 0);
+      return;
+    }
+  }
+  UNREACHABLE();
+}
+
+#else
+
+void SetGuardPagesEnabled(bool enabled) {}
+
+bool EnableTrapHandler() { return false; }
+
+bool RegisterGuardRegion(void* start, size_t size, Object** landing,
+                         Object** code_table) {
+  return false;
+}
+
+void UnregisterGuardRegion(void* start) { UNREACHABLE(); }
+
+#endif  // V8_WASM_TRAP_HANDLER
+}
+}
+}  // namespace v8::internal::wasm
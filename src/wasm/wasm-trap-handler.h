@@ -0,0 +1,51 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef V8_WASM_TRAP_HANDLER_H_
+#define V8_WASM_TRAP_HANDLER_H_
+
+#include "src/globals.h"
+
+namespace v8 {
+namespace internal {
+
+class Object;
+
+namespace wasm {
+
+// The size of the address space reserved for a memory protected by guard
+// pages: any 32-bit index plus any 32-bit offset plus the size of the largest
+// access, rounded up to a generous page size.
+const size_t kGuardRegionSize =
+    (static_cast<size_t>(1) << 33) + (static_cast<size_t>(1) << 16);
+
+// Enables or disables guard pages for the instances created afterwards. They
+// are disabled by default, as the signal handler for SIGSEGV is process-wide
+// and has to cooperate with the handlers of the embedder.
+void SetGuardPagesEnabled(bool enabled);
+
+// Installs the signal handler that turns faults on guard pages into traps.
+// Returns false if guard pages are disabled or not supported on this
+// platform, in which case the code has to check the bounds of memory accesses
+// explicitly.
+bool EnableTrapHandler();
+
+// Registers the reservation of a memory protected by guard pages, so that
+// faults in it from the wasm functions in the code table found in
+// {code_table} continue in the code found in {landing}, the location of the
+// handle of a stub that throws the out of bounds trap. The faulting function
+// is discarded, as if it had tail-called the stub. Other faults are passed on
+// to the previous signal handler. Returns false if no more reservations can
+// be registered. The handles may be weak; faults are passed on once they are
+// cleared.
+bool RegisterGuardRegion(void* start, size_t size, Object** landing,
+                         Object** code_table);
+
+// Unregisters the reservation at {start}, which must have been registered.
+void UnregisterGuardRegion(void* start);
+}
+}
+}  // namespace v8::internal::wasm
+
+#endif  // V8_WASM_TRAP_HANDLER_H_
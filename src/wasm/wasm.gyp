@@ -24,16 +24,23 @@
 	  'module-decoder.h',
           'wasm-compiler.h',
           'wasm-compiler.cc',
+          'wasm-instance.cc',
           'wasm-js.cc',
           'wasm-js.h',
           'wasm-linkage.cc',
           'wasm-macro-gen.h',
+          'wasm-module-file.cc',
+          'wasm-module-file.h',
           'wasm-module.cc',
           'wasm-module.h',
           'wasm-opcodes.cc',
           'wasm-opcodes.h',
           'wasm-result.cc',
           'wasm-result.h',
+          'wasm-serializer.cc',
+          'wasm-serializer.h',
+          'wasm-trap-handler.cc',
+          'wasm-trap-handler.h',
         ],
       },
     },
@@ -2,13 +2,21 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cmath>
 #include <stdlib.h>
 #include <string.h>
 
+#include "include/libplatform/libplatform.h"
+#include "include/v8-wasm.h"
+#include "src/api.h"
 #include "src/wasm/encoder.h"
+#include "src/wasm/module-decoder.h"
+#include "src/wasm/wasm-compiler.h"
 #include "src/wasm/wasm-macro-gen.h"
 #include "src/wasm/wasm-module.h"
 #include "src/wasm/wasm-opcodes.h"
+#include "src/wasm/wasm-serializer.h"
+#include "src/wasm/wasm-trap-handler.h"
 
 #include "test/cctest/cctest.h"
 
@@ -25,6 +33,162 @@ void TestModule(WasmModuleIndex* module, int32_t expected_result) {
       CompileAndRunWasmModule(isolate, module->Begin(), module->End());
   CHECK_EQ(expected_result, result);
 }
+
+
+// Enters a new context of the isolate shared by the tests.
+class ContextScope {
+ public:
+  ContextScope()
+      : isolate_(CcTest::InitIsolateOnce()),
+        handle_scope_(isolate_),
+        context_(v8::Context::New(reinterpret_cast<v8::Isolate*>(isolate_))),
+        context_scope_(context_) {}
+
+  Isolate* isolate() const { return isolate_; }
+  v8::Local<v8::Context> context() const { return context_; }
+
+ private:
+  Isolate* isolate_;
+  HandleScope handle_scope_;
+  v8::Local<v8::Context> context_;
+  v8::Context::Scope context_scope_;
+};
+
+
+// A module decoded from bytes that have to be valid. The module is deleted
+// with this object, and its instances live in the current handle scope.
+class DecodedModule {
+ public:
+  DecodedModule(Isolate* isolate, const byte* start, const byte* end)
+      : isolate_(isolate) {
+    ModuleResult result =
+        DecodeWasmModule(isolate, &zone_, start, end, false, false);
+    CHECK(result.ok());
+    module_ = result.val;
+  }
+  ~DecodedModule() { delete module_; }
+
+  WasmModule* module() const { return module_; }
+
+  // Instantiates the module with its own code, which has to succeed.
+  Handle<JSObject> Instantiate(
+      WasmCompilationMode mode = kEagerCompilation,
+      Handle<JSObject> ffi = Handle<JSObject>::null()) {
+    return module_->Instantiate(isolate_, ffi, Handle<JSArrayBuffer>::null(),
+                                mode)
+        .ToHandleChecked();
+  }
+
+  // Instantiates the module with the code of {compiled_module}, which has to
+  // succeed.
+  Handle<JSObject> InstantiateShared(Handle<JSObject> compiled_module) {
+    return module_->Instantiate(isolate_, Handle<JSObject>::null(),
+                                Handle<JSArrayBuffer>::null(),
+                                compiled_module)
+        .ToHandleChecked();
+  }
+
+ private:
+  Isolate* isolate_;
+  Zone zone_;
+  WasmModule* module_;
+};
+
+
+// Calls the exported function of an instance.
+int32_t CallMain(Isolate* isolate, Handle<JSObject> instance) {
+  // Exported functions without a name are installed as "<?>".
+  Handle<Object> main =
+      Object::GetProperty(instance,
+                          isolate->factory()->InternalizeUtf8String("<?>"))
+          .ToHandleChecked();
+  CHECK(main->IsJSFunction());
+  Handle<Object> retval =
+      Execution::Call(isolate, main, instance, 0, nullptr).ToHandleChecked();
+  return static_cast<int32_t>(retval->Number());
+}
+
+
+// Builds a module that exports a function "main" returning {value}.
+WasmModuleIndex* BuildMainModule(Zone* zone, int8_t value) {
+  WasmModuleBuilder* builder = new(zone) WasmModuleBuilder(zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("main");
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_I8(value)};
+  f->EmitCode(code, sizeof(code));
+  return builder->Build(zone)->WriteTo(zone);
+}
+
+
+// Instantiates the module with the given compilation mode and calls its
+// exported function several times, so that code compiled after
+// instantiation gets to run.
+void TestModuleWithMode(WasmModuleIndex* module, WasmCompilationMode mode,
+                        int32_t expected_result) {
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  Handle<JSObject> instance =
+      DecodedModule(isolate, module->Begin(), module->End()).Instantiate(mode);
+
+  for (int i = 0; i < 4; i++) {
+    CHECK_EQ(expected_result, CallMain(isolate, instance));
+  }
+}
+
+
+// Instantiates the module eagerly, deserializing its code from
+// {serialized_code} if given and serializing it into {serialized_data} if
+// given, and calls its exported function.
+int32_t InstantiateAndRun(Isolate* isolate, WasmModuleIndex* module,
+                          Vector<const byte> serialized_code,
+                          std::vector<byte>* serialized_data) {
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  Handle<JSObject> instance =
+      decoded.module()
+          ->Instantiate(isolate, Handle<JSObject>::null(),
+                        Handle<JSArrayBuffer>::null(), kEagerCompilation,
+                        serialized_code)
+          .ToHandleChecked();
+  if (serialized_data) {
+    CHECK(decoded.module()->Serialize(isolate, instance, serialized_data));
+  }
+  return CallMain(isolate, instance);
+}
+
+
+#if V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
+// Deserializes the code of the module, which has a single int32 global, from
+// {serialized_code} for fresh memory and globals. Returns whether the data was
+// accepted.
+bool DeserializeCode(Isolate* isolate, WasmModuleIndex* module,
+                     Vector<const byte> serialized_code) {
+  DecodedModule decoded_module(isolate, module->Begin(), module->End());
+  WasmModule* decoded = decoded_module.module();
+  std::vector<byte> memory(static_cast<size_t>(1)
+                           << decoded->min_mem_size_log2);
+  int32_t global = 0;
+
+  ModuleEnv module_env;
+  module_env.module = decoded;
+  module_env.mem_start = reinterpret_cast<uintptr_t>(memory.data());
+  module_env.mem_end = module_env.mem_start + memory.size();
+  module_env.globals_area = reinterpret_cast<uintptr_t>(&global);
+  module_env.linker = nullptr;
+  module_env.function_code = nullptr;
+  module_env.tier_up_budgets = nullptr;
+  module_env.context = isolate->native_context();
+  module_env.asm_js = false;
+  Handle<FixedArray> code_table = isolate->factory()->NewFixedArray(
+      static_cast<int>(decoded->functions->size()));
+  std::vector<Handle<Code>> results;
+  bool deserialized =
+      DeserializeWasmCode(isolate, &module_env, sizeof(global), code_table,
+                          serialized_code, &results);
+  return deserialized;
+}
+#endif  // V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
 }  // namespace
 
 
@@ -191,3 +355,1153 @@ TEST(Run_WasmModule_Global) {
   WasmModuleWriter* writer = builder->Build(&zone);
   TestModule(writer->WriteTo(&zone), 97);
 }
+
+
+TEST(Run_WasmModule_CallChain) {
+  // Enough functions to spread compilation over several background tasks.
+  static const int kNumFunctions = 48;
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  byte code1[] = {WASM_I8(1)};
+  f->EmitCode(code1, sizeof(code1));
+  for (int i = 1; i < kNumFunctions; i++) {
+    uint16_t next_index = builder->AddFunction();
+    f = builder->FunctionAt(next_index);
+    f->ReturnType(kAstI32);
+    if (i == kNumFunctions - 1) f->Exported(1);
+    byte code2[] = {
+        WASM_I32_ADD(WASM_CALL_FUNCTION0(f_index), WASM_I8(1))};
+    f->EmitCode(code2, sizeof(code2));
+    f_index = next_index;
+  }
+  WasmModuleWriter* writer = builder->Build(&zone);
+  TestModule(writer->WriteTo(&zone), kNumFunctions);
+}
+
+
+TEST(Run_WasmModule_LazyCallChain) {
+  static const int kNumFunctions = 8;
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  byte code1[] = {WASM_I8(1)};
+  f->EmitCode(code1, sizeof(code1));
+  for (int i = 1; i < kNumFunctions; i++) {
+    uint16_t next_index = builder->AddFunction();
+    f = builder->FunctionAt(next_index);
+    f->ReturnType(kAstI32);
+    if (i == kNumFunctions - 1) f->Exported(1);
+    byte code2[] = {
+        WASM_I32_ADD(WASM_CALL_FUNCTION0(f_index), WASM_I8(1))};
+    f->EmitCode(code2, sizeof(code2));
+    f_index = next_index;
+  }
+  WasmModuleWriter* writer = builder->Build(&zone);
+  TestModuleWithMode(writer->WriteTo(&zone), kLazyCompilation, kNumFunctions);
+}
+
+
+TEST(Run_WasmModule_TieredLoop) {
+  // Enough iterations to exhaust the tier-up budget several times.
+  static const int kNumIterations = 5000;
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint32_t global = builder->AddGlobal(kMachInt32, 0);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_BLOCK(
+      3, WASM_STORE_GLOBAL(global, WASM_ZERO),
+      WASM_WHILE(
+          WASM_I32_LTS(WASM_LOAD_GLOBAL(global), WASM_I32(kNumIterations)),
+          WASM_STORE_GLOBAL(
+              global, WASM_I32_ADD(WASM_LOAD_GLOBAL(global), WASM_I8(1)))),
+      WASM_LOAD_GLOBAL(global))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  Handle<JSObject> instance =
+      DecodedModule(isolate, module->Begin(), module->End())
+          .Instantiate(kTieredCompilation);
+
+  // The loop exhausts the tier-up budget, which starts the recompilation on
+  // a background thread. Its code replaces the quick tier code in the code
+  // table once it has been installed.
+  Handle<Code> quick_code = GetFunctionCodeForTesting(instance, f_index);
+  CHECK_EQ(kNumIterations, CallMain(isolate, instance));
+  FinishTierUpForTesting(instance);
+  CHECK(*GetFunctionCodeForTesting(instance, f_index) != *quick_code);
+  CHECK_EQ(kNumIterations, CallMain(isolate, instance));
+}
+
+
+#if V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
+TEST(Run_WasmModule_SerializeCode) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint32_t global = builder->AddGlobal(kMachInt32, 0);
+  uint16_t f1_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f1_index);
+  f->ReturnType(kAstI32);
+  byte code1[] = {WASM_I32_ADD(WASM_LOAD_MEM(kMachInt32, WASM_I8(8)),
+                               WASM_LOAD_GLOBAL(global))};
+  f->EmitCode(code1, sizeof(code1));
+  uint16_t f2_index = builder->AddFunction();
+  f = builder->FunctionAt(f2_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code2[] = {WASM_STORE_MEM(kMachInt32, WASM_I8(8), WASM_I32(11)),
+                  WASM_STORE_GLOBAL(global, WASM_I32(31)),
+                  WASM_RETURN(WASM_CALL_FUNCTION0(f1_index))};
+  f->EmitCode(code2, sizeof(code2));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  std::vector<byte> data;
+  CHECK_EQ(42, InstantiateAndRun(isolate, module, Vector<const byte>(), &data));
+  CHECK(!data.empty());
+
+  // The code is relinked against the memory and globals of a new instance.
+  Vector<const byte> serialized(data.data(), static_cast<int>(data.size()));
+  CHECK(DeserializeCode(isolate, module, serialized));
+  CHECK_EQ(42, InstantiateAndRun(isolate, module, serialized, nullptr));
+
+  // Truncated data is rejected and the module compiled instead.
+  Vector<const byte> truncated =
+      serialized.SubVector(0, serialized.length() / 2);
+  CHECK(!DeserializeCode(isolate, module, truncated));
+  CHECK_EQ(42, InstantiateAndRun(isolate, module, truncated, nullptr));
+}
+#endif  // V8_TARGET_ARCH_X64 || V8_TARGET_ARCH_IA32
+
+
+TEST(Run_WasmModule_SharedCode) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint32_t global = builder->AddGlobal(kMachInt32, 0);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_BLOCK(
+      3, WASM_STORE_MEM(kMachInt32, WASM_I8(8),
+                        WASM_I32_ADD(WASM_LOAD_MEM(kMachInt32, WASM_I8(8)),
+                                     WASM_I8(1))),
+      WASM_STORE_GLOBAL(global,
+                        WASM_I32_ADD(WASM_LOAD_GLOBAL(global), WASM_I8(10))),
+      WASM_I32_ADD(WASM_LOAD_MEM(kMachInt32, WASM_I8(8)),
+                   WASM_LOAD_GLOBAL(global)))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  Handle<JSObject> compiled =
+      decoded.module()->Compile(isolate).ToHandleChecked();
+  Handle<JSObject> first = decoded.InstantiateShared(compiled);
+  Handle<JSObject> second = decoded.InstantiateShared(compiled);
+
+  // Each instance uses its own memory and globals.
+  CHECK_EQ(11, CallMain(isolate, first));
+  CHECK_EQ(22, CallMain(isolate, first));
+  CHECK_EQ(11, CallMain(isolate, second));
+  CHECK_EQ(33, CallMain(isolate, first));
+}
+
+
+TEST(Run_WasmModule_StreamingCompile) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint32_t global = builder->AddGlobal(kMachInt32, 0);
+  // The exported function calls a function that arrives after it, so it is
+  // compiled once the module is complete, unlike its callee.
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code1[] = {WASM_I32_ADD(WASM_CALL_FUNCTION0(f_index + 1), WASM_I8(1))};
+  f->EmitCode(code1, sizeof(code1));
+  f = builder->FunctionAt(builder->AddFunction());
+  f->ReturnType(kAstI32);
+  byte code2[] = {WASM_I32_ADD(WASM_LOAD_GLOBAL(global), WASM_I8(41))};
+  f->EmitCode(code2, sizeof(code2));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+  size_t size = module->End() - module->Begin();
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  size_t chunk_sizes[] = {1, 7, size};
+  for (size_t chunk_size : chunk_sizes) {
+    WasmStreamingCompiler compiler(isolate);
+    for (size_t pos = 0; pos < size; pos += chunk_size) {
+      compiler.AddBytes(module->Begin() + pos, Min(chunk_size, size - pos));
+    }
+    Handle<JSObject> compiled = compiler.Finish().ToHandleChecked();
+    Handle<JSObject> instance =
+        compiler.module()
+            ->Instantiate(isolate, Handle<JSObject>::null(),
+                          Handle<JSArrayBuffer>::null(), compiled)
+            .ToHandleChecked();
+    CHECK_EQ(42, CallMain(isolate, instance));
+  }
+
+  {
+    // A module that ends within a section fails to decode.
+    WasmStreamingCompiler compiler(isolate);
+    CHECK(compiler.AddBytes(module->Begin(), kDeclMemorySize + 2));
+    CHECK(compiler.Finish().is_null());
+    isolate->clear_scheduled_exception();
+  }
+
+  {
+    // An invalid section fails as soon as it arrives, and the bytes after it
+    // are ignored.
+    static const byte kInvalidSection[] = {0x7f};
+    static const size_t kMemoryEnd = kDeclMemorySize + 1;
+    WasmStreamingCompiler compiler(isolate);
+    CHECK(compiler.AddBytes(module->Begin(), kMemoryEnd));
+    CHECK(!compiler.AddBytes(kInvalidSection, sizeof(kInvalidSection)));
+    CHECK(isolate->has_scheduled_exception());
+    isolate->clear_scheduled_exception();
+    CHECK(!compiler.AddBytes(module->Begin() + kMemoryEnd,
+                             size - kMemoryEnd));
+    CHECK(compiler.Finish().is_null());
+    CHECK(!isolate->has_scheduled_exception());
+  }
+}
+
+
+TEST(Run_WasmModule_GrowMemory) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  // Grows the memory by 64k and accesses the memory beyond the old size.
+  byte code[] = {WASM_I32_ADD(
+      WASM_GROW_MEMORY(WASM_I32(65536)),
+      WASM_BLOCK(2, WASM_STORE_MEM(kMachInt32, WASM_I32(65540), WASM_I8(7)),
+                 WASM_LOAD_MEM(kMachInt32, WASM_I32(65540))))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  CHECK_EQ(16, decoded.module()->min_mem_size_log2);
+  decoded.module()->max_mem_size_log2 = 17;
+  Handle<JSObject> compiled =
+      decoded.module()->Compile(isolate).ToHandleChecked();
+  Handle<JSObject> shared = decoded.InstantiateShared(compiled);
+  Handle<JSObject> instance = decoded.Instantiate();
+
+  // The first call grows the memory to its maximum size, so that the second
+  // call fails to grow it and returns -1.
+  CHECK_EQ(65536 + 7, CallMain(isolate, instance));
+  CHECK_EQ(-1 + 7, CallMain(isolate, instance));
+  CHECK_EQ(65536 + 7, CallMain(isolate, shared));
+  CHECK_EQ(-1 + 7, CallMain(isolate, shared));
+}
+
+
+TEST(Run_WasmModule_GrowMemoryByBytes) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_GROW_MEMORY(WASM_I32(100))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+
+  // A memory that cannot grow behaves the same whether its bounds are checked
+  // explicitly or it is protected by guard pages.
+  for (bool guard_pages : {false, true}) {
+    SetGuardPagesEnabled(guard_pages);
+    CHECK_EQ(-1, CallMain(isolate, decoded.Instantiate()));
+  }
+
+  // A memory that can grow does so by any number of bytes, not only by whole
+  // pages, whether or not its code is shared and guard pages are enabled.
+  decoded.module()->max_mem_size_log2 = 17;
+  Handle<JSObject> compiled =
+      decoded.module()->Compile(isolate).ToHandleChecked();
+  Handle<JSObject> shared = decoded.InstantiateShared(compiled);
+  Handle<JSObject> instance = decoded.Instantiate();
+  SetGuardPagesEnabled(false);
+
+  CHECK_EQ(65536, CallMain(isolate, shared));
+  CHECK_EQ(65536 + 100, CallMain(isolate, shared));
+  CHECK_EQ(65536, CallMain(isolate, instance));
+  CHECK_EQ(65536 + 100, CallMain(isolate, instance));
+}
+
+
+TEST(Run_WasmModule_MemoryOutOfBounds) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  // Accesses the memory far beyond its size of 64k.
+  byte code[] = {WASM_LOAD_MEM(kMachInt32, WASM_I32(0x7ffffff0))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  // The access traps, whether the bounds are checked explicitly or the
+  // access faults on a guard page.
+  for (bool guard_pages : {false, true}) {
+    SetGuardPagesEnabled(guard_pages);
+    Handle<JSObject> instance = decoded.Instantiate();
+    Handle<Object> main =
+        Object::GetProperty(instance,
+                            isolate->factory()->InternalizeUtf8String("<?>"))
+            .ToHandleChecked();
+    for (int i = 0; i < 2; i++) {
+      v8::TryCatch try_catch(reinterpret_cast<v8::Isolate*>(isolate));
+      CHECK(Execution::Call(isolate, main, instance, 0, nullptr).is_null());
+      CHECK(try_catch.HasCaught());
+    }
+  }
+  SetGuardPagesEnabled(false);
+}
+
+
+namespace {
+bool instance_died = false;
+
+void InstanceDied(const v8::WeakCallbackInfo<v8::Global<v8::Object>>& info) {
+  info.GetParameter()->Reset();
+  instance_died = true;
+}
+
+// Instantiates {module} lazily, or with the code of {compiled_module}, and
+// checks that the instance is collected once it is no longer referenced, even
+// though the code in its tables may refer to it.
+void CheckInstanceDies(Isolate* isolate, WasmModule* module,
+                       Handle<JSObject> compiled_module) {
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  v8::Global<v8::Object> weak;
+  {
+    HandleScope scope(isolate);
+    Handle<JSObject> instance =
+        module->Instantiate(isolate, Handle<JSObject>::null(),
+                            Handle<JSArrayBuffer>::null(), kLazyCompilation,
+                            Vector<const byte>(), compiled_module)
+            .ToHandleChecked();
+    weak.Reset(v8_isolate, v8::Utils::ToLocal(instance));
+    weak.SetWeak(&weak, &InstanceDied, v8::WeakCallbackType::kParameter);
+  }
+  instance_died = false;
+  isolate->heap()->CollectAllAvailableGarbage();
+  CHECK(instance_died);
+}
+}  // namespace
+
+
+TEST(Run_WasmModule_GuardedInstanceDies) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_LOAD_MEM(kMachInt32, WASM_I8(0))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  // The trap handler refers to the code table and the out of bounds stub of
+  // an instance whose memory is protected by guard pages only weakly.
+  SetGuardPagesEnabled(true);
+  CheckInstanceDies(isolate, decoded.module(), Handle<JSObject>::null());
+  SetGuardPagesEnabled(false);
+}
+
+
+TEST(Run_WasmModule_SharedInstanceDies) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_LOAD_MEM(kMachInt32, WASM_I8(0))};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleWriter* writer = builder->Build(&zone);
+  WasmModuleIndex* module = writer->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  // The context of an instance of shared code refers to its code table and
+  // its function table only weakly.
+  Handle<JSObject> compiled =
+      decoded.module()->Compile(isolate).ToHandleChecked();
+  CheckInstanceDies(isolate, decoded.module(), compiled);
+}
+
+
+TEST(Run_WasmModule_SharedWrappers) {
+  // Two identical signatures, whose wrappers are compiled once and copied.
+  // The WasmModuleBuilder would merge them, so the module is written raw.
+  static const byte data[] = {
+      // sig#0 and sig#1 --------------------------------
+      kDeclSignatures, 2,
+      1, kLocalI32, kLocalI32,       // int -> int
+      1, kLocalI32, kLocalI32,       // int -> int
+      kDeclFunctions, 5,
+      // func#0 (import "a") ----------------------------
+      kDeclFunctionName | kDeclFunctionImport,
+      0, 0,                          // sig index
+      65, 0, 0, 0,                   // name offset
+      // func#1 (import "b") ----------------------------
+      kDeclFunctionName | kDeclFunctionImport,
+      1, 0,                          // sig index
+      67, 0, 0, 0,                   // name offset
+      // func#2 (export "c") ----------------------------
+      kDeclFunctionName | kDeclFunctionExport,
+      0, 0,                          // sig index
+      69, 0, 0, 0,                   // name offset
+      4, 0,                          // body size
+      kExprCallFunction, 0,          // --
+      kExprGetLocal, 0,              // --
+      // func#3 (export "d") ----------------------------
+      kDeclFunctionName | kDeclFunctionExport,
+      1, 0,                          // sig index
+      71, 0, 0, 0,                   // name offset
+      4, 0,                          // body size
+      kExprCallFunction, 1,          // --
+      kExprGetLocal, 0,              // --
+      // func#4 (export "e") ----------------------------
+      kDeclFunctionName | kDeclFunctionExport,
+      0, 0,                          // sig index
+      73, 0, 0, 0,                   // name offset
+      5, 0,                          // body size
+      kExprI32Add,                   // --
+      kExprGetLocal, 0,              // --
+      kExprI8Const, 1,               // --
+      kDeclEnd,
+      // names ------------------------------------------
+      'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e', 0,
+  };
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  Handle<JSObject> ffi = Handle<JSObject>::cast(v8::Utils::OpenHandle(
+      *CompileRun("({a: function(x) { return x + 10; },"
+                  "  b: function(x) { return x + 20; }})")));
+  Handle<JSObject> instance =
+      DecodedModule(isolate, data, data + arraysize(data))
+          .Instantiate(kEagerCompilation, ffi);
+
+  const char* names[] = {"c", "d", "e"};
+  int32_t expected[] = {11, 21, 2};
+  for (size_t i = 0; i < arraysize(names); i++) {
+    Handle<Object> function =
+        Object::GetProperty(instance,
+                            isolate->factory()->InternalizeUtf8String(names[i]))
+            .ToHandleChecked();
+    Handle<Object> args[] = {handle(Smi::FromInt(1), isolate)};
+    Handle<Object> retval =
+        Execution::Call(isolate, function, instance, 1, args)
+            .ToHandleChecked();
+    CHECK_EQ(expected[i], static_cast<int32_t>(retval->Number()));
+  }
+}
+
+
+TEST(Run_WasmModule_ConvertArguments) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("i");
+  f->ReturnType(kAstI32);
+  f->AddParam(kAstI32);
+  f->Exported(1);
+  byte code_i[] = {WASM_I32_ADD(WASM_GET_LOCAL(0), WASM_I8(1))};
+  f->EmitCode(code_i, sizeof(code_i));
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("f");
+  f->ReturnType(kAstF64);
+  f->AddParam(kAstF64);
+  f->Exported(1);
+  byte code_f[] = {WASM_GET_LOCAL(0)};
+  f->EmitCode(code_f, sizeof(code_f));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+  Handle<JSObject> instance =
+      DecodedModule(isolate, module->Begin(), module->End()).Instantiate();
+  v8::Local<v8::Object> global = context->Global();
+  CHECK(global->Set(context, v8_str("m"), v8::Utils::ToLocal(instance))
+            .FromJust());
+
+  // Smis and heap numbers are converted inline, other values by ToNumber.
+  CHECK_EQ(2, CompileRun("m.i(1)")->Int32Value(context).FromJust());
+  CHECK_EQ(-7, CompileRun("m.i(-8)")->Int32Value(context).FromJust());
+  CHECK_EQ(3, CompileRun("m.i(2.5)")->Int32Value(context).FromJust());
+  CHECK_EQ(1, CompileRun("m.i(4294967296)")->Int32Value(context).FromJust());
+  CHECK_EQ(1, CompileRun("m.i(NaN)")->Int32Value(context).FromJust());
+  CHECK_EQ(42, CompileRun("m.i('41')")->Int32Value(context).FromJust());
+  CHECK_EQ(8, CompileRun("m.i({valueOf: function() { return 7; }})")
+                  ->Int32Value(context)
+                  .FromJust());
+  CHECK_EQ(-3.0, CompileRun("m.f(-3)")->NumberValue(context).FromJust());
+  CHECK_EQ(2.5, CompileRun("m.f(2.5)")->NumberValue(context).FromJust());
+  CHECK_EQ(1.5, CompileRun("m.f('1.5')")->NumberValue(context).FromJust());
+  CHECK(std::isnan(CompileRun("m.f()")->NumberValue(context).FromJust()));
+
+  // The wrapper of the export calls its wasm code directly and records the
+  // signature of the function.
+  Handle<Object> f =
+      Object::GetProperty(instance,
+                          isolate->factory()->InternalizeUtf8String("f"))
+          .ToHandleChecked();
+  FunctionSig* sig = GetWasmExportSignature(&zone, JSFunction::cast(*f));
+  CHECK_NOT_NULL(sig);
+  CHECK_EQ(1, static_cast<int>(sig->return_count()));
+  CHECK_EQ(1, static_cast<int>(sig->parameter_count()));
+  CHECK_EQ(kAstF64, sig->GetReturn());
+  CHECK_EQ(kAstF64, sig->GetParam(0));
+}
+
+
+TEST(Run_WasmModule_CallImportArity) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  const char* names[] = {"a", "b", "c", "d"};
+  for (int i = 0; i < 4; i++) {
+    WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+    f->SetName(names[i]);
+    f->ReturnType(kAstI32);
+    f->AddParam(kAstI32);
+    if (i < 2) {
+      // Imports "a" and "b", called by the exports "c" and "d".
+      f->External(1);
+    } else {
+      f->Exported(1);
+      byte code[] = {WASM_CALL_FUNCTION(i - 2, WASM_GET_LOCAL(0))};
+      f->EmitCode(code, sizeof(code));
+    }
+  }
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+  // The first function takes more parameters, so it is called through the
+  // Call builtin. The second one is sloppy and called directly, with the
+  // global proxy as the receiver, as the Call builtin would pass it.
+  Handle<JSObject> ffi = Handle<JSObject>::cast(v8::Utils::OpenHandle(
+      *CompileRun("var global = this;"
+                  "({a: function(x, y) { return y === undefined ? x : -1; },"
+                  "  b: function(x) { return this === global ? x * 2 : -1; }"
+                  "})")));
+  Handle<JSObject> instance =
+      DecodedModule(isolate, module->Begin(), module->End())
+          .Instantiate(kEagerCompilation, ffi);
+  v8::Local<v8::Object> global = context->Global();
+  CHECK(global->Set(context, v8_str("m"), v8::Utils::ToLocal(instance))
+            .FromJust());
+
+  CHECK_EQ(7, CompileRun("m.c(7)")->Int32Value(context).FromJust());
+  CHECK_EQ(-5, CompileRun("m.c(-5)")->Int32Value(context).FromJust());
+  CHECK_EQ(14, CompileRun("m.d(7)")->Int32Value(context).FromJust());
+
+  // Only functions of the exact arity are called directly, and sloppy ones
+  // get the global proxy as the receiver.
+  LocalType kIntInt[] = {kAstI32, kAstI32};
+  FunctionSig sig(1, 1, kIntInt);
+  const char* sources[] = {"(function(x) { 'use strict'; return x; })",
+                           "(function(x, y) { 'use strict'; return x; })",
+                           "(function(x) { return x; })",
+                           "'use strict'; (class { constructor(x) {} })"};
+  int expected[] = {1, -1, 1, -1};
+  bool global_proxy[] = {false, false, true, false};
+  for (size_t i = 0; i < arraysize(sources); i++) {
+    Handle<JSFunction> function = Handle<JSFunction>::cast(
+        v8::Utils::OpenHandle(*CompileRun(sources[i])));
+    CHECK_EQ(expected[i], GetDirectCallArgumentCount(*function, &sig));
+    CHECK_EQ(global_proxy[i], HasGlobalProxyReceiver(*function));
+  }
+}
+
+
+#if (V8_TARGET_ARCH_X64 && !V8_OS_WIN) || \
+    (V8_TARGET_ARCH_ARM64 && !USE_SIMULATOR)
+
+namespace {
+int32_t HostAdd(int32_t a, int32_t b) { return a + b; }
+
+double HostScale(double x, int32_t k) { return x * k; }
+
+int32_t HostIsStackAligned() {
+  uintptr_t frame = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  return frame % base::OS::ActivationFrameAlignment() == 0 ? 1 : 0;
+}
+}  // namespace
+
+
+TEST(Run_WasmModule_HostFunctions) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("add");
+  f->ReturnType(kAstI32);
+  f->AddParam(kAstI32);
+  f->AddParam(kAstI32);
+  f->External(1);
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("scale");
+  f->ReturnType(kAstF64);
+  f->AddParam(kAstF64);
+  f->AddParam(kAstI32);
+  f->External(1);
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("c");
+  f->ReturnType(kAstI32);
+  f->AddParam(kAstI32);
+  f->Exported(1);
+  byte code_c[] = {WASM_CALL_FUNCTION(0, WASM_GET_LOCAL(0), WASM_I8(5))};
+  f->EmitCode(code_c, sizeof(code_c));
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("d");
+  f->ReturnType(kAstF64);
+  f->AddParam(kAstF64);
+  f->Exported(1);
+  byte code_d[] = {WASM_CALL_FUNCTION(1, WASM_GET_LOCAL(0), WASM_I8(3))};
+  f->EmitCode(code_d, sizeof(code_d));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+
+  LocalType add_types[] = {kAstI32, kAstI32, kAstI32};
+  FunctionSig add_sig(1, 2, add_types);
+  LocalType scale_types[] = {kAstF64, kAstF64, kAstI32};
+  FunctionSig scale_sig(1, 2, scale_types);
+  std::vector<WasmHostFunction> host_functions = {
+      {"add", &add_sig, FUNCTION_ADDR(HostAdd)},
+      {"scale", &scale_sig, FUNCTION_ADDR(HostScale)}};
+  Handle<JSObject> instance =
+      decoded.module()
+          ->Instantiate(isolate, Handle<JSObject>::null(),
+                        Handle<JSArrayBuffer>::null(), kEagerCompilation,
+                        Vector<const byte>(), Handle<JSObject>::null(),
+                        &host_functions)
+          .ToHandleChecked();
+  v8::Local<v8::Object> global = context->Global();
+  CHECK(global->Set(context, v8_str("m"), v8::Utils::ToLocal(instance))
+            .FromJust());
+  CHECK_EQ(12, CompileRun("m.c(7)")->Int32Value(context).FromJust());
+  CHECK_EQ(-1, CompileRun("m.c(-6)")->Int32Value(context).FromJust());
+  CHECK_EQ(4.5, CompileRun("m.d(1.5)")->NumberValue(context).FromJust());
+
+  // The signature of a host function must match that of the import.
+  host_functions[0].sig = &scale_sig;
+  CHECK(decoded.module()
+            ->Instantiate(isolate, Handle<JSObject>::null(),
+                          Handle<JSArrayBuffer>::null(), kEagerCompilation,
+                          Vector<const byte>(), Handle<JSObject>::null(),
+                          &host_functions)
+            .is_null());
+  isolate->clear_scheduled_exception();
+}
+
+
+TEST(Run_WasmModule_HostFunctionStackAlignment) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("aligned");
+  f->ReturnType(kAstI32);
+  f->External(1);
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("f");
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  byte code[] = {WASM_CALL_FUNCTION0(0)};
+  f->EmitCode(code, sizeof(code));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+
+  LocalType aligned_types[] = {kAstI32};
+  FunctionSig aligned_sig(1, 0, aligned_types);
+  std::vector<WasmHostFunction> host_functions = {
+      {"aligned", &aligned_sig, FUNCTION_ADDR(HostIsStackAligned)}};
+  Handle<JSObject> instance =
+      decoded.module()
+          ->Instantiate(isolate, Handle<JSObject>::null(),
+                        Handle<JSArrayBuffer>::null(), kEagerCompilation,
+                        Vector<const byte>(), Handle<JSObject>::null(),
+                        &host_functions)
+          .ToHandleChecked();
+  v8::Local<v8::Object> global = context->Global();
+  CHECK(global->Set(context, v8_str("m"), v8::Utils::ToLocal(instance))
+            .FromJust());
+  // Host functions are entered with the stack aligned as in C, whatever the
+  // depth of the JavaScript frames calling into wasm.
+  CHECK_EQ(1, CompileRun("m.f()")->Int32Value(context).FromJust());
+  CHECK_EQ(1, CompileRun("(function g(n) { return n ? g(n - 1) : m.f(); })(1)")
+                  ->Int32Value(context)
+                  .FromJust());
+  CHECK_EQ(1, CompileRun("(function g(n) { return n ? g(n - 1) : m.f(); })(2)")
+                  ->Int32Value(context)
+                  .FromJust());
+}
+
+#endif
+
+
+namespace {
+int32_t HostSum(int32_t a, int32_t b, int32_t c, int32_t d, int32_t e,
+                int32_t f, int32_t g, int32_t h, int32_t i) {
+  return a + b + c + d + e + f + g + h + i;
+}
+}  // namespace
+
+
+TEST(Run_WasmModule_HostFunctionUnsupportedSignature) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("sum");
+  f->ReturnType(kAstI32);
+  for (int i = 0; i < 9; i++) f->AddParam(kAstI32);
+  f->External(1);
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  Isolate* isolate = CcTest::InitIsolateOnce();
+  HandleScope scope(isolate);
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+
+  // Parameters that the C calling convention passes on the stack are not
+  // supported, on any platform, and instantiation fails instead.
+  LocalType sum_types[] = {kAstI32, kAstI32, kAstI32, kAstI32, kAstI32,
+                           kAstI32, kAstI32, kAstI32, kAstI32, kAstI32};
+  FunctionSig sum_sig(1, 9, sum_types);
+  CHECK_NULL(ModuleEnv::GetHostCallDescriptor(&zone, &sum_sig));
+  std::vector<WasmHostFunction> host_functions = {
+      {"sum", &sum_sig, FUNCTION_ADDR(HostSum)}};
+  CHECK(decoded.module()
+            ->Instantiate(isolate, Handle<JSObject>::null(),
+                          Handle<JSArrayBuffer>::null(), kEagerCompilation,
+                          Vector<const byte>(), Handle<JSObject>::null(),
+                          &host_functions)
+            .is_null());
+  isolate->clear_scheduled_exception();
+}
+
+
+TEST(Run_WasmModule_TypedExports) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("scale");
+  f->ReturnType(kAstF64);
+  f->AddParam(kAstI32);
+  f->AddParam(kAstF64);
+  f->Exported(1);
+  byte code_scale[] = {WASM_F64_MUL(WASM_F64_SCONVERT_I32(WASM_GET_LOCAL(0)),
+                                    WASM_GET_LOCAL(1))};
+  f->EmitCode(code_scale, sizeof(code_scale));
+  f = builder->FunctionAt(builder->AddFunction());
+  f->SetName("check");
+  f->ReturnType(kAstStmt);
+  f->AddParam(kAstI32);
+  f->Exported(1);
+  byte code_check[] = {WASM_IF(WASM_GET_LOCAL(0), WASM_UNREACHABLE)};
+  f->EmitCode(code_check, sizeof(code_check));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  DecodedModule decoded(isolate, module->Begin(), module->End());
+  Handle<JSObject> object = decoded.Instantiate();
+
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  v8::WasmInstance instance(v8_isolate, v8::Utils::ToLocal(object));
+  v8::WasmExport<double(int32_t, double)> scale =
+      instance.GetExport<double(int32_t, double)>("scale");
+  CHECK(scale.IsValid());
+  double value = 0;
+  CHECK(scale.Call(3, 0.5, &value));
+  CHECK_EQ(1.5, value);
+  CHECK(scale.Call(-7, 2.25, &value));
+  CHECK_EQ(-15.75, value);
+
+  v8::WasmExport<void(int32_t)> check =
+      instance.GetExport<void(int32_t)>("check");
+  CHECK(check.IsValid());
+  CHECK(check.Call(0));
+  {
+    v8::TryCatch try_catch(v8_isolate);
+    CHECK(!check.Call(1));
+    CHECK(try_catch.HasCaught());
+  }
+
+  // The C++ signature has to match the wasm signature exactly.
+  CHECK(!instance.GetExport<double(double, double)>("scale").IsValid());
+  CHECK(!instance.GetExport<float(int32_t, double)>("scale").IsValid());
+  CHECK(!instance.GetExport<void()>("check").IsValid());
+  CHECK(!instance.GetExport<void(int32_t)>("missing").IsValid());
+
+  // Exports stay callable after the handle scope they were created in, and
+  // across garbage collections.
+  v8::WasmExport<double(int32_t, double)>* outer = nullptr;
+  {
+    v8::HandleScope inner_scope(v8_isolate);
+    v8::WasmInstance inner(v8_isolate, v8::Utils::ToLocal(object));
+    outer = new v8::WasmExport<double(int32_t, double)>(
+        inner.GetExport<double(int32_t, double)>("scale"));
+  }
+  isolate->heap()->CollectAllAvailableGarbage();
+  CHECK(outer->IsValid());
+  CHECK(outer->Call(4, 0.25, &value));
+  CHECK_EQ(1.0, value);
+  delete outer;
+
+  // Lazily compiled exports do not call the wasm code directly.
+  Handle<JSObject> lazy = decoded.Instantiate(kLazyCompilation);
+  v8::WasmInstance lazy_instance(v8_isolate, v8::Utils::ToLocal(lazy));
+  CHECK(!lazy_instance.GetExport<double(int32_t, double)>("scale").IsValid());
+}
+
+
+namespace {
+int async_fulfilled = 0;
+int async_rejected = 0;
+
+void OnAsyncFulfilled(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Local<v8::Context> context = args.GetIsolate()->GetCurrentContext();
+  CHECK(context->Global()->Set(context, v8_str("m"), args[0]).FromJust());
+  async_fulfilled++;
+}
+
+void OnAsyncRejected(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  async_rejected++;
+}
+
+// Instantiates the module asynchronously, and runs the tasks posted to the
+// isolate's thread and the microtasks until its promise is settled.
+void InstantiateAsyncAndWait(Isolate* isolate, v8::Local<v8::Context> context,
+                             const byte* start, const byte* end) {
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  v8::Local<v8::Promise::Resolver> resolver =
+      v8::Promise::Resolver::New(context).ToLocalChecked();
+  v8::Local<v8::Promise> promise = resolver->GetPromise();
+  CHECK(!promise->Then(context, v8::Function::New(context, OnAsyncFulfilled)
+                                    .ToLocalChecked())
+             .IsEmpty());
+  CHECK(!promise->Catch(context, v8::Function::New(context, OnAsyncRejected)
+                                     .ToLocalChecked())
+             .IsEmpty());
+  int settled = async_fulfilled + async_rejected;
+  EnableAsyncInstantiations(isolate);
+  InstantiateModuleAsync(isolate, std::vector<byte>(start, end),
+                         Handle<JSObject>::null(),
+                         Handle<JSArrayBuffer>::null(),
+                         v8::Utils::OpenHandle(*resolver));
+  while (async_fulfilled + async_rejected == settled) {
+    if (!v8::platform::PumpMessageLoop(V8::GetCurrentPlatform(), v8_isolate)) {
+      base::OS::Sleep(base::TimeDelta::FromMilliseconds(1));
+    }
+    v8_isolate->RunMicrotasks();
+  }
+}
+}  // namespace
+
+
+TEST(Run_WasmModule_InstantiateAsync) {
+  Zone zone;
+  WasmModuleIndex* module = BuildMainModule(&zone, 11);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+  async_fulfilled = 0;
+  async_rejected = 0;
+
+  InstantiateAsyncAndWait(isolate, context, module->Begin(), module->End());
+  CHECK_EQ(1, async_fulfilled);
+  CHECK_EQ(11, CompileRun("m.main()")->Int32Value(context).FromJust());
+
+  // Errors reject the promise instead of throwing.
+  static const byte truncated[] = {kDeclSignatures, 1, 0};
+  InstantiateAsyncAndWait(isolate, context, truncated,
+                          truncated + arraysize(truncated));
+  CHECK_EQ(1, async_rejected);
+  CHECK(!isolate->has_scheduled_exception());
+  // As the embedder does before it disposes of the isolate.
+  AbortAsyncInstantiations(isolate);
+}
+
+
+TEST(Run_WasmModule_AbortAsyncInstantiations) {
+  Zone zone;
+  WasmModuleIndex* module = BuildMainModule(&zone, 11);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  v8::Local<v8::Context> context = scope.context();
+  v8::Local<v8::Promise::Resolver> resolver =
+      v8::Promise::Resolver::New(context).ToLocalChecked();
+  v8::Local<v8::Promise> promise = resolver->GetPromise();
+  CHECK(!promise->Then(context, v8::Function::New(context, OnAsyncFulfilled)
+                                    .ToLocalChecked())
+             .IsEmpty());
+  CHECK(!promise->Catch(context, v8::Function::New(context, OnAsyncRejected)
+                                     .ToLocalChecked())
+             .IsEmpty());
+  async_fulfilled = 0;
+  async_rejected = 0;
+  v8::WasmAsyncInstantiation::Enable(v8_isolate);
+  CHECK(AsyncInstantiationsEnabled(isolate));
+  InstantiateModuleAsync(isolate,
+                         std::vector<byte>(module->Begin(), module->End()),
+                         Handle<JSObject>::null(),
+                         Handle<JSArrayBuffer>::null(),
+                         v8::Utils::OpenHandle(*resolver));
+
+  // The tasks that are still posted do nothing once the job is aborted, and
+  // no new jobs can start.
+  v8::WasmAsyncInstantiation::Abort(v8_isolate);
+  CHECK(!AsyncInstantiationsEnabled(isolate));
+  for (int i = 0; i < 10; i++) {
+    while (v8::platform::PumpMessageLoop(V8::GetCurrentPlatform(),
+                                         v8_isolate)) {
+    }
+    base::OS::Sleep(base::TimeDelta::FromMilliseconds(1));
+  }
+  v8_isolate->RunMicrotasks();
+  CHECK_EQ(0, async_fulfilled);
+  CHECK_EQ(0, async_rejected);
+}
+
+
+TEST(Run_WasmModule_CompileModuleFile) {
+  Zone zone;
+  WasmModuleIndex* module = BuildMainModule(&zone, 23);
+  size_t size = module->End() - module->Begin();
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Local<v8::Context> context = scope.context();
+
+  EmbeddedVector<char, 64> path;
+  SNPrintF(path, "wasm-module-file-%d.wasm", OS::GetCurrentProcessId());
+  FILE* file = OS::FOpen(path.start(), "wb");
+  CHECK(file != nullptr);
+  CHECK_EQ(size, fwrite(module->Begin(), 1, size, file));
+  fclose(file);
+
+  Handle<JSObject> compiled_module;
+  {
+    ErrorThrower thrower(isolate, "CompileModuleFile");
+    CHECK(CompileModuleFile(thrower, isolate, path.start())
+              .ToHandle(&compiled_module));
+  }
+  // The compiled module keeps the mapping, not the file.
+  CHECK(OS::Remove(path.start()));
+  CHECK(IsCompiledModule(compiled_module));
+
+  Handle<JSObject> instance =
+      InstantiateCompiledModule(isolate, compiled_module,
+                                Handle<JSObject>::null(),
+                                Handle<JSArrayBuffer>::null())
+          .ToHandleChecked();
+  CHECK(context->Global()
+            ->Set(context, v8_str("m"), v8::Utils::ToLocal(instance))
+            .FromJust());
+  CHECK_EQ(23, CompileRun("m.main()")->Int32Value(context).FromJust());
+
+  {
+    ErrorThrower thrower(isolate, "CompileModuleFile");
+    CHECK(CompileModuleFile(thrower, isolate, path.start()).is_null());
+  }
+  isolate->clear_scheduled_exception();
+}
+
+
+TEST(Run_WasmModule_CompiledModuleDataSegments) {
+  static const int kPageSegmentDest = 4096;
+  static const int kPageSegmentSize = 8192;
+  static const int kCounterDest = 8200;
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  // Increments the word at kCounterDest and returns it.
+  byte code[] = {
+      WASM_BLOCK(2, WASM_STORE_MEM(kMachInt32, WASM_I32(kCounterDest),
+                                   WASM_I32_ADD(WASM_LOAD_MEM(
+                                                    kMachInt32,
+                                                    WASM_I32(kCounterDest)),
+                                                WASM_I8(1))),
+                 WASM_LOAD_MEM(kMachInt32, WASM_I32(kCounterDest)))};
+  f->EmitCode(code, sizeof(code));
+  // A segment large enough to be mapped from the data image, and a later
+  // one that overwrites part of it.
+  byte* page_data = zone.NewArray<byte>(kPageSegmentSize);
+  memset(page_data, 0x11, kPageSegmentSize);
+  builder->AddDataSegment(new(&zone) WasmDataSegmentEncoder(
+      &zone, page_data, kPageSegmentSize, kPageSegmentDest));
+  byte small_data[] = {0x10, 0, 0, 0};
+  builder->AddDataSegment(new(&zone) WasmDataSegmentEncoder(
+      &zone, small_data, sizeof(small_data), kCounterDest));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  ErrorThrower thrower(isolate, "CompileModule");
+  Handle<JSObject> compiled_module =
+      CompileModule(thrower, isolate, module->Begin(), module->End())
+          .ToHandleChecked();
+
+  Handle<JSObject> first =
+      InstantiateCompiledModule(isolate, compiled_module,
+                                Handle<JSObject>::null(),
+                                Handle<JSArrayBuffer>::null())
+          .ToHandleChecked();
+  CHECK_EQ(0x11, CallMain(isolate, first));
+  CHECK_EQ(0x12, CallMain(isolate, first));
+
+  // Writes of one instance do not show in the other.
+  Handle<JSObject> second =
+      InstantiateCompiledModule(isolate, compiled_module,
+                                Handle<JSObject>::null(),
+                                Handle<JSArrayBuffer>::null())
+          .ToHandleChecked();
+  CHECK_EQ(0x11, CallMain(isolate, second));
+  CHECK_EQ(0x13, CallMain(isolate, first));
+}
+
+
+#if V8_OS_LINUX
+
+TEST(Run_WasmModule_SnapshotInstance) {
+  static const int kCounterDest = 0;
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  uint16_t f_index = builder->AddFunction();
+  WasmFunctionBuilder* f = builder->FunctionAt(f_index);
+  f->ReturnType(kAstI32);
+  f->Exported(1);
+  // Increments the word at kCounterDest and returns it.
+  byte code[] = {
+      WASM_BLOCK(2, WASM_STORE_MEM(kMachInt32, WASM_I32(kCounterDest),
+                                   WASM_I32_ADD(WASM_LOAD_MEM(
+                                                    kMachInt32,
+                                                    WASM_I32(kCounterDest)),
+                                                WASM_I8(1))),
+                 WASM_LOAD_MEM(kMachInt32, WASM_I32(kCounterDest)))};
+  f->EmitCode(code, sizeof(code));
+  byte data[] = {5, 0, 0, 0};
+  builder->AddDataSegment(new(&zone) WasmDataSegmentEncoder(
+      &zone, data, sizeof(data), kCounterDest));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  ErrorThrower thrower(isolate, "SnapshotInstance");
+  Handle<JSObject> compiled_module =
+      CompileModule(thrower, isolate, module->Begin(), module->End())
+          .ToHandleChecked();
+  Handle<JSObject> instance =
+      InstantiateCompiledModule(isolate, compiled_module,
+                                Handle<JSObject>::null(),
+                                Handle<JSArrayBuffer>::null())
+          .ToHandleChecked();
+  CHECK_EQ(6, CallMain(isolate, instance));
+  CHECK_EQ(7, CallMain(isolate, instance));
+
+  Handle<JSObject> snapshot =
+      SnapshotInstance(thrower, isolate, instance).ToHandleChecked();
+  CHECK(IsInstanceSnapshot(snapshot));
+  CHECK(!IsInstanceSnapshot(compiled_module));
+  CHECK_EQ(8, CallMain(isolate, instance));
+
+  // Instances created from the snapshot start out in its state, and do not
+  // see each other's writes.
+  Handle<JSObject> first =
+      InstantiateSnapshot(thrower, isolate, snapshot, Handle<JSObject>::null())
+          .ToHandleChecked();
+  Handle<JSObject> second =
+      InstantiateSnapshot(thrower, isolate, snapshot, Handle<JSObject>::null())
+          .ToHandleChecked();
+  CHECK_EQ(8, CallMain(isolate, first));
+  CHECK_EQ(9, CallMain(isolate, first));
+  CHECK_EQ(8, CallMain(isolate, second));
+
+  // Resetting restores the state of the snapshot, or of instantiation.
+  CHECK(ResetInstance(isolate, first));
+  CHECK_EQ(8, CallMain(isolate, first));
+  CHECK(ResetInstance(isolate, instance));
+  CHECK_EQ(6, CallMain(isolate, instance));
+}
+
+#endif  // V8_OS_LINUX
+
+
+// Objects created from templates can mimic the layout of the internal fields
+// of the wasm objects, but not their brands.
+TEST(Run_WasmModule_BrandChecks) {
+  ContextScope scope;
+  Isolate* isolate = scope.isolate();
+  v8::Isolate* v8_isolate = reinterpret_cast<v8::Isolate*>(isolate);
+  v8::Local<v8::Context> context = scope.context();
+
+  for (int count : {2, 3, 9}) {
+    v8::Local<v8::ObjectTemplate> templ = v8::ObjectTemplate::New(v8_isolate);
+    templ->SetInternalFieldCount(count);
+    Handle<JSObject> object = v8::Utils::OpenHandle(
+        *templ->NewInstance(context).ToLocalChecked());
+    Handle<Foreign> foreign = isolate->factory()->NewForeign(nullptr);
+    for (int i = 0; i < count; i++) object->SetInternalField(i, *foreign);
+    CHECK(!IsCompiledModule(object));
+    CHECK(!IsInstanceSnapshot(object));
+    CHECK(!ResetInstance(isolate, object));
+  }
+}
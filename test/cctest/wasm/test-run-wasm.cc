@@ -1861,6 +1861,241 @@ TEST(Run_Wasm_LoadMemI32_oob) {
 }
 
 
+TEST(Run_Wasm_LoadMemI32_masked_index) {
+  WasmRunner<int32_t> r(kMachUint32);
+  TestingModule module;
+  int32_t* memory = module.AddMemoryElems<int32_t>(8);
+  module.RandomizeMemory(1113);
+  r.env()->module = &module;
+
+  // The mask keeps the index within the memory without a bounds check.
+  BUILD(r, WASM_LOAD_MEM(kMachInt32, WASM_I32_AND(WASM_GET_LOCAL(0),
+                                                  WASM_I8(0x1c))));
+
+  for (uint32_t i = 0; i < 8; i++) {
+    memory[i] = static_cast<int32_t>(1111 * i);
+    CHECK_EQ(memory[i], r.Call(i * 4));
+    CHECK_EQ(memory[i], r.Call(0xffffff00 + i * 4));
+  }
+}
+
+
+TEST(Run_Wasm_LoadMemI32_redundant_check) {
+  WasmRunner<int32_t> r(kMachUint32);
+  TestingModule module;
+  int32_t* memory = module.AddMemoryElems<int32_t>(8);
+  module.RandomizeMemory(1114);
+  r.env()->module = &module;
+
+  // The check of the first access covers the second one.
+  BUILD(r, WASM_I32_ADD(WASM_LOAD_MEM_OFFSET(kMachInt32, 4, WASM_GET_LOCAL(0)),
+                        WASM_LOAD_MEM(kMachInt32, WASM_GET_LOCAL(0))));
+
+  memory[0] = 100;
+  memory[1] = 11;
+  memory[7] = 22;
+  CHECK_EQ(111, r.Call(0u));
+  CHECK_TRAP(r.Call(28u));
+  CHECK_TRAP(r.Call(0xfffffffc));
+}
+
+
+TEST(Run_Wasm_LoadMemU8_loop_check) {
+  WasmRunner<int32_t> r(kMachUint32);
+  const int kNumElems = 32;
+  const byte kIndex = r.AllocateLocal(kAstI32);
+  const byte kSum = r.AllocateLocal(kAstI32);
+  TestingModule module;
+  byte* memory = module.AddMemoryElems<byte>(kNumElems);
+  module.RandomizeMemory(1115);
+  r.env()->module = &module;
+
+  // The check of the access in the loop is hoisted out of the loop.
+  BUILD(r,
+        WASM_BLOCK(
+            2, WASM_WHILE(
+                   WASM_I32_LTU(WASM_GET_LOCAL(kIndex), WASM_GET_LOCAL(0)),
+                   WASM_BLOCK(
+                       2, WASM_SET_LOCAL(
+                              kSum, WASM_I32_ADD(
+                                        WASM_GET_LOCAL(kSum),
+                                        WASM_LOAD_MEM(kMachUint8,
+                                                      WASM_GET_LOCAL(kIndex)))),
+                       WASM_INC_LOCAL(kIndex))),
+            WASM_GET_LOCAL(kSum)));
+
+  int32_t expected = 0;
+  for (uint32_t count = 0; count <= kNumElems; count++) {
+    CHECK_EQ(expected, r.Call(count));
+    if (count < kNumElems) expected += memory[count];
+  }
+  CHECK_TRAP(r.Call(kNumElems + 1));
+  CHECK_TRAP(r.Call(0xffffffff));
+}
+
+
+TEST(Run_Wasm_StoreMemU8_loop_check) {
+  WasmRunner<int32_t> r(kMachUint32);
+  const int kNumElems = 32;
+  const byte kIndex = r.AllocateLocal(kAstI32);
+  TestingModule module;
+  byte* memory = module.AddMemoryElems<byte>(kNumElems);
+  r.env()->module = &module;
+
+  // A loop that runs out of bounds stores up to the end of the memory before
+  // it traps.
+  BUILD(r, WASM_BLOCK(
+               2, WASM_WHILE(
+                      WASM_I32_LTU(WASM_GET_LOCAL(kIndex), WASM_GET_LOCAL(0)),
+                      WASM_BLOCK(2, WASM_STORE_MEM(kMachUint8,
+                                                   WASM_GET_LOCAL(kIndex),
+                                                   WASM_I8(7)),
+                                 WASM_INC_LOCAL(kIndex))),
+               WASM_GET_LOCAL(kIndex)));
+
+  module.ZeroMemory();
+  CHECK_EQ(kNumElems / 2, r.Call(kNumElems / 2));
+  for (int i = 0; i < kNumElems; i++) {
+    CHECK_EQ(i < kNumElems / 2 ? 7 : 0, memory[i]);
+  }
+  module.ZeroMemory();
+  CHECK_TRAP(r.Call(kNumElems + 1));
+  for (int i = 0; i < kNumElems; i++) {
+    CHECK_EQ(7, memory[i]);
+  }
+}
+
+
+TEST(Run_Wasm_LoadMemU8_nested_loop_check) {
+  WasmRunner<int32_t> r(kMachUint32);
+  const int kNumElems = 32;
+  const int kNumRepeats = 3;
+  const byte kOuter = r.AllocateLocal(kAstI32);
+  const byte kIndex = r.AllocateLocal(kAstI32);
+  const byte kSum = r.AllocateLocal(kAstI32);
+  TestingModule module;
+  byte* memory = module.AddMemoryElems<byte>(kNumElems);
+  module.RandomizeMemory(1116);
+  r.env()->module = &module;
+
+  // The check of the access in the inner loop is hoisted out of the inner
+  // loop, which the outer loop enters again on every iteration.
+  BUILD(r,
+        WASM_BLOCK(
+            2,
+            WASM_WHILE(
+                WASM_I32_LTU(WASM_GET_LOCAL(kOuter), WASM_I8(kNumRepeats)),
+                WASM_BLOCK(
+                    3, WASM_SET_LOCAL(kIndex, WASM_ZERO),
+                    WASM_WHILE(
+                        WASM_I32_LTU(WASM_GET_LOCAL(kIndex), WASM_GET_LOCAL(0)),
+                        WASM_BLOCK(
+                            2,
+                            WASM_SET_LOCAL(
+                                kSum,
+                                WASM_I32_ADD(
+                                    WASM_GET_LOCAL(kSum),
+                                    WASM_LOAD_MEM(kMachUint8,
+                                                  WASM_GET_LOCAL(kIndex)))),
+                            WASM_INC_LOCAL(kIndex))),
+                    WASM_INC_LOCAL(kOuter))),
+            WASM_GET_LOCAL(kSum)));
+
+  int32_t expected = 0;
+  for (uint32_t count = 0; count <= kNumElems; count++) {
+    CHECK_EQ(kNumRepeats * expected, r.Call(count));
+    if (count < kNumElems) expected += memory[count];
+  }
+  CHECK_TRAP(r.Call(kNumElems + 1));
+  CHECK_TRAP(r.Call(0xffffffff));
+}
+
+
+TEST(Run_Wasm_LoadMemU8_loop_check_call) {
+  const int kNumElems = 32;
+  TestSignatures sigs;
+  TestingModule module;
+  byte* memory = module.AddMemoryElems<byte>(kNumElems);
+  module.RandomizeMemory(1117);
+
+  // Build the function called in the loop.
+  WasmFunctionCompiler t(sigs.i_i());
+  BUILD(t, WASM_I32_MUL(WASM_GET_LOCAL(0), WASM_I8(3)));
+  unsigned index = t.CompileAndAdd(&module);
+
+  // The loop versioned on the hoisted check contains the call, whose result
+  // is summed up after the loop.
+  WasmRunner<int32_t> r(kMachUint32);
+  const byte kIndex = r.AllocateLocal(kAstI32);
+  const byte kSum = r.AllocateLocal(kAstI32);
+  r.env()->module = &module;
+  BUILD(r,
+        WASM_BLOCK(
+            2, WASM_WHILE(
+                   WASM_I32_LTU(WASM_GET_LOCAL(kIndex), WASM_GET_LOCAL(0)),
+                   WASM_BLOCK(
+                       2, WASM_SET_LOCAL(
+                              kSum, WASM_I32_ADD(
+                                        WASM_GET_LOCAL(kSum),
+                                        WASM_CALL_FUNCTION(
+                                            index,
+                                            WASM_LOAD_MEM(
+                                                kMachUint8,
+                                                WASM_GET_LOCAL(kIndex))))),
+                       WASM_INC_LOCAL(kIndex))),
+            WASM_GET_LOCAL(kSum)));
+
+  int32_t expected = 0;
+  for (uint32_t count = 0; count <= kNumElems; count++) {
+    CHECK_EQ(expected, r.Call(count));
+    if (count < kNumElems) expected += 3 * memory[count];
+  }
+  CHECK_TRAP(r.Call(kNumElems + 1));
+}
+
+
+TEST(Run_Wasm_LoadMemU8_signed_loop_check) {
+  WasmRunner<int32_t> r(kMachInt32, kMachInt32);
+  const int kNumElems = 32;
+  const byte kSum = r.AllocateLocal(kAstI32);
+  TestingModule module;
+  byte* memory = module.AddMemoryElems<byte>(kNumElems);
+  module.RandomizeMemory(1118);
+  r.env()->module = &module;
+
+  // The signed induction variable runs from the first parameter up to the
+  // second one.
+  BUILD(r,
+        WASM_BLOCK(
+            2, WASM_WHILE(
+                   WASM_I32_LTS(WASM_GET_LOCAL(0), WASM_GET_LOCAL(1)),
+                   WASM_BLOCK(
+                       2, WASM_SET_LOCAL(
+                              kSum, WASM_I32_ADD(
+                                        WASM_GET_LOCAL(kSum),
+                                        WASM_LOAD_MEM(kMachUint8,
+                                                      WASM_GET_LOCAL(0)))),
+                       WASM_INC_LOCAL(0))),
+            WASM_GET_LOCAL(kSum)));
+
+  for (int32_t start = 0; start <= kNumElems; start++) {
+    int32_t expected = 0;
+    for (int32_t end = start; end <= kNumElems; end++) {
+      CHECK_EQ(expected, r.Call(start, end));
+      if (end < kNumElems) expected += memory[end];
+    }
+    CHECK_TRAP(r.Call(start, kNumElems + 1));
+  }
+  // Loops that do not run never access the memory.
+  CHECK_EQ(0, r.Call(-1, -1));
+  CHECK_EQ(0, r.Call(-5, -10));
+  CHECK_EQ(0, r.Call(kNumElems + 1, kNumElems));
+  CHECK_EQ(0, r.Call(0x7fffffff, std::numeric_limits<int32_t>::min()));
+  // Negative indexes are out of bounds.
+  CHECK_TRAP(r.Call(-1, 1));
+  CHECK_TRAP(r.Call(std::numeric_limits<int32_t>::min(), 0));
+}
+
 TEST(Run_Wasm_LoadMemI32_oob_asm) {
   WasmRunner<int32_t> r(kMachUint32);
   TestingModule module;
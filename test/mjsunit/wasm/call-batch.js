@@ -0,0 +1,91 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+load("test/mjsunit/wasm/wasm-constants.js");
+
+var module = (function () {
+  var kBodySize1 = 6;
+  var kBodySize2 = 4;
+  var kScaleOffset = 30 + kBodySize1 + kBodySize2;
+  var kCheckOffset = kScaleOffset + 6;
+
+  return WASM.instantiateModule(bytes(
+    // -- signatures
+    kDeclSignatures, 2,
+    2, kAstF64, kAstI32, kAstF64,  // (int, double) -> double
+    1, kAstStmt, kAstI32,          // int -> void
+    kDeclFunctions, 2,
+    // -- function #0 (scale)
+    kDeclFunctionName | kDeclFunctionExport,
+    0, 0,                          // signature index
+    kScaleOffset, 0, 0, 0,         // name offset
+    kBodySize1, 0,                 // body size
+    kExprF64Mul,
+    kExprF64SConvertI32,
+    kExprGetLocal, 0,
+    kExprGetLocal, 1,
+    // -- function #1 (check)
+    kDeclFunctionName | kDeclFunctionExport,
+    1, 0,                          // signature index
+    kCheckOffset, 0, 0, 0,         // name offset
+    kBodySize2, 0,                 // body size
+    kExprIf,
+    kExprGetLocal, 0,
+    kExprUnreachable,
+    kDeclEnd,
+    's', 'c', 'a', 'l', 'e', 0,    // name
+    'c', 'h', 'e', 'c', 'k', 0     // name
+  ));
+})();
+
+// A batch computes the same results as single calls.
+var n = 1000;
+var ints = new Int32Array(n);
+var doubles = new Float64Array(n);
+var results = new Float64Array(n);
+for (var i = 0; i < n; i++) {
+  ints[i] = i - 500;
+  doubles[i] = i * 0.25;
+}
+WASM.callBatch(module.scale, results, ints, doubles);
+for (var i = 0; i < n; i++) {
+  assertEquals(module.scale(ints[i], doubles[i]), results[i]);
+}
+
+// Views start at their offset into the buffer.
+var buffer = new ArrayBuffer(8 * 8);
+var view = new Float64Array(buffer, 16, 4);
+WASM.callBatch(module.scale, view, new Int32Array([1, 2, 3, 4]),
+               new Float64Array([0.5, 0.5, 0.5, 0.5]));
+var all = new Float64Array(buffer);
+assertEquals([0, 0, 0.5, 1, 1.5, 2, 0, 0], Array.prototype.slice.call(all));
+
+// Empty batches make no calls.
+WASM.callBatch(module.scale, new Float64Array(0), new Int32Array(0),
+               new Float64Array(0));
+
+// Functions without results take undefined instead of the results.
+WASM.callBatch(module.check, undefined, new Int32Array(10));
+var exception = "";
+try {
+  WASM.callBatch(module.check, undefined, new Int32Array([0, 0, 1]));
+} catch (e) {
+  exception = e;
+}
+assertEquals("unreachable", exception);
+
+// The arrays have to match the signature and each other.
+assertThrows(function() {
+  WASM.callBatch(function(a, b) { return a * b; }, results, ints, doubles);
+});
+assertThrows(function() {
+  WASM.callBatch(module.scale, results, doubles, doubles);
+});
+assertThrows(function() { WASM.callBatch(module.scale, results, ints); });
+assertThrows(function() {
+  WASM.callBatch(module.scale, new Float64Array(3), ints, doubles);
+});
+assertThrows(function() {
+  WASM.callBatch(module.check, new Int32Array(3), new Int32Array(3));
+});
@@ -0,0 +1,65 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+load("test/mjsunit/wasm/wasm-constants.js");
+
+var kBodySize = 5;
+var kNameGetOffset = 26 + kBodySize + 1;
+var kNameMainOffset = kNameGetOffset + 4;
+
+var data = bytes(
+  // -- memory
+  kDeclMemory,
+  10, 10, 1,
+  // -- signatures
+  kDeclSignatures, 1,
+  0, kAstI32,                 // signature: void -> int
+  kDeclFunctions, 2,
+  // -- imported function
+  kDeclFunctionName | kDeclFunctionImport,
+  0, 0,                       // signature index
+  kNameGetOffset, 0, 0, 0,    // name offset
+  // -- main function
+  kDeclFunctionName | kDeclFunctionExport,
+  0, 0,                       // signature index
+  kNameMainOffset, 0, 0, 0,   // name offset
+  kBodySize, 0,               // body size
+  // -- body
+  kExprI32Add,                // --
+  kExprCallFunction, 0,       // --
+  kExprI8Const, 1,            // --
+  kDeclEnd,
+  'g', 'e', 't', 0,           // name
+  'm', 'a', 'i', 'n', 0       // name
+);
+
+var compiled = WASM.compileModule(data);
+assertEquals("object", typeof compiled);
+
+// The compiled module does not refer to the bytes it was compiled from.
+new Uint8Array(data).fill(0);
+
+// Each instance has its own imports and memory.
+var first = WASM.instantiate(compiled, {get: function() { return 10; }});
+var second = WASM.instantiate(compiled, {get: function() { return 20; }});
+assertEquals(11, first.main());
+assertEquals(21, second.main());
+assertEquals(11, first.main());
+assertTrue(first.memory instanceof ArrayBuffer);
+assertFalse(first.memory === second.memory);
+
+// Instances can use memory provided by the caller.
+var memory = new ArrayBuffer(1024);
+var third = WASM.instantiate(compiled, {get: function() { return 30; }},
+                             memory);
+assertEquals(31, third.main());
+assertEquals(memory, third.memory);
+
+// Errors.
+assertThrows(function() { WASM.compileModule(); });
+assertThrows(function() { WASM.compileModule(new ArrayBuffer(3)); });
+assertThrows(function() { WASM.instantiate(); });
+assertThrows(function() { WASM.instantiate({}); });
+assertThrows(function() { WASM.instantiate(first); });
+assertThrows(function() { WASM.instantiate(compiled); });
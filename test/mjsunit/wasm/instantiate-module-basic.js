@@ -58,3 +58,20 @@ assertFalse(module.main === 0);
 assertEquals("function", typeof module.main);
 
 assertEquals(kReturnValue, module.main());
+
+// Modules can be read from a view into a larger buffer.
+var kPadding = 13;
+var embedded = new Uint8Array(kPadding + data.byteLength + kPadding);
+embedded.fill(0xff);
+embedded.set(new Uint8Array(data), kPadding);
+var view = new Uint8Array(embedded.buffer, kPadding, data.byteLength);
+WASM.verifyModule(view);
+assertEquals(kReturnValue, WASM.instantiateModule(view).main());
+assertEquals(kReturnValue,
+             WASM.instantiateModule(new DataView(embedded.buffer, kPadding,
+                                                 data.byteLength)).main());
+assertThrows(function() { WASM.verifyModule(embedded); });
+
+// The buffer can still be used normally afterwards.
+embedded[0] = 1;
+assertEquals(1, embedded[0]);
@@ -0,0 +1,72 @@
+// Copyright 2015 the V8 project authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+load("test/mjsunit/wasm/wasm-constants.js");
+
+var kBodySize = 11;
+var kNameOffset = 35 + kBodySize;
+var kDataOffset = kNameOffset + 4;
+
+var data = bytes(
+  // -- memory
+  kDeclMemory,
+  12, 12, 1,
+  // -- signatures
+  kDeclSignatures, 1,
+  0, kAstI32,                 // signature: void -> int
+  kDeclFunctions, 1,
+  // -- increments the word at address 0 and returns it
+  kDeclFunctionName | kDeclFunctionExport,
+  0, 0,                       // signature index
+  kNameOffset, 0, 0, 0,       // name offset
+  kBodySize, 0,               // body size
+  // -- body
+  kExprI32StoreMem, 0,        // --
+  kExprI8Const, 0,            // --
+  kExprI32Add,                // --
+  kExprI32LoadMem, 0,         // --
+  kExprI8Const, 0,            // --
+  kExprI8Const, 1,            // --
+  // -- data segment
+  kDeclDataSegments, 1,
+  0, 0, 0, 0,                 // dest addr
+  kDataOffset, 0, 0, 0,       // source offset
+  4, 0, 0, 0,                 // source size
+  1,                          // init
+  kDeclEnd,
+  'i', 'n', 'c', 0,           // name
+  5, 0, 0, 0                  // data
+);
+
+var compiled = WASM.compileModule(data);
+var instance = WASM.instantiate(compiled);
+assertEquals(6, instance.inc());
+assertEquals(7, instance.inc());
+var view = new Uint8Array(instance.memory);
+view[100] = 42;
+
+// Resetting restores the data segments and clears the rest of the memory,
+// and keeps the exports and views of the memory.
+assertTrue(WASM.resetInstance(instance));
+assertEquals(0, view[100]);
+assertEquals(5, view[0]);
+assertEquals(6, instance.inc());
+assertEquals(6, view[0]);
+assertTrue(WASM.resetInstance(instance));
+assertEquals(6, instance.inc());
+
+// Other instances of the compiled module are not affected.
+var other = WASM.instantiate(compiled);
+assertEquals(6, other.inc());
+assertTrue(WASM.resetInstance(instance));
+assertEquals(7, other.inc());
+
+// Only memory allocated at instantiation can be reset, and only instances
+// of compiled modules.
+var memory = new ArrayBuffer(4096);
+assertFalse(WASM.resetInstance(WASM.instantiate(compiled, {}, memory)));
+assertFalse(WASM.resetInstance(WASM.instantiateModule(data)));
+assertFalse(WASM.resetInstance({}));
+assertThrows(function() { WASM.resetInstance(); });
+assertThrows(function() { WASM.resetInstance(1); });
@@ -7,3 +7,11 @@ assertFalse(undefined == WASM);
 assertEquals("function", typeof WASM.verifyModule);
 assertEquals("function", typeof WASM.verifyFunction);
 assertEquals("function", typeof WASM.compileRun);
+assertEquals("function", typeof WASM.callBatch);
+assertEquals("function", typeof WASM.instantiateModuleAsync);
+assertEquals("function", typeof WASM.compileModule);
+assertEquals("undefined", typeof WASM.compileModuleFile);
+assertEquals("function", typeof WASM.instantiate);
+assertEquals("function", typeof WASM.resetInstance);
+assertEquals("function", typeof WASM.snapshotInstance);
+assertEquals("function", typeof WASM.instantiateSnapshot);
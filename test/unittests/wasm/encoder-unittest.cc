@@ -8,6 +8,7 @@
 
 #include "src/wasm/encoder.h"
 #include "src/wasm/ast-decoder.h"
+#include "src/wasm/module-decoder.h"
 
 namespace v8 {
 namespace internal {
@@ -120,6 +121,38 @@ TEST_F(EncoderTest, Function_Builder_Indexing_Variable_Width) {
   CHECK_EQ(0x00, static_cast<size_t>(*(body + 2*127 + 4)));
 }
 
+TEST_F(EncoderTest, Function_Builder_Names) {
+  Zone zone;
+  WasmModuleBuilder* builder = new(&zone) WasmModuleBuilder(&zone);
+  WasmFunctionBuilder* import = builder->FunctionAt(builder->AddFunction());
+  import->External(1);
+  import->SetName("imported");
+  WasmFunctionBuilder* main = builder->FunctionAt(builder->AddFunction());
+  main->Exported(1);
+  main->SetName("main");
+  byte code[] = {kExprCallFunction, 0};
+  main->EmitCode(code, sizeof(code));
+  WasmModuleIndex* module = builder->Build(&zone)->WriteTo(&zone);
+
+  // The names follow the end of the module, and the bodies are unchanged.
+  ModuleResult result = DecodeWasmModule(nullptr, &zone, module->Begin(),
+                                         module->End(), false, false);
+  CHECK(result.ok());
+  WasmModule* decoded = result.val;
+  CHECK_EQ(2, decoded->functions->size());
+  WasmFunction* function = &decoded->functions->at(0);
+  CHECK(function->external);
+  CHECK_EQ(0, strcmp("imported", decoded->GetName(function->name_offset)));
+  function = &decoded->functions->at(1);
+  CHECK(function->exported);
+  CHECK_EQ(0, strcmp("main", decoded->GetName(function->name_offset)));
+  CHECK_EQ(sizeof(code),
+           function->code_end_offset - function->code_start_offset);
+  CHECK_EQ(0, memcmp(code, module->Begin() + function->code_start_offset,
+                     sizeof(code)));
+  delete decoded;
+}
+
 TEST_F(EncoderTest, LEB_Functions) {
   byte leb_value[5] = {0, 0, 0, 0, 0};
   CheckReadValue(leb_value, 0, 1, kNoError);
@@ -657,6 +657,119 @@ TEST_F(WasmModuleVerifyTest, IndirectFunctionInvalidIndex) {
 }
 
 
+TEST_F(WasmModuleVerifyTest, StreamingDecodesCompleteEntries) {
+  static const byte data[] = {
+      // sig#0 -------------------------------------------------------
+      kDeclSignatures, 1,
+      0, 0,                          // void -> void
+      // func#0 ------------------------------------------------------
+      kDeclFunctions, 1,
+      kDeclFunctionExport,
+      0, 0,                          // signature index
+      2, 0,                          // size
+      kExprNop, kExprNop,
+  };
+  static const size_t kFunctionEnd = arraysize(data);
+  static const size_t kSignaturesEnd = 4;
+
+  StreamingModuleDecoder decoder(zone());
+  for (size_t i = 0; i < arraysize(data); i++) {
+    decoder.AddBytes(data + i, 1);
+    // Entries appear once all of their bytes have arrived.
+    EXPECT_EQ(i + 1 >= kSignaturesEnd,
+              decoder.IsComplete(kDeclSignatures));
+    EXPECT_EQ(i + 1 >= kFunctionEnd ? 1 : 0,
+              decoder.module()->functions->size());
+  }
+  EXPECT_TRUE(decoder.IsComplete(kDeclFunctions));
+  WasmFunction* function = &decoder.module()->functions->back();
+  EXPECT_EQ(kFunctionEnd - 2, function->code_start_offset);
+  EXPECT_EQ(kFunctionEnd, function->code_end_offset);
+}
+
+
+TEST_F(WasmModuleVerifyTest, StreamingStopsAtFirstError) {
+  static const byte data[] = {
+      // sig#0 -------------------------------------------------------
+      kDeclSignatures, 1,
+      0, 0,                          // void -> void
+      0x7f,                          // unrecognized section
+      // globals -----------------------------------------------------
+      kDeclGlobals, 0,
+  };
+  static const size_t kErrorPos = 4;
+
+  StreamingModuleDecoder decoder(zone());
+  for (size_t i = 0; i < arraysize(data); i++) {
+    // The invalid section fails as soon as it arrives, and the bytes after
+    // it are ignored.
+    EXPECT_EQ(i < kErrorPos, decoder.AddBytes(data + i, 1));
+    EXPECT_EQ(i >= kErrorPos, decoder.failed());
+  }
+  EXPECT_FALSE(decoder.IsComplete(kDeclGlobals));
+  ModuleResult result = decoder.Finish();
+  EXPECT_FALSE(result.ok());
+  EXPECT_EQ(kErrorPos, static_cast<size_t>(result.error_pc - result.start));
+}
+
+
+TEST_F(WasmModuleVerifyTest, StreamingFailsOnDuplicateSection) {
+  static const byte data[] = {
+      kDeclGlobals, 0,
+      kDeclGlobals, 0,
+  };
+
+  StreamingModuleDecoder decoder(zone());
+  EXPECT_FALSE(decoder.AddBytes(data, arraysize(data)));
+  EXPECT_FALSE(decoder.Finish().ok());
+}
+
+
+TEST_F(WasmModuleVerifyTest, StreamingFailsOnTruncatedSection) {
+  static const byte data[] = {
+      // sig#0 -------------------------------------------------------
+      kDeclSignatures, 2,
+      0, 0,                          // void -> void
+  };
+
+  // The missing signature may still arrive until the module is complete.
+  StreamingModuleDecoder decoder(zone());
+  EXPECT_TRUE(decoder.AddBytes(data, arraysize(data)));
+  EXPECT_FALSE(decoder.failed());
+  EXPECT_FALSE(decoder.Finish().ok());
+}
+
+
+TEST_F(WasmModuleVerifyTest, StreamingChecksOffsetsAtFinish) {
+  static const byte data[] = {
+      kDeclGlobals, 1,
+      9, 0, 0, 0,                    // name offset
+      kMemI32,                       // memory type
+      0,                             // exported
+      kDeclEnd,
+      'a', 0,                        // name
+  };
+
+  {
+    // The name arrives in the second chunk.
+    StreamingModuleDecoder decoder(zone());
+    EXPECT_TRUE(decoder.AddBytes(data, 8));
+    EXPECT_TRUE(decoder.AddBytes(data + 8, arraysize(data) - 8));
+    ModuleResult result = decoder.Finish();
+    EXPECT_TRUE(result.ok());
+    EXPECT_EQ(1, result.val->globals->size());
+  }
+
+  {
+    // The name never arrives.
+    StreamingModuleDecoder decoder(zone());
+    EXPECT_TRUE(decoder.AddBytes(data, 8));
+    ModuleResult result = decoder.Finish();
+    EXPECT_FALSE(result.ok());
+    EXPECT_EQ(2, result.error_pc - result.start);
+  }
+}
+
 class WasmSignatureDecodeTest : public TestWithZone {};
 
 